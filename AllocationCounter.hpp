@@ -0,0 +1,188 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <cstdint>
+
+#ifndef ALLOCATIONCOUNTER_HPP
+#define ALLOCATIONCOUNTER_HPP
+
+#ifdef NM_ALLOCATION_COUNTER
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+constexpr const char *allocationsIntf =
+    "xyz.openbmc_project.NodeManagerProxy.Allocations";
+
+/**
+ * @brief Counts heap allocations made through operator new. Memory allocated
+ * directly with malloc (e.g. by libsystemd) is not accounted.
+ */
+class AllocationCounter
+{
+  public:
+    /**
+     * @brief Allocations of the calling thread are counted as scoped while
+     * any Scope is alive, e.g. during the poll loop handlers
+     */
+    class Scope
+    {
+      public:
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        Scope()
+        {
+            scopeDepth++;
+        }
+
+        ~Scope()
+        {
+            scopeDepth--;
+        }
+    };
+
+    /**
+     * @brief Allocations of the calling thread are not counted as scoped
+     * while any Exclude is alive, e.g. in the Dbus transport
+     */
+    class Exclude
+    {
+      public:
+        Exclude(const Exclude &) = delete;
+        Exclude &operator=(const Exclude &) = delete;
+
+        Exclude()
+        {
+            excludeDepth++;
+        }
+
+        ~Exclude()
+        {
+            excludeDepth--;
+        }
+    };
+
+    static void allocated()
+    {
+        total.fetch_add(1, std::memory_order_relaxed);
+        live.fetch_add(1, std::memory_order_relaxed);
+        if (scopeDepth > 0 && excludeDepth == 0)
+        {
+            scoped++;
+        }
+    }
+
+    static void freed()
+    {
+        live.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    static uint64_t getTotal()
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t getLive()
+    {
+        return live.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Scoped allocations made so far by the calling thread
+     */
+    static uint64_t getScoped()
+    {
+        return scoped;
+    }
+
+  private:
+    static inline std::atomic<uint64_t> total{0};
+    static inline std::atomic<uint64_t> live{0};
+    static inline thread_local uint64_t scoped{0};
+    static inline thread_local uint32_t scopeDepth{0};
+    static inline thread_local uint32_t excludeDepth{0};
+};
+
+#define NM_ALLOCATIONS_SCOPE() AllocationCounter::Scope allocationsScope
+#define NM_ALLOCATIONS_EXCLUDED()                                              \
+    AllocationCounter::Exclude allocationsExcluded
+
+// Replacements of the global allocation functions, this header must be
+// included by exactly one translation unit
+void *operator new(size_t size)
+{
+    void *ptr = std::malloc(size ? size : 1);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    AllocationCounter::allocated();
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    void *ptr = std::malloc(size ? size : 1);
+    if (ptr != nullptr)
+    {
+        AllocationCounter::allocated();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (ptr != nullptr)
+    {
+        AllocationCounter::freed();
+        std::free(ptr);
+    }
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+#else
+
+#define NM_ALLOCATIONS_SCOPE()
+#define NM_ALLOCATIONS_EXCLUDED()
+
+#endif
+
+#endif
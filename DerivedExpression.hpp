@@ -0,0 +1,380 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef DERIVEDEXPRESSION_HPP
+#define DERIVEDEXPRESSION_HPP
+
+/**
+ * @brief Arithmetic over sensor readings, e.g.
+ * "Total_Power - CPU_Power - Memory_Power" or
+ * "100 * CPU_Power / Total_Power". Supports numbers, sensor names, + - * /,
+ * unary minus and parentheses.
+ *
+ * The text is compiled once into a postfix plan, so evaluation is a single
+ * pass over it with a stack sized at compile time and does not allocate.
+ * NaN inputs and division by zero give NaN.
+ */
+class DerivedExpression
+{
+  public:
+    /**
+     * @brief Compiles expression, nullopt when it is not valid
+     */
+    static std::optional<DerivedExpression> compile(const std::string &text)
+    {
+        DerivedExpression expression;
+        Parser parser{text, 0, expression, 0};
+        if (!parser.parseSum() || parser.skipSpaces() != text.size())
+        {
+            return std::nullopt;
+        }
+        expression.stack.resize(parser.maxDepth);
+        return expression;
+    }
+
+    /**
+     * @brief Names of the inputs, in the order evaluate() takes their values
+     */
+    const std::vector<std::string> &getInputs() const
+    {
+        return inputs;
+    }
+
+    double evaluate(const std::vector<double> &values)
+    {
+        size_t top = 0;
+        for (const Op &op : plan)
+        {
+            switch (op.code)
+            {
+                case OpCode::constant:
+                    stack[top++] = op.constant;
+                    break;
+                case OpCode::input:
+                    stack[top++] = values[op.input];
+                    break;
+                case OpCode::negate:
+                    stack[top - 1] = -stack[top - 1];
+                    break;
+                default:
+                    top--;
+                    stack[top - 1] =
+                        apply(op.code, stack[top - 1], stack[top]);
+                    break;
+            }
+        }
+        return stack[0];
+    }
+
+    /**
+     * @brief Range of the result for inputs within their ranges, by interval
+     * arithmetic. NaN when an input range is not known or a divisor range
+     * includes zero.
+     */
+    void bounds(const std::vector<double> &inputMins,
+                const std::vector<double> &inputMaxs, double &min,
+                double &max) const
+    {
+        std::vector<double> mins(stack.size());
+        std::vector<double> maxs(stack.size());
+        size_t top = 0;
+        for (const Op &op : plan)
+        {
+            switch (op.code)
+            {
+                case OpCode::constant:
+                    mins[top] = maxs[top] = op.constant;
+                    top++;
+                    break;
+                case OpCode::input:
+                    mins[top] = inputMins[op.input];
+                    maxs[top] = inputMaxs[op.input];
+                    top++;
+                    break;
+                case OpCode::negate:
+                    std::swap(mins[top - 1], maxs[top - 1]);
+                    mins[top - 1] = -mins[top - 1];
+                    maxs[top - 1] = -maxs[top - 1];
+                    break;
+                default:
+                    top--;
+                    applyBounds(op.code, mins[top - 1], maxs[top - 1],
+                                mins[top], maxs[top]);
+                    break;
+            }
+        }
+        min = mins[0];
+        max = maxs[0];
+    }
+
+  private:
+    enum class OpCode : uint8_t
+    {
+        constant,
+        input,
+        negate,
+        add,
+        subtract,
+        multiply,
+        divide
+    };
+
+    struct Op
+    {
+        OpCode code;
+        size_t input;
+        double constant;
+    };
+
+    std::vector<Op> plan;
+    std::vector<std::string> inputs;
+    std::vector<double> stack;
+
+    static double apply(OpCode code, double left, double right)
+    {
+        switch (code)
+        {
+            case OpCode::add:
+                return left + right;
+            case OpCode::subtract:
+                return left - right;
+            case OpCode::multiply:
+                return left * right;
+            default:
+                return right == 0 ? std::numeric_limits<double>::quiet_NaN()
+                                  : left / right;
+        }
+    }
+
+    // left range becomes the range of the result
+    static void applyBounds(OpCode code, double &leftMin, double &leftMax,
+                            double rightMin, double rightMax)
+    {
+        constexpr double unknown = std::numeric_limits<double>::quiet_NaN();
+        switch (code)
+        {
+            case OpCode::add:
+                leftMin += rightMin;
+                leftMax += rightMax;
+                return;
+            case OpCode::subtract:
+                leftMin -= rightMax;
+                leftMax -= rightMin;
+                return;
+            case OpCode::divide:
+                if (!(rightMin > 0 || rightMax < 0))
+                {
+                    leftMin = leftMax = unknown;
+                    return;
+                }
+                std::swap(rightMin, rightMax);
+                rightMin = 1 / rightMin;
+                rightMax = 1 / rightMax;
+                break;
+            default:
+                break;
+        }
+        if (std::isnan(leftMin + leftMax + rightMin + rightMax))
+        {
+            leftMin = leftMax = unknown;
+            return;
+        }
+        double products[] = {leftMin * rightMin, leftMin * rightMax,
+                             leftMax * rightMin, leftMax * rightMax};
+        leftMin = *std::min_element(std::begin(products), std::end(products));
+        leftMax = *std::max_element(std::begin(products), std::end(products));
+    }
+
+    /**
+     * @brief Recursive descent parser emitting the postfix plan and tracking
+     * the stack depth it needs
+     */
+    struct Parser
+    {
+        const std::string &text;
+        size_t pos;
+        DerivedExpression &expression;
+        size_t depth;
+        size_t maxDepth{0};
+
+        size_t skipSpaces()
+        {
+            while (pos < text.size() &&
+                   std::isspace(static_cast<unsigned char>(text[pos])))
+            {
+                pos++;
+            }
+            return pos;
+        }
+
+        bool accept(char c)
+        {
+            if (skipSpaces() < text.size() && text[pos] == c)
+            {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        void emit(OpCode code, size_t input = 0, double constant = 0)
+        {
+            expression.plan.push_back(Op{code, input, constant});
+            if (code == OpCode::constant || code == OpCode::input)
+            {
+                maxDepth = std::max(maxDepth, ++depth);
+            }
+            else if (code != OpCode::negate)
+            {
+                depth--;
+            }
+        }
+
+        bool parseSum()
+        {
+            if (!parseProduct())
+            {
+                return false;
+            }
+            while (true)
+            {
+                OpCode code;
+                if (accept('+'))
+                {
+                    code = OpCode::add;
+                }
+                else if (accept('-'))
+                {
+                    code = OpCode::subtract;
+                }
+                else
+                {
+                    return true;
+                }
+                if (!parseProduct())
+                {
+                    return false;
+                }
+                emit(code);
+            }
+        }
+
+        bool parseProduct()
+        {
+            if (!parseUnary())
+            {
+                return false;
+            }
+            while (true)
+            {
+                OpCode code;
+                if (accept('*'))
+                {
+                    code = OpCode::multiply;
+                }
+                else if (accept('/'))
+                {
+                    code = OpCode::divide;
+                }
+                else
+                {
+                    return true;
+                }
+                if (!parseUnary())
+                {
+                    return false;
+                }
+                emit(code);
+            }
+        }
+
+        bool parseUnary()
+        {
+            if (accept('-'))
+            {
+                if (!parseUnary())
+                {
+                    return false;
+                }
+                emit(OpCode::negate);
+                return true;
+            }
+            return parsePrimary();
+        }
+
+        bool parsePrimary()
+        {
+            if (accept('('))
+            {
+                return parseSum() && accept(')');
+            }
+            if (skipSpaces() >= text.size())
+            {
+                return false;
+            }
+
+            unsigned char c = static_cast<unsigned char>(text[pos]);
+            if (std::isdigit(c) || c == '.')
+            {
+                const char *begin = text.c_str() + pos;
+                char *end = nullptr;
+                double value = std::strtod(begin, &end);
+                if (end == begin)
+                {
+                    return false;
+                }
+                pos += static_cast<size_t>(end - begin);
+                emit(OpCode::constant, 0, value);
+                return true;
+            }
+            if (std::isalpha(c) || c == '_')
+            {
+                size_t begin = pos;
+                while (pos < text.size() &&
+                       (std::isalnum(static_cast<unsigned char>(text[pos])) ||
+                        text[pos] == '_'))
+                {
+                    pos++;
+                }
+                std::string name = text.substr(begin, pos - begin);
+                auto &inputs = expression.inputs;
+                size_t input = static_cast<size_t>(
+                    std::find(inputs.begin(), inputs.end(), name) -
+                    inputs.begin());
+                if (input == inputs.size())
+                {
+                    inputs.push_back(std::move(name));
+                }
+                emit(OpCode::input, input);
+                return true;
+            }
+            return false;
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,150 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef HANDLERMEMORY_HPP
+#define HANDLERMEMORY_HPP
+
+constexpr size_t handlerMemorySize = 128; // bytes, an asio operation
+
+/**
+ * @brief Memory of one asio operation at a time, reused by handlers posted
+ * over and over, e.g. for every polled frame. Taken on one thread and given
+ * back on another, falls back to the heap while taken.
+ */
+class HandlerMemory
+{
+  public:
+    HandlerMemory() = default;
+    HandlerMemory(const HandlerMemory &) = delete;
+    HandlerMemory &operator=(const HandlerMemory &) = delete;
+
+    void *allocate(size_t size)
+    {
+        if (size <= sizeof(storage) && !inUse.exchange(true))
+        {
+            return &storage;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void *pointer)
+    {
+        if (pointer == &storage)
+        {
+            inUse = false;
+            return;
+        }
+        ::operator delete(pointer);
+    }
+
+  private:
+    std::aligned_storage_t<handlerMemorySize> storage;
+    std::atomic<bool> inUse{false};
+};
+
+/**
+ * @brief Allocator of asio operations from HandlerMemory
+ */
+template <typename T>
+class HandlerAllocator
+{
+  public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory &memoryArg) noexcept :
+        memory(&memoryArg)
+    {
+    }
+
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U> &other) noexcept :
+        memory(other.memory)
+    {
+    }
+
+    T *allocate(size_t count)
+    {
+        return static_cast<T *>(memory->allocate(sizeof(T) * count));
+    }
+
+    void deallocate(T *pointer, size_t)
+    {
+        memory->deallocate(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const HandlerAllocator<U> &other) const noexcept
+    {
+        return memory == other.memory;
+    }
+
+    template <typename U>
+    bool operator!=(const HandlerAllocator<U> &other) const noexcept
+    {
+        return memory != other.memory;
+    }
+
+  private:
+    template <typename>
+    friend class HandlerAllocator;
+
+    HandlerMemory *memory;
+};
+
+/**
+ * @brief Handler whose operation asio allocates from the given memory
+ */
+template <typename Handler>
+class AllocatingHandler
+{
+  public:
+    using allocator_type = HandlerAllocator<Handler>;
+
+    AllocatingHandler(HandlerMemory &memoryArg, Handler handlerArg) :
+        memory(memoryArg), handler(std::move(handlerArg))
+    {
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(memory);
+    }
+
+    template <typename... Args>
+    void operator()(Args &&... args)
+    {
+        handler(std::forward<Args>(args)...);
+    }
+
+  private:
+    HandlerMemory &memory;
+    Handler handler;
+};
+
+template <typename Handler>
+AllocatingHandler<std::decay_t<Handler>>
+    makeAllocatingHandler(HandlerMemory &memory, Handler &&handler)
+{
+    return AllocatingHandler<std::decay_t<Handler>>(
+        memory, std::forward<Handler>(handler));
+}
+
+#endif
@@ -0,0 +1,444 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "NodeManagerProxy.hpp"
+#include "ProxyClock.hpp"
+
+#include <boost/asio/post.hpp>
+#include <boost/container/flat_map.hpp>
+#include <phosphor-logging/log.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef IPMBREPLAY_HPP
+#define IPMBREPLAY_HPP
+
+/**
+ * @brief IPMB log file layout. The file starts with IpmbLogHeader followed by
+ * records, each being IpmbLogRecord and then requestSize bytes of request
+ * and responseSize bytes of response payload. Native byte order.
+ */
+constexpr uint32_t ipmbLogMagic = 0x524d4e4e; // "NNMR"
+constexpr uint16_t ipmbLogVersion = 1;
+
+struct IpmbLogHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+};
+static_assert(sizeof(IpmbLogHeader) == 8);
+
+constexpr uint8_t ipmbLogFlagAsync = 0x1;     // sent by the poll loop
+constexpr uint8_t ipmbLogFlagDbusError = 0x2; // no response from Ipmb service
+
+struct IpmbLogRecord
+{
+    uint64_t timestampUs; // CLOCK_REALTIME of the request
+    uint32_t latencyUs;
+    int32_t status;
+    uint8_t channel;
+    uint8_t netFn;
+    uint8_t lun;
+    uint8_t cmd;
+    uint8_t cc;
+    uint8_t flags;
+    uint8_t requestSize;
+    uint8_t responseSize;
+    uint8_t responseNetFn;
+    uint8_t responseLun;
+    uint8_t responseCmd;
+    uint8_t reserved[5];
+};
+static_assert(sizeof(IpmbLogRecord) == 32);
+
+/**
+ * @brief Passes requests to another transport, appending every request and
+ * response pair to the IPMB log
+ */
+class RecordingIpmbTransport : public IpmbTransport
+{
+  public:
+    RecordingIpmbTransport(const RecordingIpmbTransport &) = delete;
+    RecordingIpmbTransport &operator=(const RecordingIpmbTransport &) = delete;
+
+    RecordingIpmbTransport(std::shared_ptr<IpmbTransport> transportArg,
+                           const std::string &path) :
+        transport(transportArg)
+    {
+        file = std::fopen(path.c_str(), "wb");
+        IpmbLogHeader header{ipmbLogMagic, ipmbLogVersion,
+                             sizeof(IpmbLogRecord)};
+        if (file == nullptr ||
+            std::fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "RecordingIpmbTransport: cannot create log, not recording",
+                phosphor::logging::entry("FILE=%s", path.c_str()));
+            if (file != nullptr)
+            {
+                std::fclose(file);
+                file = nullptr;
+            }
+        }
+    }
+
+    ~RecordingIpmbTransport()
+    {
+        if (file != nullptr)
+        {
+            std::fclose(file);
+        }
+    }
+
+    void asyncSendRequest(uint8_t channel,
+                          const std::vector<uint8_t> &dataToSend,
+                          uint8_t netFn, uint8_t lun, uint8_t cmd,
+                          IpmbHandler handler) override
+    {
+        NM_ALLOCATIONS_EXCLUDED();
+        IpmbLogRecord record = makeRecord(channel, netFn, lun, cmd);
+        record.flags = ipmbLogFlagAsync;
+        transport->asyncSendRequest(
+            channel, dataToSend, netFn, lun, cmd,
+            [this, record, request{dataToSend},
+             start{std::chrono::steady_clock::now()},
+             handler{std::move(handler)}](boost::system::error_code ec,
+                                          IpmbDbusRspType &response) mutable {
+                setLatency(record, start);
+                if (ec)
+                {
+                    record.flags |= ipmbLogFlagDbusError;
+                }
+                append(record, request, response);
+                handler(ec, response);
+            });
+    }
+
+  private:
+    std::shared_ptr<IpmbTransport> transport;
+    FILE *file{nullptr};
+    std::mutex fileMutex; // requests are recorded by both threads
+
+    static IpmbLogRecord makeRecord(uint8_t channel, uint8_t netFn,
+                                    uint8_t lun, uint8_t cmd)
+    {
+        IpmbLogRecord record{};
+        record.timestampUs = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch())
+                .count());
+        record.channel = channel;
+        record.netFn = netFn;
+        record.lun = lun;
+        record.cmd = cmd;
+        return record;
+    }
+
+    static void setLatency(IpmbLogRecord &record,
+                           std::chrono::steady_clock::time_point start)
+    {
+        record.latencyUs = static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count());
+    }
+
+    void append(IpmbLogRecord &record, const std::vector<uint8_t> &request,
+                const IpmbDbusRspType &response)
+    {
+        const auto &[status, netFn, lun, cmd, cc, dataReceived] = response;
+        bool answered = !(record.flags & ipmbLogFlagDbusError);
+        record.status = answered ? status : -1;
+        record.cc = answered ? cc : 0;
+        record.responseNetFn = answered ? netFn : 0;
+        record.responseLun = answered ? lun : 0;
+        record.responseCmd = answered ? cmd : 0;
+        record.requestSize = static_cast<uint8_t>(
+            std::min<size_t>(request.size(), UINT8_MAX));
+        record.responseSize = static_cast<uint8_t>(
+            answered ? std::min<size_t>(dataReceived.size(), UINT8_MAX) : 0);
+
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (file == nullptr)
+        {
+            return;
+        }
+        std::fwrite(&record, sizeof(record), 1, file);
+        std::fwrite(request.data(), 1, record.requestSize, file);
+        std::fwrite(dataReceived.data(), 1, record.responseSize, file);
+        // Keep the log usable when the proxy is killed
+        std::fflush(file);
+    }
+};
+
+/**
+ * @brief Answers requests from a recorded IPMB log instead of the ME.
+ * Requests are matched by channel, command and payload, every match returns
+ * the next recorded response in order, so a session replays
+ * deterministically. Once all responses of a request were consumed the
+ * recording no longer covers the traffic: further matches fail and the end of
+ * the session is reported once.
+ */
+class ReplayIpmbTransport : public IpmbTransport
+{
+  public:
+    ReplayIpmbTransport(const ReplayIpmbTransport &) = delete;
+    ReplayIpmbTransport &operator=(const ReplayIpmbTransport &) = delete;
+
+    /**
+     * @param realTime - responses are delayed by the recorded latency,
+     * otherwise they are returned as fast as possible
+     * @param sessionEnded - called once when the first request runs out of
+     * recorded responses
+     */
+    ReplayIpmbTransport(boost::asio::io_context &pollIoArg,
+                        const std::string &path, bool realTimeArg,
+                        std::function<void()> sessionEndedArg = nullptr) :
+        pollIo(pollIoArg),
+        realTime(realTimeArg), sessionEnded(std::move(sessionEndedArg))
+    {
+        load(path);
+    }
+
+    void asyncSendRequest(uint8_t channel,
+                          const std::vector<uint8_t> &dataToSend,
+                          uint8_t netFn, uint8_t lun, uint8_t cmd,
+                          IpmbHandler handler) override
+    {
+        NM_ALLOCATIONS_EXCLUDED();
+        const Entry *entry = next(channel, netFn, lun, cmd, dataToSend);
+        auto respond = [entry, handler{std::move(handler)}]() {
+            IpmbDbusRspType response;
+            boost::system::error_code ec;
+            if (entry == nullptr || entry->dbusError)
+            {
+                ec = boost::system::errc::make_error_code(
+                    boost::system::errc::io_error);
+            }
+            else
+            {
+                response = entry->response;
+            }
+            handler(ec, response);
+        };
+
+        if (!realTime || entry == nullptr)
+        {
+            boost::asio::post(pollIo, std::move(respond));
+            return;
+        }
+        auto timer = std::make_shared<ProxyTimer>(pollIo);
+        timer->expires_after(entry->latency);
+        timer->async_wait(
+            [timer, respond{std::move(respond)}](
+                const boost::system::error_code &) { respond(); });
+    }
+
+  private:
+    struct Entry
+    {
+        IpmbDbusRspType response;
+        std::chrono::microseconds latency;
+        bool dbusError;
+    };
+
+    struct Responses
+    {
+        std::vector<Entry> entries;
+        size_t next{0};
+    };
+
+    using Key = std::tuple<uint8_t, uint8_t, uint8_t, uint8_t,
+                           std::vector<uint8_t>>;
+
+    boost::asio::io_context &pollIo;
+    bool realTime;
+    std::function<void()> sessionEnded;
+    bool ended{false};
+    boost::container::flat_map<Key, Responses> responses;
+    std::mutex responsesMutex; // requests are replayed by both threads
+
+    void load(const std::string &path)
+    {
+        FILE *file = std::fopen(path.c_str(), "rb");
+        IpmbLogHeader header{};
+        if (file == nullptr ||
+            std::fread(&header, sizeof(header), 1, file) != 1 ||
+            header.magic != ipmbLogMagic || header.version != ipmbLogVersion ||
+            header.recordSize != sizeof(IpmbLogRecord))
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "ReplayIpmbTransport: cannot read log",
+                phosphor::logging::entry("FILE=%s", path.c_str()));
+            if (file != nullptr)
+            {
+                std::fclose(file);
+            }
+            return;
+        }
+
+        size_t count = 0;
+        IpmbLogRecord record;
+        while (std::fread(&record, sizeof(record), 1, file) == 1)
+        {
+            std::vector<uint8_t> request(record.requestSize);
+            std::vector<uint8_t> data(record.responseSize);
+            if (std::fread(request.data(), 1, request.size(), file) !=
+                    request.size() ||
+                std::fread(data.data(), 1, data.size(), file) != data.size())
+            {
+                phosphor::logging::log<phosphor::logging::level::WARNING>(
+                    "ReplayIpmbTransport: truncated record, stopping");
+                break;
+            }
+
+            Entry entry{{record.status, record.responseNetFn,
+                         record.responseLun, record.responseCmd, record.cc,
+                         std::move(data)},
+                        std::chrono::microseconds(record.latencyUs),
+                        (record.flags & ipmbLogFlagDbusError) != 0};
+            responses[Key{record.channel, record.netFn, record.lun, record.cmd,
+                          std::move(request)}]
+                .entries.push_back(std::move(entry));
+            count++;
+        }
+        std::fclose(file);
+
+        phosphor::logging::log<phosphor::logging::level::INFO>(
+            "ReplayIpmbTransport: log loaded",
+            phosphor::logging::entry("FILE=%s", path.c_str()),
+            phosphor::logging::entry("RECORDS=%zu", count));
+    }
+
+    const Entry *next(uint8_t channel, uint8_t netFn, uint8_t lun, uint8_t cmd,
+                      const std::vector<uint8_t> &request)
+    {
+        std::lock_guard<std::mutex> lock(responsesMutex);
+        auto found = responses.find(Key{channel, netFn, lun, cmd, request});
+        if (found == responses.end())
+        {
+            phosphor::logging::log<phosphor::logging::level::WARNING>(
+                "ReplayIpmbTransport: request not in log",
+                phosphor::logging::entry("CHANNEL=%d", channel),
+                phosphor::logging::entry("NETFN=%d", netFn),
+                phosphor::logging::entry("CMD=%d", cmd));
+            return nullptr;
+        }
+        Responses &recorded = found->second;
+        if (recorded.next == recorded.entries.size())
+        {
+            if (!ended)
+            {
+                ended = true;
+                phosphor::logging::log<phosphor::logging::level::INFO>(
+                    "ReplayIpmbTransport: replay session ended",
+                    phosphor::logging::entry("CHANNEL=%d", channel),
+                    phosphor::logging::entry("NETFN=%d", netFn),
+                    phosphor::logging::entry("CMD=%d", cmd));
+                if (sessionEnded)
+                {
+                    sessionEnded();
+                }
+            }
+            return nullptr;
+        }
+        return &recorded.entries[recorded.next++];
+    }
+};
+
+/**
+ * @brief Returns wire size of the response to a command from the IpmiCommand
+ * descriptors, 0 for unknown commands
+ */
+template <typename... Reqs>
+size_t ipmiResponseSize(uint8_t netFn, uint8_t cmd)
+{
+    size_t size = 0;
+    ((IpmiCommand<Reqs>::netFn == netFn && IpmiCommand<Reqs>::cmd == cmd
+          ? (size = IpmiCommand<Reqs>::responseSize, true)
+          : false) ||
+     ...);
+    return size;
+}
+
+/**
+ * @brief Answers every known command immediately with a successful, zero
+ * filled response, except for capabilities wide enough to accept any policy.
+ * Lets the Dbus side be loaded without an ME.
+ */
+class SimulatedIpmbTransport : public IpmbTransport
+{
+  public:
+    SimulatedIpmbTransport(boost::asio::io_context &pollIoArg) :
+        pollIo(pollIoArg)
+    {
+    }
+
+    void asyncSendRequest(uint8_t channel,
+                          const std::vector<uint8_t> &dataToSend,
+                          uint8_t netFn, uint8_t lun, uint8_t cmd,
+                          IpmbHandler handler) override
+    {
+        NM_ALLOCATIONS_EXCLUDED();
+        boost::asio::post(pollIo, [this, netFn, lun, cmd,
+                                   handler{std::move(handler)}]() {
+            IpmbDbusRspType response = respond(netFn, lun, cmd);
+            handler(boost::system::error_code(), response);
+        });
+    }
+
+  private:
+    boost::asio::io_context &pollIo;
+
+    static IpmbDbusRspType respond(uint8_t netFn, uint8_t lun, uint8_t cmd)
+    {
+        constexpr uint8_t ccInvalidCommand = 0xC1;
+        constexpr uint8_t simulatedMaxPolicies = 0xFF;
+        size_t size =
+            ipmiResponseSize<ipmiGetDeviceIdReq, nmIpmiGetNmStatisticsReq,
+                             nmIpmiSetNmPolicyReq, nmIpmiGetNmPolicyReq,
+                             nmIpmiGetNmCapabilitesReq>(netFn, cmd);
+        std::vector<uint8_t> data(size);
+        if (size >= sizeof(ipmiIana) &&
+            netFn == IpmiCommand<nmIpmiGetNmStatisticsReq>::netFn)
+        {
+            IpmiWriter writer(data.data());
+            writer.put24(ipmiIanaIntel);
+            if (cmd == IpmiCommand<nmIpmiGetNmCapabilitesReq>::cmd)
+            {
+                writer.put8(simulatedMaxPolicies);
+                writer.put16(std::numeric_limits<uint16_t>::max());
+                writer.put16(0);
+                writer.put32(0);
+                writer.put32(std::numeric_limits<uint32_t>::max());
+                writer.put16(0);
+                writer.put16(std::numeric_limits<uint16_t>::max());
+            }
+        }
+        return {0, static_cast<uint8_t>(netFn | 1), lun, cmd,
+                static_cast<uint8_t>(size ? 0 : ccInvalidCommand),
+                std::move(data)};
+    }
+};
+
+#endif
@@ -0,0 +1,117 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef IPMICODEC_HPP
+#define IPMICODEC_HPP
+
+/**
+ * @brief Writes IPMI payload fields byte by byte. Multi-byte fields are LS-byte
+ * first as required by IPMI, independently of host endianness and alignment.
+ */
+class IpmiWriter
+{
+  public:
+    explicit IpmiWriter(uint8_t *dataArg) : data(dataArg)
+    {
+    }
+
+    constexpr void put8(uint8_t value)
+    {
+        data[pos++] = value;
+    }
+
+    constexpr void put16(uint16_t value)
+    {
+        put8(static_cast<uint8_t>(value));
+        put8(static_cast<uint8_t>(value >> 8));
+    }
+
+    constexpr void put24(uint32_t value)
+    {
+        put16(static_cast<uint16_t>(value));
+        put8(static_cast<uint8_t>(value >> 16));
+    }
+
+    constexpr void put32(uint32_t value)
+    {
+        put16(static_cast<uint16_t>(value));
+        put16(static_cast<uint16_t>(value >> 16));
+    }
+
+    constexpr size_t size() const
+    {
+        return pos;
+    }
+
+  private:
+    uint8_t *data;
+    size_t pos{0};
+};
+
+/**
+ * @brief Reads IPMI payload fields written as described for IpmiWriter
+ */
+class IpmiReader
+{
+  public:
+    explicit IpmiReader(const uint8_t *dataArg) : data(dataArg)
+    {
+    }
+
+    constexpr uint8_t get8()
+    {
+        return data[pos++];
+    }
+
+    constexpr uint16_t get16()
+    {
+        uint16_t value = get8();
+        return static_cast<uint16_t>(value | (get8() << 8));
+    }
+
+    constexpr uint32_t get24()
+    {
+        uint32_t value = get16();
+        return value | (static_cast<uint32_t>(get8()) << 16);
+    }
+
+    constexpr uint32_t get32()
+    {
+        uint32_t value = get16();
+        return value | (static_cast<uint32_t>(get16()) << 16);
+    }
+
+    constexpr size_t size() const
+    {
+        return pos;
+    }
+
+  private:
+    const uint8_t *data;
+    size_t pos{0};
+};
+
+/**
+ * @brief Extracts bits [shift, shift + width) of the byte
+ */
+constexpr uint8_t ipmiBits(uint8_t byte, unsigned shift, unsigned width)
+{
+    return static_cast<uint8_t>((byte >> shift) & ((1u << width) - 1));
+}
+
+#endif
@@ -0,0 +1,651 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/container/flat_map.hpp>
+#include <phosphor-logging/log.hpp>
+#include <sdbusplus/asio/object_server.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifndef LOOPMONITOR_HPP
+#define LOOPMONITOR_HPP
+
+/**
+ * @brief Loop monitor Dbus
+ */
+constexpr const char *loopMonitorPath =
+    "/xyz/openbmc_project/NodeManagerProxy/LoopMonitor";
+constexpr const char *loopMonitorIntf =
+    "xyz.openbmc_project.NodeManagerProxy.LoopMonitor";
+
+/**
+ * @brief Loop monitor defines
+ */
+constexpr uint32_t loopHeartbeatInterval = 100;  // msec
+constexpr uint32_t loopStallThreshold = 500;     // msec
+constexpr uint32_t loopPublishInterval = 100;    // heartbeats
+constexpr uint32_t loopStallLogInterval = 60;    // seconds
+constexpr size_t loopLagHistogramBuckets = 20;   // log2 buckets, up to ~9 min
+constexpr size_t latencySubBuckets = 8;          // per power of 2
+constexpr size_t latencyOctaves = 27;            // usec, up to ~9 min
+
+/**
+ * @brief Histogram of durations with latencySubBuckets linear buckets per
+ * power of 2 of microseconds, so tail percentiles are precise to ~12%
+ */
+class LatencyHistogram
+{
+  public:
+    void record(std::chrono::nanoseconds duration)
+    {
+        uint64_t us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(duration)
+                .count());
+        buckets[bucketFor(us)]++;
+        samples++;
+    }
+
+    uint64_t count() const
+    {
+        return samples;
+    }
+
+    /**
+     * @brief Returns upper bound [ms] of the bucket holding the percentile
+     */
+    double percentileMs(double p) const
+    {
+        if (samples == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(p * samples);
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+        {
+            seen += buckets[bucket];
+            if (seen > rank)
+            {
+                return upperBoundUs(bucket) / 1000.0;
+            }
+        }
+        return upperBoundUs(buckets.size() - 1) / 1000.0;
+    }
+
+  private:
+    std::array<uint64_t, latencyOctaves * latencySubBuckets> buckets{};
+    uint64_t samples{0};
+
+    // Octave 0 holds [0, latencySubBuckets) us linearly, octave N > 0 holds
+    // [2^(N-1), 2^N) * latencySubBuckets us split into latencySubBuckets
+    static size_t bucketFor(uint64_t us)
+    {
+        size_t octave = 0;
+        while (octave < latencyOctaves - 1 &&
+               us >= (latencySubBuckets << octave))
+        {
+            octave++;
+        }
+        uint64_t base = octave == 0 ? 0 : latencySubBuckets << (octave - 1);
+        uint64_t width = octave == 0 ? 1 : uint64_t{1} << (octave - 1);
+        uint64_t sub =
+            std::min<uint64_t>((us - base) / width, latencySubBuckets - 1);
+        return octave * latencySubBuckets + sub;
+    }
+
+    static double upperBoundUs(size_t bucket)
+    {
+        size_t octave = bucket / latencySubBuckets;
+        size_t sub = bucket % latencySubBuckets;
+        uint64_t base = octave == 0 ? 0 : latencySubBuckets << (octave - 1);
+        uint64_t width = octave == 0 ? 1 : uint64_t{1} << (octave - 1);
+        return static_cast<double>(base + (sub + 1) * width);
+    }
+};
+
+/**
+ * @brief Orders handler names by content, the same name may be a different
+ * literal at registration and at the scope
+ */
+struct HandlerNameLess
+{
+    bool operator()(const char *lhs, const char *rhs) const
+    {
+        return std::strcmp(lhs, rhs) < 0;
+    }
+};
+
+using LatencyMap =
+    boost::container::flat_map<const char *, LatencyHistogram, HandlerNameLess>;
+
+/**
+ * @brief Returns histogram of the name, inserting it only when the name was
+ * not registered in advance
+ */
+inline LatencyHistogram &latencyFor(LatencyMap &latencies, const char *name)
+{
+    auto found = latencies.find(name);
+    if (found == latencies.end())
+    {
+        found = latencies.emplace(name, LatencyHistogram{}).first;
+    }
+    return found->second;
+}
+
+/**
+ * @brief Marks the handler currently running on the event loop. Time spent in
+ * the longest handler between two heartbeats is what a stall is blamed on.
+ */
+class HandlerScope
+{
+  public:
+    HandlerScope(const HandlerScope &) = delete;
+    HandlerScope &operator=(const HandlerScope &) = delete;
+
+    explicit HandlerScope(const char *nameArg) :
+        name(nameArg), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~HandlerScope()
+    {
+        auto duration = std::chrono::steady_clock::now() - start;
+        latencyFor(handlerLatency, name).record(duration);
+        if (duration > longestDuration)
+        {
+            longestDuration = duration;
+            longestName = name;
+        }
+    }
+
+    /**
+     * @brief Returns name of the longest handler run since last call and
+     * resets tracking
+     */
+    static const char *takeLongest(std::chrono::nanoseconds &duration)
+    {
+        const char *ret = longestName;
+        duration = longestDuration;
+        longestName = nullptr;
+        longestDuration = std::chrono::nanoseconds::zero();
+        return ret;
+    }
+
+    /**
+     * @brief Adds histograms of handlers run by the calling thread upfront,
+     * so that the handlers do not allocate them on their first run
+     */
+    static void registerNames(std::initializer_list<const char *> names)
+    {
+        handlerLatency.reserve(handlerLatency.size() + names.size());
+        for (const char *handler : names)
+        {
+            handlerLatency.emplace(handler, LatencyHistogram{});
+        }
+    }
+
+    /**
+     * @brief Latency of every handler run so far by the calling thread
+     */
+    static const LatencyMap &getLatency()
+    {
+        return handlerLatency;
+    }
+
+  private:
+    const char *name;
+    std::chrono::steady_clock::time_point start;
+
+    static inline thread_local LatencyMap handlerLatency;
+
+    // Per thread, only handlers of the monitored loop are reported
+    static inline thread_local const char *longestName = nullptr;
+    static inline thread_local std::chrono::nanoseconds longestDuration{0};
+};
+
+/**
+ * @brief Measures latency of a Dbus method served by a coroutine, from the
+ * call until the reply including the time it waits for the ME. Other handlers
+ * run meanwhile, so it is reported apart from handlers and not blamed for
+ * stalls.
+ */
+class ServingScope
+{
+  public:
+    ServingScope(const ServingScope &) = delete;
+    ServingScope &operator=(const ServingScope &) = delete;
+
+    explicit ServingScope(const char *nameArg) :
+        name(nameArg), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ServingScope()
+    {
+        latencyFor(methodLatency, name)
+            .record(std::chrono::steady_clock::now() - start);
+    }
+
+    /**
+     * @brief Adds histograms of methods served by the calling thread upfront
+     */
+    static void registerNames(std::initializer_list<const char *> names)
+    {
+        methodLatency.reserve(methodLatency.size() + names.size());
+        for (const char *method : names)
+        {
+            methodLatency.emplace(method, LatencyHistogram{});
+        }
+    }
+
+    /**
+     * @brief Latency of every method served so far by the calling thread
+     */
+    static const LatencyMap &getLatency()
+    {
+        return methodLatency;
+    }
+
+  private:
+    const char *name;
+    std::chrono::steady_clock::time_point start;
+
+    static inline thread_local LatencyMap methodLatency;
+};
+
+/**
+ * @brief Lag statistics of one event loop, taken on its thread
+ */
+struct LoopStats
+{
+    double maxLagMs;
+    double p50LagMs;
+    double p99LagMs;
+    uint64_t stallCount;
+    double lastStallLagMs;
+    std::string lastStallHandler;
+    LatencyMap handlers; // copy of the loop thread ones, empty on a stall
+};
+
+/**
+ * @brief Periodic heartbeat measuring how late the event loop dispatches
+ * handlers. Runs on the thread of the loop, keeps max/percentile lag
+ * statistics and records the handler running when a stall exceeded
+ * loopStallThreshold. Statistics are passed to the callback on every stall
+ * and every loopPublishInterval heartbeats, along with handler latency of
+ * the thread.
+ */
+class LoopHeartbeat
+{
+  public:
+    using Callback = std::function<void(LoopStats &&stats, bool stalled)>;
+
+    LoopHeartbeat() = delete;
+    LoopHeartbeat(const LoopHeartbeat &) = delete;
+    LoopHeartbeat &operator=(const LoopHeartbeat &) = delete;
+
+    LoopHeartbeat(boost::asio::io_context &io, const char *nameArg,
+                  Callback callbackArg) :
+        timer(io),
+        name(nameArg), callback(std::move(callbackArg))
+    {
+        scheduleHeartbeat(std::chrono::steady_clock::now());
+    }
+
+  private:
+    boost::asio::steady_timer timer;
+    const char *name;
+    Callback callback;
+    std::array<uint64_t, loopLagHistogramBuckets> histogram{};
+    uint64_t samples{0};
+    uint32_t heartbeats{0};
+    double maxLagMs{0};
+    uint64_t stallCount{0};
+    double lastStallLagMs{0};
+    std::string lastStallHandler;
+    uint64_t stallsSinceLog{0};
+    double worstLagSinceLog{0};
+    std::string worstHandlerSinceLog;
+    std::chrono::steady_clock::time_point lastLog{};
+
+    void scheduleHeartbeat(std::chrono::steady_clock::time_point expected)
+    {
+        expected += std::chrono::milliseconds(loopHeartbeatInterval);
+        timer.expires_at(expected);
+        timer.async_wait([this, expected](const boost::system::error_code &ec) {
+            if (ec)
+            {
+                phosphor::logging::log<phosphor::logging::level::ERR>(
+                    "LoopMonitor: timer error",
+                    phosphor::logging::entry("LOOP=%s", name));
+                return;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            std::chrono::duration<double, std::milli> lag = now - expected;
+            record(lag.count());
+
+            // Base the next deadline on now, otherwise a long stall would
+            // produce a burst of immediately expiring heartbeats
+            scheduleHeartbeat(now);
+        });
+    }
+
+    void record(double lagMs)
+    {
+        samples++;
+        histogram[bucketFor(lagMs)]++;
+        maxLagMs = std::max(maxLagMs, lagMs);
+
+        std::chrono::nanoseconds handlerDuration;
+        const char *handler = HandlerScope::takeLongest(handlerDuration);
+
+        if (lagMs >= loopStallThreshold)
+        {
+            stallCount++;
+            lastStallLagMs = lagMs;
+            lastStallHandler = handler ? handler : "unknown";
+            logStall(lagMs, lastStallHandler);
+            callback(makeStats(false), true);
+        }
+
+        if (++heartbeats >= loopPublishInterval)
+        {
+            heartbeats = 0;
+            callback(makeStats(true), false);
+        }
+    }
+
+    LoopStats makeStats(bool withHandlers) const
+    {
+        LoopStats stats{maxLagMs,       percentile(0.50), percentile(0.99),
+                        stallCount,     lastStallLagMs,   lastStallHandler,
+                        LatencyMap{}};
+        if (withHandlers)
+        {
+            stats.handlers = HandlerScope::getLatency();
+        }
+        return stats;
+    }
+
+    /**
+     * @brief Logs stalls no more often than loopStallLogInterval, summarizing
+     * the ones which were not logged in the meantime
+     */
+    void logStall(double lagMs, const std::string &handler)
+    {
+        stallsSinceLog++;
+        if (lagMs > worstLagSinceLog)
+        {
+            worstLagSinceLog = lagMs;
+            worstHandlerSinceLog = handler;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastLog < std::chrono::seconds(loopStallLogInterval))
+        {
+            return;
+        }
+
+        phosphor::logging::log<phosphor::logging::level::WARNING>(
+            "Event loop stalled", phosphor::logging::entry("LOOP=%s", name),
+            phosphor::logging::entry("STALLS=%llu",
+                                     static_cast<unsigned long long>(
+                                         stallsSinceLog)),
+            phosphor::logging::entry("WORST_LAG_MS=%.1f", worstLagSinceLog),
+            phosphor::logging::entry("HANDLER=%s",
+                                     worstHandlerSinceLog.c_str()));
+
+        lastLog = now;
+        stallsSinceLog = 0;
+        worstLagSinceLog = 0;
+        worstHandlerSinceLog.clear();
+    }
+
+    static size_t bucketFor(double lagMs)
+    {
+        size_t bucket = 0;
+        // Bucket N holds lags in [2^(N-1), 2^N) ms, bucket 0 below 1 ms
+        for (double bound = 1; bucket < loopLagHistogramBuckets - 1;
+             bound *= 2, bucket++)
+        {
+            if (lagMs < bound)
+            {
+                break;
+            }
+        }
+        return bucket;
+    }
+
+    /**
+     * @brief Returns upper bound of the histogram bucket holding the given
+     * percentile
+     */
+    double percentile(double p) const
+    {
+        if (samples == 0)
+        {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(p * samples);
+        uint64_t seen = 0;
+        double bound = 1;
+        for (size_t bucket = 0; bucket < histogram.size(); bucket++)
+        {
+            seen += histogram[bucket];
+            if (seen > rank)
+            {
+                return std::min(bound, maxLagMs);
+            }
+            bound *= 2;
+        }
+        return maxLagMs;
+    }
+};
+
+/**
+ * @brief Exposes on Dbus the heartbeat statistics and per handler latency of
+ * the serving loop and, when given, of the poll loop under "Poll" prefixed
+ * properties, along with per method latency and process CPU and memory
+ * usage. Statistics of the poll loop are taken on the poll thread and
+ * published on the serving side.
+ */
+class LoopMonitor
+{
+  public:
+    LoopMonitor() = delete;
+    LoopMonitor(const LoopMonitor &) = delete;
+    LoopMonitor &operator=(const LoopMonitor &) = delete;
+
+    LoopMonitor(boost::asio::io_context &io,
+                sdbusplus::asio::object_server &server,
+                boost::asio::io_context *pollIo = nullptr) :
+        servingLoop{""},
+        pollLoop{"Poll"}
+    {
+        iface = server.add_interface(loopMonitorPath, loopMonitorIntf);
+        registerLoopProperties(servingLoop);
+        iface->register_property("Methods", HandlerStats{});
+        iface->register_property("CpuPercent", double{0});
+        iface->register_property("RssKiB", uint64_t{0});
+        if (pollIo != nullptr)
+        {
+            registerLoopProperties(pollLoop);
+        }
+        iface->initialize();
+
+        serving = std::make_unique<LoopHeartbeat>(
+            io, "serving", [this](LoopStats &&stats, bool stalled) {
+                publish(servingLoop, stats, stalled);
+            });
+        if (pollIo != nullptr)
+        {
+            poll = std::make_unique<LoopHeartbeat>(
+                *pollIo, "poll",
+                [this, &io](LoopStats &&stats, bool stalled) {
+                    boost::asio::post(
+                        io, [this, stats{std::move(stats)}, stalled]() {
+                            publish(pollLoop, stats, stalled);
+                        });
+                });
+        }
+    }
+
+  private:
+    // name, calls, calls per second, p50, p99, p999 [ms]
+    using HandlerStats = std::vector<
+        std::tuple<std::string, uint64_t, double, double, double, double>>;
+
+    // published state of a monitored loop, on the serving side
+    struct PublishedLoop
+    {
+        std::string prefix;
+        boost::container::flat_map<const char *, uint64_t> lastCalls;
+        std::chrono::steady_clock::time_point lastPublish{
+            std::chrono::steady_clock::now()};
+    };
+
+    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
+    PublishedLoop servingLoop;
+    PublishedLoop pollLoop;
+    boost::container::flat_map<const char *, uint64_t> lastMethodCalls;
+    uint64_t lastCpuTicks{0};
+    std::unique_ptr<LoopHeartbeat> serving;
+    std::unique_ptr<LoopHeartbeat> poll;
+
+    void registerLoopProperties(const PublishedLoop &loop)
+    {
+        iface->register_property(loop.prefix + "MaxLagMs", double{0});
+        iface->register_property(loop.prefix + "P50LagMs", double{0});
+        iface->register_property(loop.prefix + "P99LagMs", double{0});
+        iface->register_property(loop.prefix + "StallCount", uint64_t{0});
+        iface->register_property(loop.prefix + "LastStallLagMs", double{0});
+        iface->register_property(loop.prefix + "LastStallHandler",
+                                 std::string{});
+        iface->register_property(loop.prefix + "Handlers", HandlerStats{});
+    }
+
+    void publish(PublishedLoop &loop, const LoopStats &stats, bool stalled)
+    {
+        if (stalled)
+        {
+            iface->set_property(loop.prefix + "StallCount", stats.stallCount);
+            iface->set_property(loop.prefix + "LastStallLagMs",
+                                stats.lastStallLagMs);
+            iface->set_property(loop.prefix + "LastStallHandler",
+                                stats.lastStallHandler);
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = now - loop.lastPublish;
+        loop.lastPublish = now;
+
+        iface->set_property(loop.prefix + "MaxLagMs", stats.maxLagMs);
+        iface->set_property(loop.prefix + "P50LagMs", stats.p50LagMs);
+        iface->set_property(loop.prefix + "P99LagMs", stats.p99LagMs);
+        iface->set_property(
+            loop.prefix + "Handlers",
+            makeStats(stats.handlers, loop.lastCalls, elapsed.count()));
+        if (&loop == &servingLoop)
+        {
+            publishUsage(elapsed.count());
+        }
+    }
+
+    /**
+     * @brief Publishes method latency and throughput since last publish,
+     * process CPU load and resident memory
+     */
+    void publishUsage(double elapsedSeconds)
+    {
+        iface->set_property("Methods",
+                            makeStats(ServingScope::getLatency(),
+                                      lastMethodCalls, elapsedSeconds));
+
+        unsigned long utime = 0, stime = 0;
+        FILE *stat = std::fopen("/proc/self/stat", "r");
+        if (stat != nullptr)
+        {
+            // Fields 14 and 15, the command name in field 2 has no spaces
+            if (std::fscanf(stat,
+                            "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+                            "%*u %lu %lu",
+                            &utime, &stime) == 2)
+            {
+                uint64_t ticks = utime + stime;
+                iface->set_property("CpuPercent",
+                                    100.0 * (ticks - lastCpuTicks) /
+                                        sysconf(_SC_CLK_TCK) /
+                                        elapsedSeconds);
+                lastCpuTicks = ticks;
+            }
+            std::fclose(stat);
+        }
+
+        unsigned long size = 0, resident = 0;
+        FILE *statm = std::fopen("/proc/self/statm", "r");
+        if (statm != nullptr)
+        {
+            if (std::fscanf(statm, "%lu %lu", &size, &resident) == 2)
+            {
+                iface->set_property("RssKiB",
+                                    static_cast<uint64_t>(resident) *
+                                        sysconf(_SC_PAGESIZE) / 1024);
+            }
+            std::fclose(statm);
+        }
+    }
+
+    static HandlerStats makeStats(
+        const LatencyMap &latencies,
+        boost::container::flat_map<const char *, uint64_t> &lastCounts,
+        double elapsedSeconds)
+    {
+        HandlerStats stats;
+        for (const auto &[name, latency] : latencies)
+        {
+            // registered upfront but not run yet
+            if (latency.count() == 0)
+            {
+                continue;
+            }
+            uint64_t &last = lastCounts[name];
+            stats.emplace_back(name, latency.count(),
+                               (latency.count() - last) / elapsedSeconds,
+                               latency.percentileMs(0.50),
+                               latency.percentileMs(0.99),
+                               latency.percentileMs(0.999));
+            last = latency.count();
+        }
+        return stats;
+    }
+};
+
+#endif
@@ -0,0 +1,1141 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "HandlerMemory.hpp"
+#include "NodeManagerProxy.hpp"
+#include "ProxyClock.hpp"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio/post.hpp>
+#include <sdbusplus/asio/object_server.hpp>
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#ifndef MECHANNEL_HPP
+#define MECHANNEL_HPP
+
+/**
+ * @brief Sensor computed from other sensors of the channel, inputs are named
+ * without the channel prefix
+ */
+struct DerivedSensorConfig
+{
+    std::string type; // e.g. power, part of the object path
+    std::string name;
+    DerivedExpression expression;
+};
+
+/**
+ * @brief Token bucket of requests sent on top of the base readings cadence,
+ * shared by all channels. Used on the poll side only.
+ */
+class RequestBudget
+{
+  public:
+    /**
+     * @param perMinuteArg - average rate, also the most taken at once
+     */
+    explicit RequestBudget(uint32_t perMinuteArg) :
+        perMinute(perMinuteArg), tokens(perMinuteArg)
+    {
+    }
+
+    bool take()
+    {
+        ProxyClock::time_point now = ProxyClock::now();
+        std::chrono::duration<double, std::ratio<60>> elapsed = now - last;
+        last = now;
+        tokens = std::min(tokens + elapsed.count() * perMinute, perMinute);
+        if (tokens < 1)
+        {
+            return false;
+        }
+        tokens -= 1;
+        return true;
+    }
+
+  private:
+    double perMinute;
+    double tokens;
+    ProxyClock::time_point last{ProxyClock::now()};
+};
+
+/**
+ * @brief Names of the readings created for every channel, before the channel
+ * prefix. Derived sensors cannot take them.
+ */
+constexpr std::array<const char *, 12> builtInReadingNames = {
+    "PowerMetric_IntervalInMin",
+    "PowerMetric_MinConsumedWatts",
+    "PowerMetric_MaxConsumedWatts",
+    "PowerMetric_AverageConsumedWatts",
+    "Total_Power",
+    "CPU_Power",
+    "Memory_Power",
+    "CPU_Throttling",
+    "Host_Unhandled_Requests",
+    "Host_Response_Time",
+    "Host_Comm_Failures",
+    "IPMB_Latency"};
+
+/**
+ * @brief ME reachable over a single IPMB channel. Name is empty for the
+ * default channel, which keeps the original Dbus paths.
+ */
+struct ChannelConfig
+{
+    uint8_t channel;
+    std::string name;
+    uint8_t hostIndex;
+    uint32_t policyStatsInterval{::policyStatsInterval}; // seconds
+    std::vector<uint32_t> windows{60, 300, 3600}; // seconds, sensor aggregates
+    uint32_t sketchEpoch{::sketchEpoch}; // seconds, 0 never restarts
+    std::vector<DerivedSensorConfig> derived;
+    double adaptiveRate{::adaptiveRate}; // Watts per second, 0 disables
+    uint32_t adaptiveInterval{::adaptiveInterval}; // msec
+};
+
+using ReadingsCallback = std::function<void(Request &)>;
+
+/**
+ * @brief Sensors, domains, health and polling of a single ME. Every channel
+ * has its own frames queue and host state, so a slow ME delays only its own
+ * requests.
+ *
+ * Polling (timers, IPMB calls, host state, decoding responses into reading
+ * samples) runs on the poll connection and its thread. Dbus objects belong
+ * to the serving connection and are only touched from handlers posted to its
+ * io_context.
+ */
+class MeChannel
+{
+  public:
+    MeChannel() = delete;
+    MeChannel(const MeChannel &) = delete;
+    MeChannel &operator=(const MeChannel &) = delete;
+
+    /**
+     * @param index - position of the channel, used to interleave its frames
+     * with the other channels
+     */
+    MeChannel(std::shared_ptr<sdbusplus::asio::connection> connArg,
+              std::shared_ptr<sdbusplus::asio::connection> pollConnArg,
+              std::shared_ptr<IpmbTransport> transportArg,
+              sdbusplus::asio::object_server &server,
+              const ChannelConfig &configArg, size_t index,
+              size_t channelsCount, ReadingsCallback publishArg,
+              std::shared_ptr<RequestBudget> budgetArg,
+              std::shared_ptr<PolicyJournal> journal = nullptr) :
+        conn(connArg),
+        pollConn(pollConnArg), transport(transportArg), config(configArg),
+        publish(std::move(publishArg)), budget(std::move(budgetArg)),
+        readingsSchedulingTimer(pollConnArg->get_io_context()),
+        framesDistributingTimer(pollConnArg->get_io_context()),
+        policyStatsTimer(pollConnArg->get_io_context()),
+        adaptiveTimer(pollConnArg->get_io_context()),
+        meVersionTimer(pollConnArg->get_io_context()),
+        windowsTimer(connArg->get_io_context()),
+        startOffset(std::chrono::milliseconds(framesInterval) * index /
+                    std::max<size_t>(channelsCount, 1))
+    {
+        createSensors(server);
+        cadences.resize(sensors.size());
+        frames = std::vector<PendingFrame>(sensors.size());
+        frameData.reserve(maxFrameSize);
+
+        getMeVer = std::make_unique<GetMeVer>(
+            conn, transport, server, config.channel, getSoftwarePath(),
+            [this]() {
+                boost::asio::post(pollConn->get_io_context(), [this]() {
+                    meResetDetected("ME firmware version changed", true);
+                });
+            });
+
+        // associations have to be on the association interface
+        statusInterface =
+            server.add_interface(getStatusPath(), associationInterface);
+        statusInterface->register_property("Associations",
+                                           std::vector<Association>{});
+        statusInterface->initialize();
+
+        healthData =
+            std::make_unique<HealthData>(statusInterface, getStatusPath());
+
+        healthInterface = server.add_interface(
+            getStatusPath(), "xyz.openbmc_project.SetHealth");
+        healthInterface->register_method(
+            "SetHealth", [this](const std::string &type,
+                                const std::string &level) {
+                HandlerScope scope("SetHealth");
+                healthData->set(type, level);
+            });
+        healthInterface->initialize();
+
+        domainDcTotal = std::make_unique<Domain>(conn, transport, server,
+                                                 config.channel,
+                                                 getNmRootPath(), dcTotal,
+                                                 std::move(journal));
+        domainDcTotal->restorePolicies(server);
+
+        powerMatch = std::make_unique<sdbusplus::bus::match::match>(
+            static_cast<sdbusplus::bus::bus &>(*pollConn),
+            "type='signal',member='PropertiesChanged',path='" + getHostPath() +
+                "',arg0='" + std::string(power::interface) + "'",
+            [this](sdbusplus::message::message &message) {
+                HandlerScope scope("powerMatch");
+                std::string objectName;
+                boost::container::flat_map<std::string,
+                                           std::variant<std::string>>
+                    values;
+                message.read(objectName, values);
+                auto findState = values.find(power::property);
+                if (findState != values.end())
+                {
+                    if (boost::ends_with(
+                            std::get<std::string>(findState->second),
+                            "Running"))
+                    {
+                        boost::asio::post(conn->get_io_context(),
+                                          [this]() { healthData->clear(); });
+                    }
+                    setHostState(std::get<std::string>(findState->second));
+                }
+            });
+    }
+
+    std::vector<std::unique_ptr<Request>> &getSensors()
+    {
+        return sensors;
+    }
+
+    const ChannelConfig &getConfig() const
+    {
+        return config;
+    }
+
+    std::string getSoftwarePath() const
+    {
+        return scopedPath(meSoftwareObjPath);
+    }
+
+    /**
+     * @brief Adds statistics of the sensors, domain and policies, as last
+     * read. Called on the serving side.
+     */
+    void collectStatistics(AllStatisticsMap &stats) const
+    {
+        for (const auto &sensor : sensors)
+        {
+            sensor->collectStatistics(stats);
+        }
+
+        StatValuesMap platformStats =
+            stats[scopedPath(powerMetricPath)]["Power"];
+        platformStats["Current"] = stats[totalPowerPath]["Power"]["Current"];
+        domainDcTotal->collectStatistics(stats, platformStats);
+    }
+
+    /**
+     * @brief Reads host state and starts polling, shifted by the channel
+     * offset so that frames of different channels interleave. Called before
+     * the poll thread runs.
+     */
+    void start()
+    {
+        readHostState();
+        getMeVer->refresh();
+        refreshMeVersion();
+        domainDcTotal->refreshCapabilities();
+
+        readingsSchedulingTimer.expires_after(startOffset);
+        readingsSchedulingTimer.async_wait(
+            [this](const boost::system::error_code &ec) {
+                if (ec)
+                {
+                    // polling started already by host state change
+                    return;
+                }
+                warmUpReadings();
+                performReadings();
+            });
+        refreshPolicyStatistics();
+        refreshWindowStatistics();
+    }
+
+    void createAssociations(sdbusplus::asio::object_server &server,
+                            const std::string &parentPath)
+    {
+        for (auto &sensor : sensors)
+        {
+            sensor->createAssociation(server, parentPath);
+        }
+    }
+
+  private:
+    std::shared_ptr<sdbusplus::asio::connection> conn;
+    std::shared_ptr<sdbusplus::asio::connection> pollConn;
+    std::shared_ptr<IpmbTransport> transport;
+    ChannelConfig config;
+    ReadingsCallback publish;
+    std::shared_ptr<RequestBudget> budget;
+    ProxyTimer readingsSchedulingTimer;
+    ProxyTimer framesDistributingTimer;
+    ProxyTimer policyStatsTimer;
+    ProxyTimer adaptiveTimer;
+    ProxyTimer meVersionTimer;
+    ProxyTimer windowsTimer; // serving side
+    std::chrono::milliseconds startOffset;
+    std::vector<uint8_t> frameData;
+    std::vector<std::unique_ptr<Request>> sensors;
+    std::string totalPowerPath;
+    Request *totalPower{nullptr}; // owned by sensors
+    Request *throttling{nullptr}; // owned by sensors
+    IpmbLatency *ipmbLatency{nullptr}; // owned by sensors
+    std::vector<DerivedSensor *> derivedSensors; // owned by sensors
+    std::unique_ptr<GetMeVer> getMeVer;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> statusInterface;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> healthInterface;
+    std::unique_ptr<HealthData> healthData;
+    std::unique_ptr<Domain> domainDcTotal;
+    std::unique_ptr<sdbusplus::bus::match::match> powerMatch;
+
+    /**
+     * @brief Host power state driving the readings cadence
+     */
+    enum class HostState
+    {
+        unknown,
+        off,
+        running
+    };
+    HostState hostState{HostState::unknown};
+    uint32_t readingsCycle{0};
+    ProxyClock::time_point burstEnd;
+
+    /**
+     * @brief Fast readings state of an adaptive sensor, period is zero while
+     * the sensor follows the base cadence
+     */
+    struct Cadence
+    {
+        std::chrono::milliseconds period{0};
+        ProxyClock::time_point next;
+    };
+    std::vector<Cadence> cadences; // by sensors index
+    bool adaptiveRunning{false};
+
+    /**
+     * @brief Frame sent for a sensor. Preallocated, so that neither the IPMB
+     * handler referring to it nor the handover of its samples to the serving
+     * side allocate per frame. Overlapping frames of the same sensor share
+     * it, the later one only shortens the measured latency.
+     */
+    struct PendingFrame
+    {
+        std::vector<std::unique_ptr<Request>>::iterator requestIter;
+        uint32_t traceId{0};
+        std::chrono::steady_clock::time_point sent;
+        HandlerMemory handover;
+    };
+    std::vector<PendingFrame> frames; // by sensors index, poll side
+
+    // ME reset detection, on the poll side
+    uint32_t consecutiveFailures{0};
+    bool meResetPending{false};
+    uint32_t lastMeTimestamp{0}; // poll side, of any sensor response
+
+    std::string scopedPath(const char *path) const
+    {
+        return config.name.empty() ? path : path + ('/' + config.name);
+    }
+
+    std::string getStatusPath() const
+    {
+        return scopedPath(meStatusPath);
+    }
+
+    std::string getNmRootPath() const
+    {
+        return scopedPath(nmRootPath);
+    }
+
+    std::string getHostPath() const
+    {
+        return power::pathPrefix + std::to_string(config.hostIndex);
+    }
+
+    void createSensors(sdbusplus::asio::object_server &server)
+    {
+        std::string prefix = config.name.empty() ? "" : config.name + '_';
+
+        // NM Statistics
+        // Global power statistics
+        sensors.push_back(std::make_unique<PowerMetric>(
+            server, scopedPath(powerMetricPath), prefix));
+        auto platform = std::make_unique<GlobalPowerPlatform>(
+            server, 0, 2040, "power", prefix + "Total_Power",
+            globalPowerStats, entirePlatform, 0);
+        totalPower = platform.get();
+        sensors.push_back(std::move(platform));
+        totalPowerPath =
+            std::string(propObj) + "power/" + prefix + "Total_Power";
+        sensors.push_back(std::make_unique<GlobalPowerCpu>(
+            server, 0, 510, "power", prefix + "CPU_Power", globalPowerStats,
+            cpuSubsystem, 0));
+        sensors.push_back(std::make_unique<GlobalPowerMemory>(
+            server, 0, 255, "power", prefix + "Memory_Power",
+            globalPowerStats, memorySubsystem, 0));
+
+        // Cost of power limiting, accounted into policy analytics
+        auto throttlingStats = std::make_unique<GlobalThrottling>(
+            server, 0, 100, "utilization", prefix + "CPU_Throttling",
+            globalThrottlingStats, entirePlatform, 0, sensorUnitPercent);
+        throttling = throttlingStats.get();
+        sensors.push_back(std::move(throttlingStats));
+
+        // ME to host interface health, response time is reported in msec
+        sensors.push_back(std::make_unique<HostInterfaceStatistics>(
+            server, 0, 65535, "count", prefix + "Host_Unhandled_Requests",
+            globalHostUnhandleReqStats, entirePlatform, 0, ""));
+        sensors.push_back(std::make_unique<HostInterfaceStatistics>(
+            server, 0, 65.535, "time", prefix + "Host_Response_Time",
+            globalHostResponseTimeStats, entirePlatform, 0, sensorUnitSeconds,
+            0.001));
+        sensors.push_back(std::make_unique<HostInterfaceStatistics>(
+            server, 0, 65535, "count", prefix + "Host_Comm_Failures",
+            globalHostCommFailureStats, entirePlatform, 0, ""));
+
+        auto latency =
+            std::make_unique<IpmbLatency>(server, prefix + "IPMB_Latency");
+        ipmbLatency = latency.get();
+        sensors.push_back(std::move(latency));
+
+        createDerivedSensors(server, prefix);
+
+        if (!config.windows.empty())
+        {
+            for (auto &sensor : sensors)
+            {
+                sensor->createWindowStatistics(server, config.windows);
+            }
+        }
+        for (auto &sensor : sensors)
+        {
+            sensor->createQuantiles(server, config.sketchEpoch);
+        }
+    }
+
+    void createDerivedSensors(sdbusplus::asio::object_server &server,
+                              const std::string &prefix)
+    {
+        for (const auto &derived : config.derived)
+        {
+            // rejected by option parsing already, names identify inputs
+            if (findReading(prefix + derived.name) != nullptr)
+            {
+                phosphor::logging::log<phosphor::logging::level::ERR>(
+                    "Derived sensor name already taken",
+                    phosphor::logging::entry("SENSOR=%s",
+                                             derived.name.c_str()));
+                continue;
+            }
+
+            // inputs may be earlier derived sensors too
+            std::vector<const Reading *> inputs;
+            for (const auto &input : derived.expression.getInputs())
+            {
+                const Reading *reading = findReading(prefix + input);
+                if (reading == nullptr)
+                {
+                    phosphor::logging::log<phosphor::logging::level::ERR>(
+                        "Derived sensor input not found",
+                        phosphor::logging::entry("SENSOR=%s",
+                                                 derived.name.c_str()),
+                        phosphor::logging::entry("INPUT=%s", input.c_str()));
+                    break;
+                }
+                inputs.push_back(reading);
+            }
+            if (inputs.size() != derived.expression.getInputs().size())
+            {
+                continue;
+            }
+
+            auto sensor = std::make_unique<DerivedSensor>(
+                server, derived.type, prefix + derived.name,
+                derived.expression, std::move(inputs));
+            derivedSensors.push_back(sensor.get());
+            sensors.push_back(std::move(sensor));
+        }
+    }
+
+    const Reading *findReading(const std::string &name) const
+    {
+        for (const auto &sensor : sensors)
+        {
+            for (const auto &reading : sensor->getReadings())
+            {
+                if (reading.name == name)
+                {
+                    return &reading;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Re-evaluates derived sensors whose inputs changed, in
+     * configuration order so chained ones see fresh values
+     */
+    void updateDerivedSensors()
+    {
+        for (DerivedSensor *sensor : derivedSensors)
+        {
+            if (sensor->refresh())
+            {
+                publish(*sensor);
+            }
+        }
+    }
+
+    /**
+     * @brief Decides whether request is sent in the current readings cycle
+     */
+    bool shouldRead(const Request &request) const
+    {
+        if (!request.isPolled())
+        {
+            return false;
+        }
+        uint32_t divider = request.getPollDivider();
+        if (hostState == HostState::off && request.isHostDependent())
+        {
+            divider = std::max(divider, hostOffPollDivider);
+        }
+        return readingsCycle % divider == 0;
+    }
+
+    std::chrono::milliseconds currentReadingsInterval() const
+    {
+        if (ProxyClock::now() < burstEnd)
+        {
+            return std::chrono::seconds(hostOnBurstInterval);
+        }
+        return std::chrono::seconds(readingsInterval);
+    }
+
+    /**
+     * @brief Spreads frames over at most half of the readings interval
+     */
+    std::chrono::milliseconds currentFramesInterval() const
+    {
+        std::chrono::milliseconds spacing =
+            currentReadingsInterval() /
+            (2 * std::max<int64_t>(sensors.size(), 1));
+        return std::min(spacing, std::chrono::milliseconds(framesInterval));
+    }
+
+    /**
+     * @brief Function distributing requests in time (burst prevention)
+     */
+    void processRequests(
+        std::vector<std::unique_ptr<Request>>::iterator requestIter,
+        std::chrono::milliseconds spacing =
+            std::chrono::milliseconds(framesInterval))
+    {
+        framesDistributingTimer.expires_after(spacing);
+        framesDistributingTimer.async_wait([this, requestIter, spacing](
+                                               const boost::system::error_code
+                                                   &ec) mutable {
+            HandlerScope scope("processRequests");
+            NM_ALLOCATIONS_SCOPE();
+            if (ec == boost::asio::error::operation_aborted)
+            {
+                // superseded by a new readings cycle
+                return;
+            }
+            if (ec)
+            {
+                phosphor::logging::log<phosphor::logging::level::ERR>(
+                    "processRequests: timer error");
+                return;
+            }
+
+            while (requestIter != sensors.end() &&
+                   (!shouldRead(**requestIter) || isFast(requestIter)))
+            {
+                requestIter++;
+            }
+            if (requestIter == sensors.end())
+            {
+                return;
+            }
+
+            sendRequest(requestIter);
+
+            requestIter++;
+            processRequests(requestIter, spacing);
+        });
+    }
+
+    /**
+     * @brief Sends request to the ME, its response is decoded on the poll
+     * side and published by the serving side
+     */
+    void
+        sendRequest(std::vector<std::unique_ptr<Request>>::iterator requestIter)
+    {
+        // prepare data to be sent, buffer is copied into the message below
+        // so it is reused by all frames
+        uint8_t netFn = 0, lun = 0, cmd = 0;
+        (*requestIter)->prepareRequest(netFn, lun, cmd, frameData);
+        PendingFrame *frame =
+            &frames[static_cast<size_t>(requestIter - sensors.begin())];
+        frame->requestIter = requestIter;
+        frame->traceId = static_cast<uint32_t>(
+            (config.channel << 8) | (requestIter - sensors.begin()));
+        frame->sent = std::chrono::steady_clock::now();
+        NM_TRACE(prepared, frame->traceId, netFn, cmd, 0, 0);
+
+        // captures fit into the handler itself, IpmbHandler does not
+        // allocate
+        transport->asyncSendRequest(
+            config.channel, frameData, netFn, lun, cmd,
+            [this, frame](boost::system::error_code ec,
+                          IpmbDbusRspType &response) {
+                frameAnswered(*frame, ec, response);
+            });
+        NM_TRACE(sent, frame->traceId, netFn, cmd, 0, 0);
+    }
+
+    void frameAnswered(PendingFrame &frame, boost::system::error_code ec,
+                       IpmbDbusRspType &response)
+    {
+        HandlerScope scope("sendRequest response");
+        NM_ALLOCATIONS_SCOPE();
+        auto requestIter = frame.requestIter;
+        [[maybe_unused]] uint32_t traceId = frame.traceId;
+        // failed round trips count as well, a timing out ME is the slowest
+        // one
+        std::chrono::duration<double> latency =
+            std::chrono::steady_clock::now() - frame.sent;
+        ipmbLatency->sample(latency.count());
+
+        if (ec)
+        {
+            NM_TRACE(failed, traceId, 0, 0, -1, 0);
+            NM_LOG_RATE_LIMITED(
+                ERR, "sendRequest: Error request response",
+                phosphor::logging::entry("CHANNEL=%d", config.channel),
+                phosphor::logging::entry("SENSOR=%s",
+                                         sensorName(**requestIter)),
+                phosphor::logging::entry("ERROR=%s", ec.message().c_str()));
+            requestFailed(frame);
+            return;
+        }
+
+        auto &[status, netFn, lun, cmd, cc, dataReceived] = response;
+        NM_TRACE(answered, traceId, netFn, cmd, status, cc);
+
+        if (status)
+        {
+            NM_LOG_RATE_LIMITED(
+                ERR, "sendRequest: non-zero response status",
+                phosphor::logging::entry("STATUS=%d", status),
+                phosphor::logging::entry("NETFN=0x%02x", netFn),
+                phosphor::logging::entry("CMD=0x%02x", cmd),
+                phosphor::logging::entry("CC=0x%02x", cc),
+                phosphor::logging::entry("CHANNEL=%d", config.channel),
+                phosphor::logging::entry("SENSOR=%s",
+                                         sensorName(**requestIter)));
+            requestFailed(frame);
+            return;
+        }
+
+        // Serving side only takes the decoded samples into Dbus properties
+        (*requestIter)->handleResponse(cc, dataReceived);
+        observeResponse(**requestIter, cc);
+        if ((*requestIter)->isAdaptive())
+        {
+            adaptCadence(static_cast<size_t>(requestIter - sensors.begin()),
+                         (*requestIter)->getChangeRate());
+        }
+        boost::asio::post(
+            conn->get_io_context(),
+            makeAllocatingHandler(
+                frame.handover, [this, requestIter, traceId, netFn{netFn},
+                                 cmd{cmd}, cc{cc}]() {
+                    publishSamples(requestIter);
+                    NM_TRACE(published, traceId, netFn, cmd, 0, cc);
+                }));
+    }
+
+    static const char *sensorName(Request &request)
+    {
+        // names are set on construction, safe to read from the poll thread
+        const auto &readings = request.getReadings();
+        return readings.empty() ? "" : readings.front().name.c_str();
+    }
+
+    /**
+     * @brief Feeds policy analytics with the new platform power reading and
+     * the latest throttling one
+     */
+    void sampleAnalytics()
+    {
+        constexpr double unknown = std::numeric_limits<double>::quiet_NaN();
+        const Reading &power = totalPower->getReadings().front();
+        const Reading &throttle = throttling->getReadings().front();
+        domainDcTotal->sampleAnalytics(
+            power.timestampUs, power.valid ? power.value : unknown,
+            throttle.valid ? throttle.value : unknown);
+    }
+
+    /**
+     * @brief Takes samples of the request into its readings and publishes
+     * them, along with the IPMB latency and derived sensors. Called on the
+     * serving side.
+     */
+    void publishSamples(
+        std::vector<std::unique_ptr<Request>>::iterator requestIter)
+    {
+        HandlerScope scope("publishSamples");
+        if ((*requestIter)->takeSamples())
+        {
+            publish(**requestIter);
+        }
+        if (ipmbLatency->takeSamples())
+        {
+            publish(*ipmbLatency);
+        }
+        updateDerivedSensors();
+        if (requestIter->get() == totalPower)
+        {
+            sampleAnalytics();
+        }
+    }
+
+    /**
+     * @brief Last readings of host dependent sensors are not current once
+     * they are read at the host off rate. Called on the poll side.
+     */
+    void invalidateHostDependent()
+    {
+        for (auto &sensor : sensors)
+        {
+            if (sensor->isHostDependent())
+            {
+                sensor->invalidateSamples();
+            }
+        }
+        boost::asio::post(conn->get_io_context(), [this]() {
+            for (auto &sensor : sensors)
+            {
+                if (sensor->isHostDependent() && sensor->takeSamples())
+                {
+                    publish(*sensor);
+                }
+            }
+            updateDerivedSensors();
+        });
+    }
+
+    void requestFailed(PendingFrame &frame)
+    {
+        auto requestIter = frame.requestIter;
+        (*requestIter)->invalidateSamples();
+        observeFailure(**requestIter);
+        boost::asio::post(conn->get_io_context(),
+                          makeAllocatingHandler(
+                              frame.handover, [this, requestIter]() {
+                                  publishSamples(requestIter);
+                              }));
+    }
+
+    /**
+     * @brief Looks for signs of ME reset in a sensor response, policies are
+     * re-provisioned as soon as the ME answers after it. Called on the
+     * poll side.
+     */
+    void observeResponse(const Request &request, uint8_t cc)
+    {
+        if (cc == ipmiCcNodeBusy || cc == ipmiCcNotSupportedInPresentState)
+        {
+            observeFailure(request);
+            return;
+        }
+        if (cc != 0)
+        {
+            return;
+        }
+        consecutiveFailures = 0;
+        bool restarted = false;
+        uint32_t meTimestamp = request.getMeTimestamp();
+        if (meTimestamp != 0)
+        {
+            // one ME clock for all sensors of the channel
+            restarted = lastMeTimestamp != 0 &&
+                        meTimestamp + meTimestampSettle < lastMeTimestamp;
+            lastMeTimestamp = meTimestamp;
+        }
+        if (restarted)
+        {
+            meResetDetected("statistics timestamp went back", true);
+        }
+        else if (meResetPending)
+        {
+            meResetDetected("ME answers again", true);
+        }
+    }
+
+    void observeFailure(const Request &request)
+    {
+        // these fail also while the host is off or when not supported
+        if (request.isOptional() || request.isHostDependent())
+        {
+            return;
+        }
+        if (++consecutiveFailures == meResetFailureBurst)
+        {
+            meResetDetected("burst of failed responses", false);
+        }
+    }
+
+    /**
+     * @param meAnswering - false when the ME may still be restarting, then
+     * policies are re-provisioned on the next successful response
+     */
+    void meResetDetected(const char *reason, bool meAnswering)
+    {
+        if (!meResetPending)
+        {
+            phosphor::logging::log<phosphor::logging::level::WARNING>(
+                "ME reset detected",
+                phosphor::logging::entry("REASON=%s", reason),
+                phosphor::logging::entry("CHANNEL=%d", config.channel));
+        }
+        meResetPending = !meAnswering;
+        if (meAnswering)
+        {
+            boost::asio::post(conn->get_io_context(), [this]() {
+                domainDcTotal->reprovisionPolicies();
+            });
+        }
+    }
+
+    /**
+     * @brief Reads all sensors back to back, so that they do not wait for
+     * readingsInterval after startup
+     */
+    void warmUpReadings()
+    {
+        processRequests(sensors.begin(), std::chrono::milliseconds(0));
+    }
+
+    void performReadings()
+    {
+        readingsSchedulingTimer.expires_after(currentReadingsInterval());
+        readingsSchedulingTimer.async_wait(
+            [this](const boost::system::error_code &ec) {
+                HandlerScope scope("performReadings");
+                if (ec == boost::asio::error::operation_aborted)
+                {
+                    // rescheduled on host state change
+                    return;
+                }
+                if (ec)
+                {
+                    phosphor::logging::log<phosphor::logging::level::ERR>(
+                        "performReadings: timer error");
+                    return;
+                }
+
+                readingsCycle++;
+                processRequests(sensors.begin(), currentFramesInterval());
+
+                performReadings();
+            });
+    }
+
+    // fast sensors are read by adaptive readings instead of the base cadence
+    bool isFast(std::vector<std::unique_ptr<Request>>::iterator requestIter)
+    {
+        return cadences[static_cast<size_t>(requestIter - sensors.begin())]
+                   .period.count() != 0;
+    }
+
+    /**
+     * @brief Switches sensor to fast readings when its reading moves faster
+     * than the configured rate. Once stable, the readings period doubles on
+     * every reading until the sensor is back at the base cadence.
+     */
+    void adaptCadence(size_t index, double rate)
+    {
+        if (config.adaptiveRate <= 0 ||
+            (hostState == HostState::off && sensors[index]->isHostDependent()))
+        {
+            cadences[index].period = std::chrono::milliseconds(0);
+            return;
+        }
+
+        Cadence &cadence = cadences[index];
+        if (rate > config.adaptiveRate)
+        {
+            cadence.period = std::chrono::milliseconds(
+                std::max(config.adaptiveInterval, framesInterval));
+        }
+        else if (cadence.period.count() != 0)
+        {
+            cadence.period *= 2;
+            if (cadence.period >= std::chrono::seconds(readingsInterval))
+            {
+                cadence.period = std::chrono::milliseconds(0);
+                return;
+            }
+        }
+        else
+        {
+            return;
+        }
+
+        cadence.next = ProxyClock::now() + cadence.period;
+        if (!adaptiveRunning)
+        {
+            adaptiveRunning = true;
+            performAdaptiveReadings();
+        }
+    }
+
+    /**
+     * @brief Reads sensors in fast readings when due, as long as the shared
+     * budget allows, sensors out of budget return to the base cadence. Stops
+     * when no sensor is fast any more.
+     */
+    void performAdaptiveReadings()
+    {
+        adaptiveTimer.expires_after(std::chrono::milliseconds(
+            std::max(config.adaptiveInterval, framesInterval)));
+        adaptiveTimer.async_wait([this](const boost::system::error_code &ec) {
+            HandlerScope scope("performAdaptiveReadings");
+            NM_ALLOCATIONS_SCOPE();
+            if (ec)
+            {
+                adaptiveRunning = false;
+                return;
+            }
+
+            bool fast = false;
+            ProxyClock::time_point now = ProxyClock::now();
+            for (size_t index = 0; index < sensors.size(); index++)
+            {
+                Cadence &cadence = cadences[index];
+                if (cadence.period.count() == 0)
+                {
+                    continue;
+                }
+                fast = true;
+                if (cadence.next > now)
+                {
+                    continue;
+                }
+                if (budget->take())
+                {
+                    cadence.next = now + cadence.period;
+                    sendRequest(sensors.begin() + index);
+                }
+                else
+                {
+                    // out of budget, back to the base cadence
+                    cadence.period = std::chrono::milliseconds(0);
+                }
+            }
+            if (!fast)
+            {
+                adaptiveRunning = false;
+                return;
+            }
+            performAdaptiveReadings();
+        });
+    }
+
+    /**
+     * @brief Periodically refreshes cached statistics of enabled policies, so
+     * that IPMB traffic does not grow with the number of clients asking. The
+     * timer is re-armed once a refresh completes, so a slow ME never gets
+     * overlapping refreshes.
+     */
+    void refreshPolicyStatistics()
+    {
+        if (config.policyStatsInterval == 0)
+        {
+            return;
+        }
+        policyStatsTimer.expires_after(
+            std::chrono::seconds(config.policyStatsInterval));
+        policyStatsTimer.async_wait(
+            [this](const boost::system::error_code &ec) {
+                if (ec)
+                {
+                    return;
+                }
+                boost::asio::post(conn->get_io_context(), [this]() {
+                    domainDcTotal->refreshPolicyStatistics([this]() {
+                        boost::asio::post(
+                            pollConn->get_io_context(),
+                            [this]() { refreshPolicyStatistics(); });
+                    });
+                });
+            });
+    }
+
+    /**
+     * @brief Reads ME version at a low rate, a changed one tells about a
+     * reset by firmware update. Runs on the poll side.
+     */
+    void refreshMeVersion()
+    {
+        meVersionTimer.expires_after(std::chrono::seconds(meVersionInterval));
+        meVersionTimer.async_wait([this](const boost::system::error_code &ec) {
+            if (ec)
+            {
+                return;
+            }
+            HandlerScope scope("refreshMeVersion");
+            getMeVer->refresh();
+            refreshMeVersion();
+        });
+    }
+
+    /**
+     * @brief Re-publishes window aggregates of all sensors every bucket of
+     * the shortest window, so that they expire to NaN when readings stop.
+     * Runs on the serving side.
+     */
+    void refreshWindowStatistics()
+    {
+        if (config.windows.empty())
+        {
+            return;
+        }
+        windowsTimer.expires_after(
+            WindowStatistics::refreshInterval(config.windows));
+        windowsTimer.async_wait([this](const boost::system::error_code &ec) {
+            if (ec)
+            {
+                return;
+            }
+            HandlerScope scope("refreshWindowStatistics");
+            for (auto &sensor : sensors)
+            {
+                sensor->refreshWindowStatistics();
+            }
+            refreshWindowStatistics();
+        });
+    }
+
+    /**
+     * @brief Maps CurrentHostState onto the readings cadence states. Host
+     * counts as running only while it runs its workload, the transition to
+     * running keeps the previous state until it completes.
+     */
+    static std::optional<HostState> parseHostState(const std::string &state)
+    {
+        static const boost::container::flat_map<std::string, HostState>
+            hostStates = {{"Running", HostState::running},
+                          {"DiagnosticMode", HostState::running},
+                          {"Off", HostState::off},
+                          {"Standby", HostState::off},
+                          {"Quiesced", HostState::off},
+                          {"TransitioningToOff", HostState::off}};
+
+        auto findState = hostStates.find(state.substr(state.rfind('.') + 1));
+        if (findState == hostStates.end())
+        {
+            return std::nullopt;
+        }
+        return findState->second;
+    }
+
+    /**
+     * @brief Adjusts readings cadence to the host power state. Host dependent
+     * sensors are slowed down and their readings invalidated while host is
+     * off, all sensors are read at a high rate for a while after host starts
+     * running.
+     */
+    void setHostState(const std::string &state)
+    {
+        std::optional<HostState> newState = parseHostState(state);
+        if (!newState)
+        {
+            if (!boost::ends_with(state, "TransitioningToRunning"))
+            {
+                phosphor::logging::log<phosphor::logging::level::INFO>(
+                    "setHostState: unknown host state ignored",
+                    phosphor::logging::entry("STATE=%s", state.c_str()));
+            }
+            return;
+        }
+        if (*newState == hostState)
+        {
+            return;
+        }
+
+        bool poweredOn =
+            hostState == HostState::off && *newState == HostState::running;
+        hostState = *newState;
+        if (hostState == HostState::off)
+        {
+            invalidateHostDependent();
+        }
+        if (poweredOn)
+        {
+            burstEnd = ProxyClock::now() +
+                       std::chrono::seconds(hostOnBurstDuration);
+            processRequests(sensors.begin(), currentFramesInterval());
+            performReadings();
+        }
+    }
+
+    void readHostState()
+    {
+        pollConn->async_method_call(
+            [this](boost::system::error_code ec,
+                   const std::variant<std::string> &state) {
+                HandlerScope scope("readHostState");
+                if (ec)
+                {
+                    phosphor::logging::log<phosphor::logging::level::INFO>(
+                        "readHostState: cannot read host state",
+                        phosphor::logging::entry("CHANNEL=%d",
+                                                 config.channel));
+                    return;
+                }
+                if (hostState == HostState::unknown)
+                {
+                    setHostState(std::get<std::string>(state));
+                }
+            },
+            power::busname, getHostPath(), "org.freedesktop.DBus.Properties",
+            "Get", power::interface, power::property);
+    }
+};
+
+#endif
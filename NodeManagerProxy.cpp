@@ -15,122 +15,231 @@
 
 #include "NodeManagerProxy.hpp"
 
+#include "AllocationCounter.hpp"
+#include "IpmbReplay.hpp"
+#include "MeChannel.hpp"
+#include "ProxyOptions.hpp"
+#include "SnapshotWriter.hpp"
+#include "TelemetryFeed.hpp"
+
+#include <systemd/sd-daemon.h>
+
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/asio.hpp>
+#include <atomic>
 #include <filesystem>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 
 static boost::asio::io_service io;
 static auto conn = std::make_shared<sdbusplus::asio::connection>(io);
-static boost::asio::steady_timer readingsSchedulingTimer(io);
-static boost::asio::steady_timer framesDistributingTimer(io);
+// IPMB polling runs on its own connection and thread, so that serving Dbus
+// clients and polling the ME do not delay each other
+static boost::asio::io_service pollIo;
+static auto pollConn = std::make_shared<sdbusplus::asio::connection>(pollIo);
+static ProxyTimer associationsDebounceTimer(io);
 
 static sdbusplus::asio::object_server server =
     sdbusplus::asio::object_server(conn);
 
-static std::vector<std::unique_ptr<Request>> configuredSensors;
+static std::vector<std::unique_ptr<MeChannel>> channels;
+static std::shared_ptr<sdbusplus::asio::dbus_interface> readinessInterface;
+static bool ready = false;
+// Set by the poll side once the replayed log no longer covers the traffic
+static std::atomic<bool> replayEnded{false};
+
+static SnapshotWriter snapshot;
+static TelemetryFeed telemetryFeed(io, []() {
+    std::vector<std::pair<uint16_t, std::string>> names;
+    for (auto &channel : channels)
+    {
+        for (auto &sensor : channel->getSensors())
+        {
+            for (const auto &reading : sensor->getReadings())
+            {
+                names.emplace_back(reading.id, reading.name);
+            }
+        }
+    }
+    return names;
+});
 
 /**
- * @brief Function distributing requests in time (burst prevention)
+ * @brief Flips readiness once all configured sensors were read
  */
-void processRequests(
-    std::vector<std::unique_ptr<Request>>::iterator requestIter)
+void updateReadiness()
 {
-    framesDistributingTimer.expires_after(
-        std::chrono::milliseconds(framesInterval));
-    framesDistributingTimer.async_wait(
-        [requestIter](const boost::system::error_code &ec) mutable {
-            if (ec)
+    if (ready)
+    {
+        return;
+    }
+    for (auto &channel : channels)
+    {
+        for (auto &sensor : channel->getSensors())
+        {
+            if (!sensor->isOptional() && !sensor->wasRead())
             {
-                phosphor::logging::log<phosphor::logging::level::ERR>(
-                    "processRequests: timer error");
                 return;
             }
+        }
+    }
 
-            if (requestIter == configuredSensors.end())
-            {
-                return;
-            }
+    ready = true;
+    readinessInterface->set_property("Ready", ready);
+    sd_notify(0, "READY=1\nSTATUS=Readings available");
+    phosphor::logging::log<phosphor::logging::level::INFO>(
+        "All sensors read, proxy is ready");
+}
 
-            // prepare data to be sent
-            std::vector<uint8_t> data;
-            uint8_t netFn = 0, lun = 0, cmd = 0;
-            (*requestIter)->prepareRequest(netFn, lun, cmd, data);
-
-            // send request to Ipmb
-            conn->async_method_call(
-                [requestIter](boost::system::error_code &ec,
-                              std::tuple<int, uint8_t, uint8_t, uint8_t,
-                                         uint8_t, std::vector<uint8_t>>
-                                  response) {
-                    if (ec)
-                    {
-                        phosphor::logging::log<phosphor::logging::level::ERR>(
-                            "sendRequest: Error request response");
-                        return;
-                    }
-
-                    std::vector<uint8_t> dataReceived;
-                    int status = -1;
-                    uint8_t netFn = 0, lun = 0, cmd = 0, cc = 0;
-
-                    std::tie(status, netFn, lun, cmd, cc, dataReceived) =
-                        response;
-
-                    if (status)
-                    {
-                        phosphor::logging::log<phosphor::logging::level::ERR>(
-                            "sendRequest: non-zero response status ",
-                            phosphor::logging::entry("%d", status));
-                        return;
-                    }
-
-                    (*requestIter)->handleResponse(cc, dataReceived);
-                },
-                ipmbBus, ipmbObj, ipmbIntf, "sendRequest", ipmbMeChannelNum,
-                netFn, lun, cmd, data);
-
-            requestIter++;
-            processRequests(requestIter);
-        });
+/**
+ * @brief Passes readings of the request to their consumers
+ */
+void publishReadings(Request &request)
+{
+    for (const auto &reading : request.getReadings())
+    {
+        snapshot.update(reading.id, reading.value, reading.timestampUs,
+                        reading.valid);
+        telemetryFeed.publish(reading.id, reading.value, reading.timestampUs,
+                              reading.valid);
+    }
+    updateReadiness();
 }
 
-void performReadings()
+/**
+ * @brief Statistics of all channels from the last readings, without asking
+ * the ME, so that one call gives a consistent view of the node
+ */
+std::tuple<uint64_t, AllStatisticsMap> collectAllStatistics()
 {
-    readingsSchedulingTimer.expires_after(
-        std::chrono::seconds(readingsInterval));
-    readingsSchedulingTimer.async_wait([](const boost::system::error_code &ec) {
-        if (ec)
-        {
-            phosphor::logging::log<phosphor::logging::level::ERR>(
-                "performReadings: timer error");
-            return;
-        }
+    AllStatisticsMap stats;
+    for (auto &channel : channels)
+    {
+        channel->collectStatistics(stats);
+    }
+    uint64_t timestampUs = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            ProxyClock::now().time_since_epoch())
+            .count());
+    return {timestampUs, std::move(stats)};
+}
 
-        processRequests(configuredSensors.begin());
+/**
+ * @brief Registers latency of all handlers and served methods for the calling
+ * thread, so that no histogram is allocated while its loop runs
+ */
+void registerLatencyNames()
+{
+    HandlerScope::registerNames(
+        {"MeVersion.Update", "Policy.Applied", "Policy.Limit.Set",
+         "Policy.LimitException.Set", "Policy.CorrectionInMs.Set",
+         "Policy.Enabled.Set", "Policy.RefreshStatistics",
+         "Policy.Reprovision", "Policy.Revalidate", "Policy.Reconcile",
+         "createAssociations", "GetAllStatistics", "configurationMatch",
+         "Trace.Dump", "VirtualClock.Advance", "Sensor.GetQuantiles",
+         "SetHealth", "powerMatch", "processRequests", "sendRequest response",
+         "publishSamples", "performReadings", "performAdaptiveReadings",
+         "readHostState", "refreshWindowStatistics", "refreshMeVersion"});
+    ServingScope::registerNames({"Policy.Delete", "Policy.GetStatistics",
+                                 "Domain.CreateWithId",
+                                 "Domain.GetStatistics"});
+}
 
-        performReadings();
-    });
+/**
+ * @brief Creates IPMB transport, talking to the ME through the Ipmb service
+ * unless traffic is replayed from a log or simulated
+ */
+std::shared_ptr<IpmbTransport> createTransport(const ProxyOptions &options)
+{
+    if (options.simulate)
+    {
+        phosphor::logging::log<phosphor::logging::level::INFO>(
+            "Simulating IPMB responses");
+        return std::make_shared<SimulatedIpmbTransport>(pollIo);
+    }
+    if (!options.replayFile.empty())
+    {
+        phosphor::logging::log<phosphor::logging::level::INFO>(
+            "Replaying IPMB traffic",
+            phosphor::logging::entry("FILE=%s", options.replayFile.c_str()));
+#ifdef NM_VIRTUAL_CLOCK
+        // Recorded latency costs nothing on the virtual clock, fast replay
+        // runs the clock free instead
+        bool realTime = true;
+#else
+        // Poll timers still run in real time, only responses are not delayed
+        bool realTime = options.replayRealTime;
+#endif
+        return std::make_shared<ReplayIpmbTransport>(
+            pollIo, options.replayFile, realTime,
+            []() { replayEnded = true; });
+    }
+
+    auto transport = std::make_shared<DbusIpmbTransport>(pollConn);
+    if (!options.recordFile.empty())
+    {
+        phosphor::logging::log<phosphor::logging::level::INFO>(
+            "Recording IPMB traffic",
+            phosphor::logging::entry("FILE=%s", options.recordFile.c_str()));
+        return std::make_shared<RecordingIpmbTransport>(transport,
+                                                        options.recordFile);
+    }
+    return transport;
 }
 
-void createSensors()
+void createChannels(const std::vector<ChannelConfig> &configs,
+                    std::shared_ptr<IpmbTransport> transport,
+                    uint32_t requestBudget,
+                    std::shared_ptr<PolicyJournal> journal)
 {
-    // NM Statistics
-    // Global power statistics
-    configuredSensors.push_back(std::make_unique<PowerMetric>(server));
-    configuredSensors.push_back(std::make_unique<GlobalPowerPlatform>(
-        server, 0, 2040, "power", "Total_Power", globalPowerStats,
-        entirePlatform, 0));
-    configuredSensors.push_back(
-        std::make_unique<GlobalPowerCpu>(server, 0, 510, "power", "CPU_Power",
-                                         globalPowerStats, cpuSubsystem, 0));
-    configuredSensors.push_back(std::make_unique<GlobalPowerMemory>(
-        server, 0, 255, "power", "Memory_Power", globalPowerStats,
-        memorySubsystem, 0));
+    // IPMB link is shared, so is the budget of fast readings
+    auto budget = std::make_shared<RequestBudget>(requestBudget);
+    for (size_t index = 0; index < configs.size(); index++)
+    {
+        channels.push_back(std::make_unique<MeChannel>(
+            conn, pollConn, transport, server, configs[index], index,
+            configs.size(), publishReadings, budget, journal));
+    }
+
+    // Give every reading a process-wide id, also used as its snapshot entry
+    uint16_t readingId = 0;
+    for (auto &channel : channels)
+    {
+        for (auto &sensor : channel->getSensors())
+        {
+            for (auto &reading : sensor->getReadings())
+            {
+                reading.id = readingId++;
+                if (!snapshot.add(reading.id, reading.name))
+                {
+                    phosphor::logging::log<phosphor::logging::level::WARNING>(
+                        "createChannels: reading not added to snapshot",
+                        phosphor::logging::entry("NAME=%s",
+                                                 reading.name.c_str()));
+                }
+            }
+        }
+    }
+
+    /* For all Active images, functional endpoints must be added. */
+    std::vector<Association> associations;
+    for (auto &channel : channels)
+    {
+        associations.push_back(Association("functional", "software_version",
+                                           channel->getSoftwarePath()));
+    }
+    auto associationsIface = server.add_interface(
+        "/xyz/openbmc_project/software", associationInterface);
+    associationsIface->register_property("Associations", associations);
+    associationsIface->initialize();
 }
 
+static bool associationsQueryInFlight = false;
+static bool associationsRebuildPending = false;
+static std::string associationsParentPath;
+
 void createAssociations()
 {
     using GetSubTreeType = std::vector<std::pair<
@@ -139,8 +248,25 @@ void createAssociations()
     constexpr int32_t scanDepth = 0;
     std::vector<std::string> confPath{sensorConfPath};
 
+    // Collapse requests arriving while mapper query is pending into one
+    // follow-up query
+    if (associationsQueryInFlight)
+    {
+        associationsRebuildPending = true;
+        return;
+    }
+    associationsQueryInFlight = true;
+
     conn->async_method_call(
         [](boost::system::error_code ec, GetSubTreeType &subtree) {
+            HandlerScope scope("createAssociations");
+            associationsQueryInFlight = false;
+            if (associationsRebuildPending)
+            {
+                associationsRebuildPending = false;
+                conn->get_io_context().post(createAssociations);
+            }
+
             if (ec)
             {
                 phosphor::logging::log<phosphor::logging::level::ERR>(
@@ -166,10 +292,16 @@ void createAssociations()
             }
             std::string parentPath =
                 std::filesystem::path(subtree.front().first).parent_path();
+            if (parentPath == associationsParentPath)
+            {
+                return;
+            }
+            associationsParentPath = parentPath;
+
             // Create associations for all configured sensors
-            for (auto &sensor : configuredSensors)
+            for (auto &channel : channels)
             {
-                sensor->createAssociation(server, parentPath);
+                channel->createAssociations(server, parentPath);
             }
         },
         "xyz.openbmc_project.ObjectMapper",
@@ -178,65 +310,250 @@ void createAssociations()
         "/xyz/openbmc_project/inventory/system", scanDepth, confPath);
 }
 
+/**
+ * @brief Rebuilds associations once configuration signals settle down
+ */
+void scheduleAssociationsRebuild()
+{
+    static bool scheduled = false;
+    static ProxyClock::time_point firstSignal;
+
+    auto now = ProxyClock::now();
+    if (!scheduled)
+    {
+        scheduled = true;
+        firstSignal = now;
+    }
+    else if (now - firstSignal >=
+             std::chrono::milliseconds(associationsDebounceMaxDelay))
+    {
+        return;
+    }
+
+    associationsDebounceTimer.expires_after(
+        std::chrono::milliseconds(associationsDebounceInterval));
+    associationsDebounceTimer.async_wait(
+        [](const boost::system::error_code &ec) {
+            if (ec)
+            {
+                // cancelled by newer signal
+                return;
+            }
+            scheduled = false;
+            createAssociations();
+        });
+}
+
+#ifdef NM_ALLOCATION_COUNTER
+static std::shared_ptr<sdbusplus::asio::dbus_interface> allocationsInterface;
+
+/**
+ * @brief Samples allocations made by the poll loop handlers every readings
+ * interval. The transport, i.e. the Dbus call machinery and the handover to
+ * the serving thread, is excluded, so in steady state none are expected.
+ */
+void reportPollAllocations(ProxyTimer &timer, uint64_t lastAllocations)
+{
+    timer.expires_after(std::chrono::seconds(readingsInterval));
+    timer.async_wait([&timer, lastAllocations](
+                         const boost::system::error_code &ec) {
+        if (ec)
+        {
+            return;
+        }
+        uint64_t allocations = AllocationCounter::getScoped();
+        uint64_t perCycle = allocations - lastAllocations;
+        boost::asio::post(io, [perCycle]() {
+            allocationsInterface->set_property("PollAllocationsPerCycle",
+                                               perCycle);
+            allocationsInterface->set_property("Total",
+                                               AllocationCounter::getTotal());
+            allocationsInterface->set_property("Live",
+                                               AllocationCounter::getLive());
+        });
+        reportPollAllocations(timer, allocations);
+    });
+}
+#endif
+
+/**
+ * @brief Reports messages dropped by rate limited logs when a burst stopped
+ * and no message lets its summary through. Limiters count in real time, so
+ * does the timer, also with the virtual clock.
+ */
+void flushSuppressedLogs(boost::asio::steady_timer &timer)
+{
+    timer.expires_after(std::chrono::seconds(logRateInterval));
+    timer.async_wait([&timer](const boost::system::error_code &ec) {
+        if (ec)
+        {
+            return;
+        }
+        LogRateLimiter::flushExpired();
+        flushSuppressedLogs(timer);
+    });
+}
+
 /**
  * @brief Main
  */
 int main(int argc, char *argv[])
 {
+    auto options = parseOptions(argc, argv);
+    if (!options)
+    {
+        return -1;
+    }
+
     conn->request_name(nmdBus);
-    createSensors();
+    registerLatencyNames();
+#ifdef NM_VIRTUAL_CLOCK
+    // Poll loop runs only while the clock is advanced, its lag is meaningless
+    LoopMonitor loopMonitor(io, server);
+#else
+    LoopMonitor loopMonitor(io, server, &pollIo);
+#endif
+
+    readinessInterface = server.add_interface(nmdObj, readinessIntf);
+    readinessInterface->register_property("Ready", ready);
+    readinessInterface->initialize();
+
+    // Domains and policies of all channels can be discovered in one call
+    server.add_manager(nmRootPath);
+    std::shared_ptr<sdbusplus::asio::dbus_interface> allStatisticsInterface =
+        server.add_interface(nmRootPath, nmAllStatisticsIf);
+    allStatisticsInterface->register_method("GetAllStatistics", []() {
+        HandlerScope scope("GetAllStatistics");
+        return collectAllStatistics();
+    });
+    allStatisticsInterface->initialize();
+
+    std::shared_ptr<PolicyJournal> journal;
+    if (!options->journalFile.empty())
+    {
+        journal = std::make_shared<PolicyJournal>(options->journalFile);
+    }
+    createChannels(options->channels, createTransport(*options),
+                   options->adaptiveBudget, journal);
     createAssociations();
-    performReadings();
-    GetMeVer getMeVer(conn, server);
-
-    // associations have to be on the association interface
-    std::shared_ptr<sdbusplus::asio::dbus_interface> statusInterface =
-        server.add_interface(meStatusPath, associationInterface);
-    statusInterface->register_property("Associations",
-                                       std::vector<Association>{});
-    statusInterface->initialize();
-
-    HealthData healthData(statusInterface);
-
-    std::shared_ptr<sdbusplus::asio::dbus_interface> healthInterface =
-        server.add_interface(meStatusPath, "xyz.openbmc_project.SetHealth");
-    healthInterface->register_method(
-        "SetHealth",
-        [&healthData](const std::string &type, const std::string &level) {
-            healthData.set(type, level);
-        });
-    healthInterface->initialize();
+    for (auto &channel : channels)
+    {
+        channel->start();
+    }
+
+    // Do not hold dependant units forever when the ME does not respond
+    ProxyTimer readinessTimer(io);
+    readinessTimer.expires_after(std::chrono::seconds(readinessTimeout));
+    readinessTimer.async_wait([](const boost::system::error_code &ec) {
+        if (ec || ready)
+        {
+            return;
+        }
+        phosphor::logging::log<phosphor::logging::level::WARNING>(
+            "Sensors not read in time, reporting startup anyway");
+        sd_notify(0, "READY=1\nSTATUS=Waiting for Node Manager readings");
+    });
 
-    Domain domainDcTotal(conn, server, dcTotal);
+    boost::asio::steady_timer logFlushTimer(io);
+    flushSuppressedLogs(logFlushTimer);
 
     sdbusplus::bus::match::match configurationMatch(
         static_cast<sdbusplus::bus::bus &>(*conn),
         "type='signal',member='PropertiesChanged',"
         "arg0namespace='" +
             std::string(sensorConfPath) + "'",
-        [](sdbusplus::message::message &message) { createAssociations(); });
+        [](sdbusplus::message::message &message) {
+            HandlerScope scope("configurationMatch");
+            scheduleAssociationsRebuild();
+        });
 
-    sdbusplus::bus::match::match powerMatch(
-        static_cast<sdbusplus::bus::bus &>(*conn),
-        "type='signal',member='PropertiesChanged',path='" +
-            std::string(power::path) + "',arg0='" +
-            std::string(power::interface) + "'",
-        [&healthData](sdbusplus::message::message &message) {
-            std::string objectName;
-            boost::container::flat_map<std::string, std::variant<std::string>>
-                values;
-            message.read(objectName, values);
-            auto findState = values.find(power::property);
-            if (findState != values.end())
+#ifdef NM_REQUEST_TRACING
+    std::shared_ptr<sdbusplus::asio::dbus_interface> traceInterface =
+        server.add_interface(nmdObj, traceIntf);
+    traceInterface->register_method("Dump", []() {
+        HandlerScope scope("Trace.Dump");
+        return RequestTrace::toChromeJson();
+    });
+    traceInterface->initialize();
+
+    boost::asio::signal_set traceSignal(io, SIGUSR1);
+    std::function<void(const boost::system::error_code &, int)> dumpTrace =
+        [&traceSignal, &dumpTrace](const boost::system::error_code &ec,
+                                   int signal) {
+            if (ec)
             {
-                if (boost::ends_with(std::get<std::string>(findState->second),
-                                     "Running"))
-                {
-                    healthData.clear();
-                }
+                return;
             }
-        });
+            if (!RequestTrace::dumpToFile(traceDumpFile))
+            {
+                phosphor::logging::log<phosphor::logging::level::ERR>(
+                    "Failed to dump request trace",
+                    phosphor::logging::entry("FILE=%s", traceDumpFile));
+            }
+            traceSignal.async_wait(dumpTrace);
+        };
+    traceSignal.async_wait(dumpTrace);
+#endif
+
+#ifdef NM_ALLOCATION_COUNTER
+    allocationsInterface = server.add_interface(nmdObj, allocationsIntf);
+    allocationsInterface->register_property("PollAllocationsPerCycle",
+                                            uint64_t{0});
+    allocationsInterface->register_property("Total", uint64_t{0});
+    allocationsInterface->register_property("Live", uint64_t{0});
+    allocationsInterface->initialize();
+
+    ProxyTimer allocationsTimer(pollIo);
+    reportPollAllocations(allocationsTimer, 0);
+#endif
+
+#ifdef NM_VIRTUAL_CLOCK
+    // Polling runs only while the clock is advanced, on the main thread
+    std::shared_ptr<sdbusplus::asio::dbus_interface> clockInterface =
+        server.add_interface(nmdObj, virtualClockIntf);
+    clockInterface->register_method("Advance", [](uint64_t milliseconds) {
+        HandlerScope scope("VirtualClock.Advance");
+        VirtualClock::advance(std::chrono::milliseconds(milliseconds));
+        // Deliver responses to requests sent by the last timers
+        pollIo.restart();
+        pollIo.poll();
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                VirtualClock::now().time_since_epoch())
+                .count());
+    });
+    clockInterface->initialize();
+
+    // Fast replay moves the clock from timer to timer until the log runs out,
+    // serving handlers run in between
+    std::function<void()> runClock = [&runClock]() {
+        if (replayEnded || !VirtualClock::advanceToNext())
+        {
+            phosphor::logging::log<phosphor::logging::level::INFO>(
+                "Virtual clock stopped, advance it over Dbus");
+            return;
+        }
+        pollIo.restart();
+        pollIo.poll();
+        boost::asio::post(io, runClock);
+    };
+    if (!options->replayFile.empty() && !options->replayRealTime)
+    {
+        boost::asio::post(io, runClock);
+    }
 
     io.run();
+#else
+    auto pollWork = boost::asio::make_work_guard(pollIo);
+    std::thread pollThread([]() {
+        registerLatencyNames();
+        pollIo.run();
+    });
+
+    io.run();
+
+    pollIo.stop();
+    pollThread.join();
+#endif
     return 0;
 }
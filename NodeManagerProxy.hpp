@@ -13,6 +13,20 @@
  *  limitations under the License.
  */
 
+#include "AllocationCounter.hpp"
+#include "DerivedExpression.hpp"
+#include "IpmiCodec.hpp"
+#include "LoopMonitor.hpp"
+#include "PolicyAnalytics.hpp"
+#include "PolicyJournal.hpp"
+#include "ProxyClock.hpp"
+#include "RateLimitedLog.hpp"
+#include "RequestTrace.hpp"
+#include "SensorQuantiles.hpp"
+#include "WindowStatistics.hpp"
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/spawn.hpp>
 #include <boost/container/flat_set.hpp>
 #include <phosphor-logging/log.hpp>
 #include <sdbusplus/asio/object_server.hpp>
@@ -28,6 +42,17 @@ constexpr const char *nmdBus = "xyz.openbmc_project.NodeManagerProxy";
 constexpr const char *nmdObj = "/xyz/openbmc_project/NodeManagerProxy";
 constexpr const char *propObj = "/xyz/openbmc_project/sensors/";
 constexpr const char *nmdSensorIntf = "xyz.openbmc_project.Sensor.Value";
+constexpr const char *sensorUnitWatts =
+    "xyz.openbmc_project.Sensor.Value.Unit.Watts";
+constexpr const char *sensorUnitSeconds =
+    "xyz.openbmc_project.Sensor.Value.Unit.Seconds";
+constexpr const char *sensorUnitPercent =
+    "xyz.openbmc_project.Sensor.Value.Unit.Percent";
+// ME counters have no Sensor.Value unit, so they are not published as sensors
+constexpr const char *nmdCounterIntf =
+    "xyz.openbmc_project.NodeManagerProxy.Counter";
+constexpr const char *nmdCounterObj =
+    "/xyz/openbmc_project/NodeManagerProxy/counters/";
 constexpr const char *nmdPowerCapIntf = "xyz.openbmc_project.Control.Power.Cap";
 constexpr const char *nmdPowerMetricIntf =
     "xyz.openbmc_project.Power.PowerMetric";
@@ -45,10 +70,17 @@ constexpr const char *sensorConfPath =
 constexpr const char *sensorName = "Node_Manager_Sensor";
 constexpr const char *associationInterface =
     "xyz.openbmc_project.Association.Definitions";
+constexpr const char *readinessIntf =
+    "xyz.openbmc_project.NodeManagerProxy.Readiness";
 
 // this currently can be anything as it's only used to set the LED, might be
 // good later to change it for redfish, but I'm not sure to what today
 constexpr const char *meStatusPath = "/xyz/openbmc_project/status/me";
+constexpr const char *nmRootPath = "/xyz/openbmc_project/NodeManager";
+constexpr const char *policyJournalPath =
+    "/var/lib/node-manager-proxy/policies.journal";
+constexpr const char *powerMetricPath =
+    "/xyz/openbmc_project/Power/PowerMetric";
 
 constexpr const sdbusplus::SdBusDuration kIpmbTimeout =
     sdbusplus::SdBusDuration{1000000};
@@ -59,7 +91,7 @@ namespace power
 {
 const static constexpr char *busname = "xyz.openbmc_project.State.Host";
 const static constexpr char *interface = "xyz.openbmc_project.State.Host";
-const static constexpr char *path = "/xyz/openbmc_project/state/host0";
+const static constexpr char *pathPrefix = "/xyz/openbmc_project/state/host";
 const static constexpr char *property = "CurrentHostState";
 } // namespace power
 
@@ -70,11 +102,36 @@ constexpr uint32_t readingsInterval = 10; // seconds
 constexpr uint32_t framesInterval =
     100; // msec - number of frames per reading * framesInterval should be 2x
          // less than readingsInterval
+constexpr uint32_t hostOffPollDivider =
+    6; // host dependent sensors are read every Nth cycle while host is off
+constexpr uint32_t hostInterfacePollDivider =
+    6; // ME to host interface statistics are read every Nth cycle
+constexpr uint32_t hostOnBurstInterval = 1; // seconds
+constexpr uint32_t hostOnBurstDuration =
+    30; // seconds - fast readings after host starts, to catch boot power spike
+constexpr uint32_t readinessTimeout =
+    60; // seconds - startup is reported to systemd even without readings
+constexpr uint32_t associationsDebounceInterval =
+    1000; // msec - configuration signals within that time cause one rebuild
+constexpr uint32_t associationsDebounceMaxDelay =
+    5000; // msec - rebuild is not postponed longer by a stream of signals
+constexpr uint32_t policyStatsInterval =
+    10; // seconds - enabled policies statistics refresh, 0 disables caching
+constexpr uint32_t sketchEpoch =
+    86400; // seconds - sensor quantile sketches restart, 0 never
+constexpr double adaptiveRate =
+    5; // Watts per second - power change switching a sensor to fast
+       // readings, 0 disables adaptive readings
+constexpr uint32_t adaptiveInterval =
+    1000; // msec - fast readings period, not shorter than framesInterval
+constexpr uint32_t adaptiveBudget =
+    30; // requests per minute - fast readings of all channels together
 
 /**
  * @brief Ipmb defines
  */
-constexpr uint8_t ipmbMeChannelNum = 1;
+constexpr uint8_t ipmbMeChannelNum = 1; // used when no channel is configured
+constexpr size_t maxFrameSize = 32;     // bytes - request payload capacity
 
 /**
  * @brief Ipmi defines
@@ -151,6 +208,20 @@ constexpr uint8_t ipmiGetDevIdNetFn = 0x6;
 constexpr uint8_t ipmiGetDevIdLun = 0;
 constexpr uint8_t ipmiGetDevIdCmd = 0x1;
 
+/**
+ * @brief ME reset detection defines
+ */
+constexpr uint8_t ipmiCcNodeBusy = 0xC0;
+constexpr uint8_t ipmiCcNotSupportedInPresentState = 0xD5;
+constexpr uint8_t nmCcInvalidPolicyId = 0x80;
+constexpr uint32_t meResetFailureBurst =
+    3; // consecutive failed sensor responses taken for ME reset
+constexpr uint32_t meTimestampSettle =
+    5; // seconds - ME clock going back less is not taken for a reset, as
+       // statistics of different sensors are not stamped at the same time
+constexpr uint32_t meVersionInterval =
+    300; // seconds - Get Device ID period, catches resets by firmware update
+
 /**
  * @brief Part of Get Device ID Command Response Payload
  */
@@ -177,6 +248,13 @@ typedef struct
     uint8_t imageFlags;
 } __attribute__((packed)) ipmiFwVerAux;
 
+/**
+ * @brief Get Device ID Command Request Payload, empty
+ */
+typedef struct
+{
+} ipmiGetDeviceIdReq;
+
 /**
  * @brief Get Device ID Command Full Response Payload
  */
@@ -320,32 +398,356 @@ typedef struct
 } __attribute__((packed)) nmIpmiGetNmCapabilitesResp;
 static_assert(sizeof(nmIpmiGetNmCapabilitesResp) == 21);
 
+/**
+ * @brief Ipmi command descriptors. Every request type is bound to its
+ * response type and routing, so a request cannot be sent with a wrong command
+ * nor its response decoded into a wrong struct. Sizes are wire sizes.
+ */
+template <typename Req>
+struct IpmiCommand;
+
+template <>
+struct IpmiCommand<ipmiGetDeviceIdReq>
+{
+    using Response = ipmiGetDeviceIdResp;
+    static constexpr uint8_t netFn = ipmiGetDevIdNetFn;
+    static constexpr uint8_t lun = ipmiGetDevIdLun;
+    static constexpr uint8_t cmd = ipmiGetDevIdCmd;
+    static constexpr size_t requestSize = 0;
+    static constexpr size_t responseSize = 15;
+};
+
+template <>
+struct IpmiCommand<nmIpmiGetNmStatisticsReq>
+{
+    using Response = nmIpmiGetNmStatisticsResp;
+    static constexpr uint8_t netFn = ipmiGetNmStatisticsNetFn;
+    static constexpr uint8_t lun = ipmiGetNmStatisticsLun;
+    static constexpr uint8_t cmd = ipmiGetNmStatisticsCmd;
+    static constexpr size_t requestSize = 6;
+    static constexpr size_t responseSize = 20;
+};
+
+template <>
+struct IpmiCommand<nmIpmiSetNmPolicyReq>
+{
+    using Response = nmIpmiSetNmPolicyResp;
+    static constexpr uint8_t netFn = ipmiSetNmPolicyNetFn;
+    static constexpr uint8_t lun = ipmiSetNmPolicyLun;
+    static constexpr uint8_t cmd = ipmiSetNmPolicyCmd;
+    static constexpr size_t requestSize = 17;
+    static constexpr size_t responseSize = 3;
+};
+
+template <>
+struct IpmiCommand<nmIpmiGetNmPolicyReq>
+{
+    using Response = nmIpmiGetNmPolicyResp;
+    static constexpr uint8_t netFn = ipmiGetNmPolicyNetFn;
+    static constexpr uint8_t lun = ipmiGetNmPolicyLun;
+    static constexpr uint8_t cmd = ipmiGetNmPolicyCmd;
+    static constexpr size_t requestSize = 5;
+    static constexpr size_t responseSize = 16;
+};
+
+template <>
+struct IpmiCommand<nmIpmiGetNmCapabilitesReq>
+{
+    using Response = nmIpmiGetNmCapabilitesResp;
+    static constexpr uint8_t netFn = ipmiGetNmCapabilitesNetFn;
+    static constexpr uint8_t lun = ipmiGetNmCapabilitesLun;
+    static constexpr uint8_t cmd = ipmiGetNmCapabilitesCmd;
+    static constexpr size_t requestSize = 5;
+    static constexpr size_t responseSize = 21;
+};
+
+/**
+ * @brief Ipmi codecs. Fields are moved byte by byte, bit fields are composed
+ * with shifts, so the wire format does not depend on the compiler struct and
+ * bit field layout.
+ */
+void ipmiEncode(IpmiWriter &writer, const ipmiIana &iana)
+{
+    writer.put8(iana.b0);
+    writer.put8(iana.b1);
+    writer.put8(iana.b2);
+}
+
+void ipmiDecode(IpmiReader &reader, ipmiIana &iana)
+{
+    iana.b0 = reader.get8();
+    iana.b1 = reader.get8();
+    iana.b2 = reader.get8();
+}
+
+void ipmiEncode(IpmiWriter &writer, const ipmiGetDeviceIdReq &req)
+{
+}
+
+void ipmiDecode(IpmiReader &reader, ipmiGetDeviceIdResp &resp)
+{
+    resp.deviceId = reader.get8();
+    uint8_t byte = reader.get8();
+    resp.deviceRev = ipmiBits(byte, 0, 4);
+    resp.reserved0 = ipmiBits(byte, 4, 3);
+    resp.sdrPresent = ipmiBits(byte, 7, 1);
+    byte = reader.get8();
+    resp.fwMajorMinor.fwMajorRev = ipmiBits(byte, 0, 7);
+    resp.fwMajorMinor.inUpgrade = ipmiBits(byte, 7, 1);
+    byte = reader.get8();
+    resp.fwMajorMinor.fwHotfixRev = ipmiBits(byte, 0, 4);
+    resp.fwMajorMinor.fwMinorRev = ipmiBits(byte, 4, 4);
+    resp.ipmiVersion = reader.get8();
+    resp.featureMask = reader.get8();
+    ipmiDecode(reader, resp.ianaId);
+    resp.prodIdMinor = reader.get8();
+    resp.prodIdMajor = reader.get8();
+    byte = reader.get8();
+    resp.fwVerAux.nmVersion = ipmiBits(byte, 0, 4);
+    resp.fwVerAux.dcmiVersion = ipmiBits(byte, 4, 4);
+    byte = reader.get8();
+    resp.fwVerAux.b = ipmiBits(byte, 0, 4);
+    resp.fwVerAux.a = ipmiBits(byte, 4, 4);
+    byte = reader.get8();
+    resp.fwVerAux.patch = ipmiBits(byte, 0, 4);
+    resp.fwVerAux.c = ipmiBits(byte, 4, 4);
+    resp.fwVerAux.imageFlags = reader.get8();
+}
+
+void ipmiEncode(IpmiWriter &writer, const nmIpmiGetNmStatisticsReq &req)
+{
+    ipmiEncode(writer, req.iana);
+    writer.put8(static_cast<uint8_t>(req.mode | req.reserved3B << 5));
+    writer.put8(static_cast<uint8_t>(req.domainId | req.statsSide << 4 |
+                                     req.reserved << 5 |
+                                     req.perComponent << 7));
+    writer.put8(req.policyId);
+}
+
+void ipmiDecode(IpmiReader &reader, nmIpmiGetNmStatisticsResp &resp)
+{
+    ipmiDecode(reader, resp.iana);
+    // Energy accumulator of the energy modes is not used by the proxy
+    resp.data.stats.cur = reader.get16();
+    resp.data.stats.min = reader.get16();
+    resp.data.stats.max = reader.get16();
+    resp.data.stats.avg = reader.get16();
+    resp.timeStamp = reader.get32();
+    resp.statsReportPeriod = reader.get32();
+    uint8_t byte = reader.get8();
+    resp.domainId = ipmiBits(byte, 0, 4);
+    resp.policyGlobalState = ipmiBits(byte, 4, 1);
+    resp.policyOperationalState = ipmiBits(byte, 5, 1);
+    resp.measurmentsState = ipmiBits(byte, 6, 1);
+    resp.policyActivationState = ipmiBits(byte, 7, 1);
+}
+
+void ipmiEncode(IpmiWriter &writer, const nmIpmiSetNmPolicyReq &req)
+{
+    ipmiEncode(writer, req.iana);
+    writer.put8(static_cast<uint8_t>(req.domainId | req.policyEnabled << 4 |
+                                     req.reservedByte4 << 5));
+    writer.put8(req.policyId);
+    writer.put8(static_cast<uint8_t>(
+        req.triggerType | req.configurationAction << 4 |
+        req.cpuPowerCorrection << 5 | req.storageOption << 7));
+    writer.put8(static_cast<uint8_t>(req.sendAlert | req.shutdownSystem << 1 |
+                                     req.reservedByte7 << 2));
+    writer.put16(static_cast<uint16_t>(req.limit));
+    writer.put32(req.correctionTime);
+    writer.put16(req.triggerLimit);
+    writer.put16(req.statsPeriod);
+}
+
+void ipmiDecode(IpmiReader &reader, nmIpmiSetNmPolicyResp &resp)
+{
+    ipmiDecode(reader, resp.iana);
+}
+
+void ipmiEncode(IpmiWriter &writer, const nmIpmiGetNmPolicyReq &req)
+{
+    ipmiEncode(writer, req.iana);
+    writer.put8(static_cast<uint8_t>(req.domainId | req.reserved0 << 4));
+    writer.put8(req.policyId);
+}
+
+void ipmiDecode(IpmiReader &reader, nmIpmiGetNmPolicyResp &resp)
+{
+    ipmiDecode(reader, resp.iana);
+    uint8_t byte = reader.get8();
+    resp.domainId = ipmiBits(byte, 0, 4);
+    resp.policyEnabled = ipmiBits(byte, 4, 1);
+    resp.domainEnabled = ipmiBits(byte, 5, 1);
+    resp.globalEnabled = ipmiBits(byte, 6, 1);
+    resp.external = ipmiBits(byte, 7, 1);
+    byte = reader.get8();
+    resp.triggerType = ipmiBits(byte, 0, 4);
+    resp.policyType = ipmiBits(byte, 4, 1);
+    resp.cpuPowerCorrection = ipmiBits(byte, 5, 2);
+    resp.storageOption = ipmiBits(byte, 7, 1);
+    byte = reader.get8();
+    resp.sendAlert = ipmiBits(byte, 0, 1);
+    resp.shutdownSystem = ipmiBits(byte, 1, 1);
+    resp.reserved0 = ipmiBits(byte, 2, 6);
+    resp.limit = static_cast<int16_t>(reader.get16());
+    resp.correctionTime = reader.get32();
+    resp.triggerLimit = reader.get16();
+    resp.statsPeriod = reader.get16();
+}
+
+void ipmiEncode(IpmiWriter &writer, const nmIpmiGetNmCapabilitesReq &req)
+{
+    ipmiEncode(writer, req.iana);
+    writer.put8(static_cast<uint8_t>(req.domainId | req.reserved0 << 4));
+    writer.put8(static_cast<uint8_t>(req.policyTriggerType |
+                                     req.policyType << 4 |
+                                     req.reserved1 << 7));
+}
+
+void ipmiDecode(IpmiReader &reader, nmIpmiGetNmCapabilitesResp &resp)
+{
+    ipmiDecode(reader, resp.iana);
+    resp.maxConcurentSettings = reader.get8();
+    resp.maxLimit = reader.get16();
+    resp.minLimit = reader.get16();
+    resp.minCorrectionTime = reader.get32();
+    resp.maxCorrectionTime = reader.get32();
+    resp.minStatsReportingPeriod = reader.get16();
+    resp.maxStatsReportingPeriod = reader.get16();
+    uint8_t byte = reader.get8();
+    resp.domainId = ipmiBits(byte, 0, 4);
+    resp.reserved = ipmiBits(byte, 4, 4);
+}
+
+/**
+ * @brief Serializes request into the payload buffer, reusing its capacity
+ */
+template <typename Req>
+void ipmiSerialize(const Req &req, std::vector<uint8_t> &data)
+{
+    data.resize(IpmiCommand<Req>::requestSize);
+    IpmiWriter writer(data.data());
+    ipmiEncode(writer, req);
+}
+
+/**
+ * @brief Deserializes response of the Req command. Fails when payload size
+ * does not match.
+ */
+template <typename Req>
+bool ipmiDeserialize(const std::vector<uint8_t> &data,
+                     typename IpmiCommand<Req>::Response &resp)
+{
+    if (data.size() != IpmiCommand<Req>::responseSize)
+    {
+        return false;
+    }
+    IpmiReader reader(data.data());
+    ipmiDecode(reader, resp);
+    return true;
+}
+
 /**
  * @brief Ipmb utils
  */
 using IpmbDbusRspType =
     std::tuple<int, uint8_t, uint8_t, uint8_t, uint8_t, std::vector<uint8_t>>;
 
-int ipmbSendRequest(sdbusplus::asio::connection &conn,
-                    IpmbDbusRspType &ipmbResponse,
-                    const std::vector<uint8_t> &dataToSend, uint8_t netFn,
-                    uint8_t lun, uint8_t cmd)
+using IpmbHandler =
+    std::function<void(boost::system::error_code, IpmbDbusRspType &)>;
+
+/**
+ * @brief Path of IPMB requests to the ME. Requests may be sent from either
+ * thread, they are issued and their handlers are called on the poll loop, so
+ * a slow ME never blocks serving Dbus clients.
+ */
+class IpmbTransport
+{
+  public:
+    virtual ~IpmbTransport() = default;
+
+    virtual void asyncSendRequest(uint8_t channel,
+                                  const std::vector<uint8_t> &dataToSend,
+                                  uint8_t netFn, uint8_t lun, uint8_t cmd,
+                                  IpmbHandler handler) = 0;
+};
+
+/**
+ * @brief Sends requests through the Ipmb service over the poll connection
+ */
+class DbusIpmbTransport : public IpmbTransport
 {
-    try
+  public:
+    DbusIpmbTransport(
+        std::shared_ptr<sdbusplus::asio::connection> pollConnArg) :
+        pollConn(pollConnArg)
     {
-        auto mesg =
-            conn.new_method_call(ipmbBus, ipmbObj, ipmbIntf, "sendRequest");
-        mesg.append(ipmbMeChannelNum, netFn, lun, cmd, dataToSend);
-        auto ret = conn.call(mesg, kIpmbTimeout);
-        ret.read(ipmbResponse);
-        return 0;
     }
-    catch (sdbusplus::exception::exception &e)
+
+    void asyncSendRequest(uint8_t channel,
+                          const std::vector<uint8_t> &dataToSend,
+                          uint8_t netFn, uint8_t lun, uint8_t cmd,
+                          IpmbHandler handler) override
     {
-        phosphor::logging::log<phosphor::logging::level::ERR>(
-            "ipmbSendRequest:, dbus call exception");
-        return -1;
+        boost::asio::io_context &pollIo = pollConn->get_io_context();
+        if (!pollIo.get_executor().running_in_this_thread())
+        {
+            // the poll connection is used by the poll thread only
+            boost::asio::post(pollIo, [this, channel, data{dataToSend}, netFn,
+                                       lun, cmd,
+                                       handler{std::move(handler)}]() mutable {
+                asyncSendRequest(channel, data, netFn, lun, cmd,
+                                 std::move(handler));
+            });
+            return;
+        }
+        // sdbusplus allocates the call and its message, not the proxy
+        NM_ALLOCATIONS_EXCLUDED();
+        pollConn->async_method_call(
+            [handler{std::move(handler)}](boost::system::error_code &ec,
+                                          IpmbDbusRspType &response) {
+                handler(ec, response);
+            },
+            ipmbBus, ipmbObj, ipmbIntf, "sendRequest", channel, netFn, lun,
+            cmd, dataToSend);
     }
+
+  private:
+    std::shared_ptr<sdbusplus::asio::connection> pollConn;
+};
+
+/**
+ * @brief Sends IPMB request from a Dbus method coroutine. The coroutine is
+ * suspended until the response is passed back to the serving side, so other
+ * clients are served while the ME answers.
+ *
+ * @param io - serving io_context the coroutine runs on
+ * @param ec - set when the request could not be delivered
+ */
+IpmbDbusRspType ipmbYieldRequest(IpmbTransport &transport,
+                                 boost::asio::io_context &io,
+                                 boost::asio::yield_context yield,
+                                 uint8_t channel,
+                                 const std::vector<uint8_t> &dataToSend,
+                                 uint8_t netFn, uint8_t lun, uint8_t cmd,
+                                 boost::system::error_code &ec)
+{
+    auto token = yield[ec];
+    return boost::asio::async_initiate<
+        decltype(token), void(boost::system::error_code, IpmbDbusRspType)>(
+        [&](auto handler) {
+            transport.asyncSendRequest(
+                channel, dataToSend, netFn, lun, cmd,
+                [&io, handler](boost::system::error_code ec,
+                               IpmbDbusRspType &response) mutable {
+                    boost::asio::post(
+                        io, [handler, ec,
+                             response{std::move(response)}]() mutable {
+                            handler(ec, std::move(response));
+                        });
+                });
+        },
+        token);
 }
 
 /**
@@ -354,21 +756,29 @@ int ipmbSendRequest(sdbusplus::asio::connection &conn,
 class GetMeVer
 {
   public:
+    /**
+     * @param versionChangedArg - called when version read differs from the
+     * previous one, as the ME was reset by firmware update
+     */
     GetMeVer(std::shared_ptr<sdbusplus::asio::connection> conn,
-             sdbusplus::asio::object_server &server) :
-        conn(conn)
+             std::shared_ptr<IpmbTransport> transport,
+             sdbusplus::asio::object_server &server, uint8_t channel,
+             const std::string &path,
+             std::function<void()> versionChangedArg = nullptr) :
+        conn(conn),
+        transport(transport), channel(channel),
+        versionChanged(std::move(versionChangedArg)),
+        retryTimer(conn->get_io_context())
     {
-        iface = server.add_interface(meSoftwareObjPath, softwareVerIntf);
+        iface = server.add_interface(path, softwareVerIntf);
 
         iface->register_property(
             "Purpose",
             std::string(
                 "xyz.openbmc_project.Software.Version.VersionPurpose.ME"));
 
-        iface->register_property(
-            "Version", std::string(""),
-            [](const std::string &newVal, std::string &oldVal) { return 1; },
-            [this](const std::string &val) { return getDevId(); });
+        // empty until the ME answers
+        iface->register_property("Version", std::string(""));
 
         iface->initialize();
 
@@ -377,7 +787,7 @@ class GetMeVer
          * set "activation" to Active and "RequestedActivation" to None.
          */
         auto activationIface =
-            server.add_interface(meSoftwareObjPath, softwareActivationIntf);
+            server.add_interface(path, softwareActivationIntf);
 
         activationIface->register_property(
             "Activation",
@@ -389,32 +799,31 @@ class GetMeVer
                         "RequestedActivations.None"));
 
         activationIface->initialize();
+    }
 
-        /* For all Active images, functional endpoints must be added. */
-        std::vector<Association> associations;
-        associations.push_back(
-            Association("functional", "software_version", meSoftwareObjPath));
-        auto associationsIface = server.add_interface(
-            "/xyz/openbmc_project/software", associationInterface);
-        associationsIface->register_property("Associations", associations);
-        associationsIface->initialize();
+    /**
+     * @brief Reads the version from the ME in the background, Version is
+     * updated once it answers and the read is retried until it does. Called
+     * periodically by the channel as well, from either side.
+     */
+    void refresh()
+    {
+        using Command = IpmiCommand<ipmiGetDeviceIdReq>;
+        transport->asyncSendRequest(
+            channel, {}, Command::netFn, Command::lun, Command::cmd,
+            [this](boost::system::error_code ec, IpmbDbusRspType &response) {
+                std::string version = ec ? "" : getDevId(response);
+                boost::asio::post(conn->get_io_context(),
+                                  [this, version{std::move(version)}]() {
+                                      HandlerScope scope("MeVersion.Update");
+                                      updateVersion(version);
+                                  });
+            });
     }
 
-    std::string getDevId()
+    static std::string getDevId(const IpmbDbusRspType &ipmbResponse)
     {
         constexpr const char *invalidMeVersion = "";
-        std::vector<uint8_t> dataToSend;
-
-        IpmbDbusRspType ipmbResponse;
-        int sendStatus =
-            ipmbSendRequest(*conn, ipmbResponse, dataToSend, ipmiGetDevIdNetFn,
-                            ipmiGetDevIdLun, ipmiGetDevIdCmd);
-
-        if (sendStatus)
-        {
-            return invalidMeVersion;
-        }
-
         const auto &[status, netfn, lun, cmd, cc, dataReceived] = ipmbResponse;
 
         if (status)
@@ -431,30 +840,160 @@ class GetMeVer
                 phosphor::logging::entry("%d", cc));
             return invalidMeVersion;
         }
-        if (dataReceived.size() != sizeof(ipmiGetDeviceIdResp))
+        ipmiGetDeviceIdResp getDevIdResp = {0};
+        if (!ipmiDeserialize<ipmiGetDeviceIdReq>(dataReceived, getDevIdResp))
         {
             phosphor::logging::log<phosphor::logging::level::WARNING>(
                 "getDevId: response size does not match expected value");
             return invalidMeVersion;
         }
 
-        auto getDevIdResp =
-            reinterpret_cast<const ipmiGetDeviceIdResp *>(dataReceived.data());
-
-        auto major = std::to_string(getDevIdResp->fwMajorMinor.fwMajorRev);
-        auto minor = std::to_string(getDevIdResp->fwMajorMinor.fwMinorRev);
-        auto hotfix = std::to_string(getDevIdResp->fwMajorMinor.fwHotfixRev);
-        auto build = std::to_string(getDevIdResp->fwVerAux.a) +
-                     std::to_string(getDevIdResp->fwVerAux.b) +
-                     std::to_string(getDevIdResp->fwVerAux.c);
-        auto patch = std::to_string(getDevIdResp->fwVerAux.patch);
+        auto major = std::to_string(getDevIdResp.fwMajorMinor.fwMajorRev);
+        auto minor = std::to_string(getDevIdResp.fwMajorMinor.fwMinorRev);
+        auto hotfix = std::to_string(getDevIdResp.fwMajorMinor.fwHotfixRev);
+        auto build = std::to_string(getDevIdResp.fwVerAux.a) +
+                     std::to_string(getDevIdResp.fwVerAux.b) +
+                     std::to_string(getDevIdResp.fwVerAux.c);
+        auto patch = std::to_string(getDevIdResp.fwVerAux.patch);
 
         return major + '.' + minor + '.' + hotfix + '.' + build + '.' + patch;
     }
 
   private:
-    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
     std::shared_ptr<sdbusplus::asio::connection> conn;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
+    std::shared_ptr<IpmbTransport> transport;
+    uint8_t channel;
+    std::string lastVersion;
+    std::function<void()> versionChanged;
+    ProxyTimer retryTimer;
+
+    void updateVersion(const std::string &version)
+    {
+        if (version.empty())
+        {
+            retryTimer.expires_after(std::chrono::seconds(readingsInterval));
+            retryTimer.async_wait([this](const boost::system::error_code &ec) {
+                if (!ec)
+                {
+                    refresh();
+                }
+            });
+            return;
+        }
+        if (!lastVersion.empty() && version != lastVersion && versionChanged)
+        {
+            versionChanged();
+        }
+        lastVersion = version;
+        iface->set_property("Version", version);
+    }
+};
+
+/**
+ * @brief Statistics type provided on DBus as return type for GetStatistics
+ */
+using StatValuesMap = std::map<std::string, std::variant<double, uint32_t>>;
+
+/**
+ * @brief Statistics of many objects, keyed by object path and then by
+ * statistics group as returned by GetStatistics of the object
+ */
+using AllStatisticsMap =
+    std::map<std::string, std::map<std::string, StatValuesMap>>;
+
+/**
+ * @brief Node Manager All Statistics DBus interface, at nmRootPath
+ * The following method shall be supported:
+ * * GetAllStatistics
+ * * * return uint64_t - CLOCK_MONOTONIC timestamp [usec] of the collection
+ * * * return AllStatisticsMap - cached statistics of all domains, policies
+ * * * and sensors
+ */
+constexpr const char *nmAllStatisticsIf =
+    "xyz.openbmc_project.NodeManager.AllStatistics";
+
+/**
+ * @brief Latest sample of a reading, handed over from the poll side decoding
+ * responses to the serving side publishing them. Single writer seqlock, the
+ * serving side reads it without locking the poll thread out.
+ */
+class ReadingSample
+{
+  public:
+    ReadingSample() = default;
+
+    // readings are copied only while sensors are created, before polling
+    ReadingSample(const ReadingSample &other) :
+        sequence(other.sequence.load()), sampleValue(other.sampleValue.load()),
+        sampleTimestampUs(other.sampleTimestampUs.load()),
+        sampleValid(other.sampleValid.load())
+    {
+    }
+
+    ReadingSample &operator=(const ReadingSample &) = delete;
+
+    void store(double value, uint64_t timestampUs, bool valid)
+    {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        sampleValue.store(value, std::memory_order_relaxed);
+        sampleTimestampUs.store(timestampUs, std::memory_order_relaxed);
+        sampleValid.store(valid, std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // keeps the last value and its timestamp, called by the writer only
+    void invalidate()
+    {
+        store(sampleValue.load(std::memory_order_relaxed),
+              sampleTimestampUs.load(std::memory_order_relaxed), false);
+    }
+
+    // returns sequence of the sample, it changes with every store
+    uint32_t load(double &value, uint64_t &timestampUs, bool &valid) const
+    {
+        uint32_t before, after;
+        do
+        {
+            before = sequence.load(std::memory_order_acquire);
+            value = sampleValue.load(std::memory_order_relaxed);
+            timestampUs = sampleTimestampUs.load(std::memory_order_relaxed);
+            valid = sampleValid.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while (before != after || (before & 1) != 0);
+        return before;
+    }
+
+  private:
+    std::atomic<uint32_t> sequence{0}; // odd while being written
+    std::atomic<double> sampleValue{0};
+    std::atomic<uint64_t> sampleTimestampUs{0};
+    std::atomic<bool> sampleValid{false};
+};
+
+/**
+ * @brief Latest value of a single reading provided by a polled request.
+ * Fields are the serving side view, the sample is written by the poll side.
+ */
+struct Reading
+{
+    Reading(const std::string &nameArg) : name(nameArg)
+    {
+    }
+
+    std::string name;
+    uint16_t id{0};
+    double value{0};
+    uint64_t timestampUs{0}; // CLOCK_MONOTONIC, or ProxyClock when virtual
+    bool valid{false};
+    // Sensor.Value range, NaN when not known
+    double minValue{std::numeric_limits<double>::quiet_NaN()};
+    double maxValue{std::numeric_limits<double>::quiet_NaN()};
+    ReadingSample sample;
+    uint32_t sampleSequence{0}; // of the sample last taken
 };
 
 /**
@@ -467,214 +1006,869 @@ class Request
     virtual void prepareRequest(uint8_t &netFn, uint8_t &lun, uint8_t &cmd,
                                 std::vector<uint8_t> &dataToSend) = 0;
 
-    // virtual function for handling responses from Ipmb
+    // virtual function for handling responses from Ipmb, decodes them into
+    // reading samples on the poll side
     virtual void handleResponse(const uint8_t completionCode,
                                 const std::vector<uint8_t> &dataReceived) = 0;
 
+    // updates Dbus properties from the readings once samples were taken, on
+    // the serving side
+    virtual void updateProperties()
+    {
+    }
+
     virtual void createAssociation(sdbusplus::asio::object_server &server,
                                    const std::string &path){};
 
-    virtual ~Request(){};
-
-  protected:
-    Request(){};
+    // true when readings are meaningful only while host is running
+    virtual bool isHostDependent() const
+    {
+        return false;
+    }
 
-    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
-    std::shared_ptr<sdbusplus::asio::dbus_interface> association;
-};
+    // request is sent every Nth readings cycle
+    virtual uint32_t getPollDivider() const
+    {
+        return 1;
+    }
 
-/**
- * @brief PowerMetric class declaration
- */
-class PowerMetric : public Request
-{
-  public:
-    PowerMetric(sdbusplus::asio::object_server &server)
+    // false for readings measured by the proxy itself, not sent to the ME
+    virtual bool isPolled() const
     {
-        iface = server.add_interface("/xyz/openbmc_project/Power/PowerMetric",
-                                     nmdPowerMetricIntf);
+        return true;
+    }
 
-        iface->register_property("IntervalInMin", static_cast<uint64_t>(0));
-        iface->register_property("MinConsumedWatts", static_cast<uint16_t>(0));
-        iface->register_property("MaxConsumedWatts", static_cast<uint16_t>(0));
-        iface->register_property("AverageConsumedWatts",
-                                 static_cast<uint16_t>(0));
-        iface->initialize();
+    // true when readiness does not wait for the readings, e.g. because not
+    // every ME supports them
+    virtual bool isOptional() const
+    {
+        return false;
     }
 
-    void handleResponse(const uint8_t completionCode,
-                        const std::vector<uint8_t> &dataReceived)
+    // true when the request is read faster while its reading changes fast
+    virtual bool isAdaptive() const
     {
-        if (completionCode != 0)
-            return;
+        return false;
+    }
 
-        if (dataReceived.size() != sizeof(nmIpmiGetNmStatisticsResp))
-        {
-            phosphor::logging::log<phosphor::logging::level::WARNING>(
-                "handleResponse: response size does not match expected value");
-            return;
-        }
+    // absolute change of the reading per second between the last two
+    // samples, NaN when not known
+    virtual double getChangeRate() const
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
 
-        auto getNmStatistics =
-            reinterpret_cast<const nmIpmiGetNmStatisticsResp *>(
-                dataReceived.data());
+    // ME clock [seconds] stamping the last successful response, 0 when the
+    // response carries none
+    virtual uint32_t getMeTimestamp() const
+    {
+        return 0;
+    }
 
-        iface->set_property(
-            "IntervalInMin",
-            static_cast<uint64_t>(getNmStatistics->statsReportPeriod));
-        iface->set_property(
-            "MinConsumedWatts",
-            static_cast<uint16_t>(getNmStatistics->data.stats.min));
-        iface->set_property(
-            "MaxConsumedWatts",
-            static_cast<uint16_t>(getNmStatistics->data.stats.max));
-        iface->set_property(
-            "AverageConsumedWatts",
-            static_cast<uint16_t>(getNmStatistics->data.stats.avg));
+    // adds latest readings as statistics of the Dbus object
+    virtual void collectStatistics(AllStatisticsMap &stats) const
+    {
     }
 
-    void prepareRequest(uint8_t &netFn, uint8_t &lun, uint8_t &cmd,
-                        std::vector<uint8_t> &dataToSend)
+    // publishes sliding window aggregates of the reading on its Dbus object,
+    // for requests providing a single reading
+    virtual void
+        createWindowStatistics(sdbusplus::asio::object_server &server,
+                               const std::vector<uint32_t> &windows)
     {
-        dataToSend.resize(sizeof(nmIpmiGetNmStatisticsReq));
+    }
 
-        auto nmGetStatistics =
-            reinterpret_cast<nmIpmiGetNmStatisticsReq *>(dataToSend.data());
+    // publishes quantile sketch of the reading on its Dbus object, for
+    // requests providing a single reading
+    virtual void createQuantiles(sdbusplus::asio::object_server &server,
+                                 uint32_t epochSeconds)
+    {
+    }
 
-        netFn = ipmiGetNmStatisticsNetFn;
-        lun = ipmiGetNmStatisticsLun;
-        cmd = ipmiGetNmStatisticsCmd;
+    virtual ~Request(){};
 
-        ipmiSetIntelIanaNumber(nmGetStatistics->iana);
-        nmGetStatistics->mode = 1;
-        nmGetStatistics->reserved3B = 0;
-        nmGetStatistics->domainId = 0;
-        nmGetStatistics->statsSide = 0;
-        nmGetStatistics->reserved = 0;
-        nmGetStatistics->perComponent = 0;
-        nmGetStatistics->policyId = 0;
+    std::vector<Reading> &getReadings()
+    {
+        return readings;
     }
-};
 
-class getNmStatistics : public Request
-{
-  public:
-    getNmStatistics(sdbusplus::asio::object_server &server, double minValue,
-                    double maxValue, std::string type, std::string name,
-                    uint8_t mode, uint8_t domainId, uint8_t policyId) :
-        mode(mode),
-        domainId(domainId), policyId(policyId), type(type), name(name)
+    const std::vector<Reading> &getReadings() const
     {
-        iface =
-            server.add_interface(propObj + type + '/' + name, nmdSensorIntf);
-
-        iface->register_property("MaxValue", static_cast<double>(maxValue));
-        iface->register_property("MinValue", static_cast<double>(minValue));
-        iface->register_property("Value", static_cast<double>(0));
-        iface->register_property(
-            "Unit", std::string("xyz.openbmc_project.Sensor.Value.Unit.Watts"));
-
-        iface->initialize();
+        return readings;
     }
 
-    void createAssociation(sdbusplus::asio::object_server &server,
-                           const std::string &path)
+    // true once every reading of the request was successfully read
+    bool wasRead() const
     {
-        if (!association)
+        for (const auto &reading : readings)
         {
-            std::vector<Association> associations;
-            associations.push_back(Association("chassis", "all_sensors", path));
-            association = server.add_interface("/xyz/openbmc_project/sensors/" +
-                                                   type + "/" + name,
-                                               associationInterface);
-
-            association->register_property("Associations", associations);
-            association->initialize();
+            if (reading.timestampUs == 0)
+            {
+                return false;
+            }
         }
+        return true;
     }
 
-    void handleResponse(const uint8_t completionCode,
-                        const std::vector<uint8_t> &dataReceived)
+    // re-publishes window aggregates, so that they expire when no samples
+    // come, on the serving side
+    void refreshWindowStatistics()
     {
-        if (completionCode != 0)
-            return;
-
-        if (dataReceived.size() != sizeof(nmIpmiGetNmStatisticsResp))
+        if (windowStatistics)
         {
-            phosphor::logging::log<phosphor::logging::level::WARNING>(
-                "handleResponse: response size does not match expected value");
-            return;
+            windowStatistics->publish(nowUs());
         }
-
-        auto getNmStatistics =
-            reinterpret_cast<const nmIpmiGetNmStatisticsResp *>(
-                dataReceived.data());
-
-        iface->set_property(
-            "Value", static_cast<double>(getNmStatistics->data.stats.cur));
     }
 
-    void prepareRequest(uint8_t &netFn, uint8_t &lun, uint8_t &cmd,
+    // marks all readings as not valid, on the serving side
+    void invalidateReadings()
+    {
+        for (auto &reading : readings)
+        {
+            reading.valid = false;
+        }
+    }
+
+    // marks all samples as not valid, e.g. when the request failed, on the
+    // poll side
+    void invalidateSamples()
+    {
+        for (auto &reading : readings)
+        {
+            reading.sample.invalidate();
+        }
+    }
+
+    /**
+     * @brief Takes samples stored by the poll side into the readings and
+     * updates Dbus properties, on the serving side. Returns true when any
+     * reading changed.
+     */
+    bool takeSamples()
+    {
+        bool changed = false;
+        for (size_t index = 0; index < readings.size(); index++)
+        {
+            Reading &reading = readings[index];
+            double value;
+            uint64_t timestampUs;
+            bool valid;
+            uint32_t sequence = reading.sample.load(value, timestampUs, valid);
+            if (sequence == reading.sampleSequence)
+            {
+                continue;
+            }
+            reading.sampleSequence = sequence;
+            changed = true;
+            if (valid)
+            {
+                setReading(index, value, timestampUs);
+            }
+            else
+            {
+                reading.valid = false;
+            }
+        }
+        if (changed)
+        {
+            updateProperties();
+        }
+        return changed;
+    }
+
+  protected:
+    Request(){};
+
+    static uint64_t nowUs()
+    {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                ProxyClock::now().time_since_epoch())
+                .count());
+    }
+
+    // stores a new sample on the poll side, returns its timestamp
+    uint64_t sampleReading(size_t index, double value)
+    {
+        uint64_t timestampUs = nowUs();
+        readings[index].sample.store(value, timestampUs, true);
+        return timestampUs;
+    }
+
+    // updates reading computed on the serving side
+    void updateReading(size_t index, double value)
+    {
+        setReading(index, value, nowUs());
+    }
+
+    void setReading(size_t index, double value, uint64_t timestampUs)
+    {
+        readings[index].value = value;
+        readings[index].timestampUs = timestampUs;
+        readings[index].valid = true;
+        if (windowStatistics)
+        {
+            windowStatistics->add(timestampUs, value);
+        }
+        if (quantiles)
+        {
+            quantiles->add(timestampUs, value);
+        }
+    }
+
+    // NaN when the reading is not valid
+    double getCachedValue(size_t index) const
+    {
+        return readings[index].valid ? readings[index].value
+                                     : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> association;
+    std::vector<Reading> readings;
+    std::unique_ptr<WindowStatistics> windowStatistics;
+    std::unique_ptr<SensorQuantiles> quantiles;
+};
+
+/**
+ * @brief PowerMetric class declaration
+ */
+class PowerMetric : public Request
+{
+  public:
+    PowerMetric(sdbusplus::asio::object_server &server,
+                const std::string &pathArg, const std::string &namePrefix) :
+        path(pathArg)
+    {
+        iface = server.add_interface(path, nmdPowerMetricIntf);
+
+        iface->register_property("IntervalInMin", static_cast<uint64_t>(0));
+        iface->register_property("MinConsumedWatts", static_cast<uint16_t>(0));
+        iface->register_property("MaxConsumedWatts", static_cast<uint16_t>(0));
+        iface->register_property("AverageConsumedWatts",
+                                 static_cast<uint16_t>(0));
+        iface->initialize();
+
+        readings.emplace_back(namePrefix + "PowerMetric_IntervalInMin");
+        readings.emplace_back(namePrefix + "PowerMetric_MinConsumedWatts");
+        readings.emplace_back(namePrefix + "PowerMetric_MaxConsumedWatts");
+        readings.emplace_back(namePrefix + "PowerMetric_AverageConsumedWatts");
+    }
+
+    void handleResponse(const uint8_t completionCode,
+                        const std::vector<uint8_t> &dataReceived)
+    {
+        if (completionCode != 0)
+        {
+            invalidateSamples();
+            return;
+        }
+
+        nmIpmiGetNmStatisticsResp getNmStatistics = {0};
+        if (!ipmiDeserialize<nmIpmiGetNmStatisticsReq>(dataReceived,
+                                                       getNmStatistics))
+        {
+            NM_LOG_RATE_LIMITED(
+                WARNING,
+                "handleResponse: response size does not match expected value",
+                phosphor::logging::entry("SENSOR=%s", readings[0].name.c_str()),
+                phosphor::logging::entry("SIZE=%zu", dataReceived.size()));
+            invalidateSamples();
+            return;
+        }
+
+        sampleReading(0, getNmStatistics.statsReportPeriod);
+        sampleReading(1, getNmStatistics.data.stats.min);
+        sampleReading(2, getNmStatistics.data.stats.max);
+        sampleReading(3, getNmStatistics.data.stats.avg);
+    }
+
+    void updateProperties()
+    {
+        if (!readings[0].valid)
+        {
+            return;
+        }
+        iface->set_property("IntervalInMin",
+                            static_cast<uint64_t>(readings[0].value));
+        iface->set_property("MinConsumedWatts",
+                            static_cast<uint16_t>(readings[1].value));
+        iface->set_property("MaxConsumedWatts",
+                            static_cast<uint16_t>(readings[2].value));
+        iface->set_property("AverageConsumedWatts",
+                            static_cast<uint16_t>(readings[3].value));
+    }
+
+    void prepareRequest(uint8_t &netFn, uint8_t &lun, uint8_t &cmd,
                         std::vector<uint8_t> &dataToSend)
     {
-        dataToSend.resize(sizeof(nmIpmiGetNmStatisticsReq));
+        using Command = IpmiCommand<nmIpmiGetNmStatisticsReq>;
+        netFn = Command::netFn;
+        lun = Command::lun;
+        cmd = Command::cmd;
+
+        nmIpmiGetNmStatisticsReq nmGetStatistics = {0};
+        ipmiSetIntelIanaNumber(nmGetStatistics.iana);
+        nmGetStatistics.mode = 1;
+        nmGetStatistics.reserved3B = 0;
+        nmGetStatistics.domainId = 0;
+        nmGetStatistics.statsSide = 0;
+        nmGetStatistics.reserved = 0;
+        nmGetStatistics.perComponent = 0;
+        nmGetStatistics.policyId = 0;
+        ipmiSerialize(nmGetStatistics, dataToSend);
+    }
+
+    void collectStatistics(AllStatisticsMap &stats) const
+    {
+        stats[path]["Power"] = StatValuesMap{
+            {"StatisticsReportingPeriod", getCachedValue(0)},
+            {"Min", getCachedValue(1)},
+            {"Max", getCachedValue(2)},
+            {"Average", getCachedValue(3)}};
+    }
+
+  private:
+    std::string path;
+};
+
+class getNmStatistics : public Request
+{
+  public:
+    /**
+     * @param unit - Sensor.Value unit, empty for counters which are published
+     * at nmdCounterObj on nmdCounterIntf instead, as there is no unit for them
+     * @param scaleArg - multiplier converting ME value into the unit
+     */
+    getNmStatistics(sdbusplus::asio::object_server &server, double minValue,
+                    double maxValue, std::string type, std::string name,
+                    uint8_t mode, uint8_t domainId, uint8_t policyId,
+                    const std::string &unit = sensorUnitWatts,
+                    double scaleArg = 1.0) :
+        mode(mode),
+        domainId(domainId), policyId(policyId), scale(scaleArg),
+        adaptive(unit == sensorUnitWatts), counter(unit.empty()),
+        path(counter ? nmdCounterObj + name : propObj + type + '/' + name)
+    {
+        iface = server.add_interface(path,
+                                     counter ? nmdCounterIntf : nmdSensorIntf);
+
+        iface->register_property("MaxValue", static_cast<double>(maxValue));
+        iface->register_property("MinValue", static_cast<double>(minValue));
+        // NaN until first successful reading, so it is not taken for 0 W
+        iface->register_property("Value",
+                                 std::numeric_limits<double>::quiet_NaN());
+        if (!unit.empty())
+        {
+            iface->register_property("Unit", unit);
+        }
+
+        iface->initialize();
+
+        Reading &reading = readings.emplace_back(name);
+        reading.minValue = minValue;
+        reading.maxValue = maxValue;
+    }
+
+    void createAssociation(sdbusplus::asio::object_server &server,
+                           const std::string &parentPath)
+    {
+        // counters are not sensors of the chassis
+        if (counter || (association && parentPath == associationPath))
+        {
+            return;
+        }
+
+        std::vector<Association> associations;
+        associations.push_back(
+            Association("chassis", "all_sensors", parentPath));
+        if (!association)
+        {
+            association = server.add_interface(path, associationInterface);
+
+            association->register_property("Associations", associations);
+            association->initialize();
+        }
+        else
+        {
+            association->set_property("Associations", associations);
+        }
+        associationPath = parentPath;
+    }
+
+    void handleResponse(const uint8_t completionCode,
+                        const std::vector<uint8_t> &dataReceived)
+    {
+        changeRate = std::numeric_limits<double>::quiet_NaN();
+        meTimestamp = 0;
+        if (completionCode != 0)
+        {
+            invalidateSamples();
+            lastSampleUs = 0;
+            return;
+        }
+
+        nmIpmiGetNmStatisticsResp getNmStatistics = {0};
+        if (!ipmiDeserialize<nmIpmiGetNmStatisticsReq>(dataReceived,
+                                                       getNmStatistics))
+        {
+            NM_LOG_RATE_LIMITED(
+                WARNING,
+                "handleResponse: response size does not match expected value",
+                phosphor::logging::entry("SENSOR=%s", readings[0].name.c_str()),
+                phosphor::logging::entry("SIZE=%zu", dataReceived.size()));
+            invalidateSamples();
+            lastSampleUs = 0;
+            return;
+        }
+
+        // ME clock starts over on reset, compared by the channel
+        meTimestamp = getNmStatistics.timeStamp;
+
+        double value = getNmStatistics.data.stats.cur * scale;
+        uint64_t timestampUs = sampleReading(0, value);
+        if (lastSampleUs != 0 && timestampUs > lastSampleUs)
+        {
+            changeRate = std::abs(value - lastSampleValue) * 1e6 /
+                         static_cast<double>(timestampUs - lastSampleUs);
+        }
+        lastSampleValue = value;
+        lastSampleUs = timestampUs;
+    }
+
+    void updateProperties()
+    {
+        if (readings[0].valid)
+        {
+            iface->set_property("Value", readings[0].value);
+        }
+    }
+
+    // power sensors follow fast changes
+    bool isAdaptive() const
+    {
+        return adaptive;
+    }
+
+    double getChangeRate() const
+    {
+        return changeRate;
+    }
+
+    uint32_t getMeTimestamp() const
+    {
+        return meTimestamp;
+    }
+
+    bool isHostDependent() const
+    {
+        return domainId == cpuSubsystem || domainId == memorySubsystem;
+    }
+
+    void collectStatistics(AllStatisticsMap &stats) const
+    {
+        stats[path][getStatisticsGroup()] =
+            StatValuesMap{{"Current", getCachedValue(0)}};
+    }
+
+    void createWindowStatistics(sdbusplus::asio::object_server &server,
+                                const std::vector<uint32_t> &windows)
+    {
+        windowStatistics =
+            std::make_unique<WindowStatistics>(server, path, windows);
+    }
 
-        auto nmGetStatistics =
-            reinterpret_cast<nmIpmiGetNmStatisticsReq *>(dataToSend.data());
+    void createQuantiles(sdbusplus::asio::object_server &server,
+                         uint32_t epochSeconds)
+    {
+        quantiles =
+            std::make_unique<SensorQuantiles>(server, path, epochSeconds);
+    }
+
+    void prepareRequest(uint8_t &netFn, uint8_t &lun, uint8_t &cmd,
+                        std::vector<uint8_t> &dataToSend)
+    {
+        using Command = IpmiCommand<nmIpmiGetNmStatisticsReq>;
+        netFn = Command::netFn;
+        lun = Command::lun;
+        cmd = Command::cmd;
+
+        nmIpmiGetNmStatisticsReq nmGetStatistics = {0};
+        ipmiSetIntelIanaNumber(nmGetStatistics.iana);
+        nmGetStatistics.mode = mode;
+        nmGetStatistics.reserved3B = 0;
+        nmGetStatistics.domainId = domainId;
+        nmGetStatistics.statsSide = 0;
+        nmGetStatistics.reserved = 0;
+        nmGetStatistics.perComponent = 0;
+        nmGetStatistics.policyId = policyId;
+        ipmiSerialize(nmGetStatistics, dataToSend);
+    }
+
+  protected:
+    virtual const char *getStatisticsGroup() const
+    {
+        return "Power";
+    }
+
+  private:
+    uint8_t mode;
+    uint8_t domainId;
+    uint8_t policyId;
+    double scale;
+    bool adaptive;
+    // poll side state of the last sample
+    double changeRate{std::numeric_limits<double>::quiet_NaN()};
+    double lastSampleValue{0};
+    uint64_t lastSampleUs{0};
+    uint32_t meTimestamp{0};
+    bool counter;
+    std::string path;
+    std::string associationPath;
+};
+
+/**
+ * @brief Global power statistics [Watts]
+ */
+class GlobalPowerPlatform : public getNmStatistics
+{
+  public:
+    using getNmStatistics::getNmStatistics;
+};
+
+class GlobalPowerCpu : public getNmStatistics
+{
+  public:
+    using getNmStatistics::getNmStatistics;
+};
+
+class GlobalPowerMemory : public getNmStatistics
+{
+  public:
+    using getNmStatistics::getNmStatistics;
+};
+
+class GlobalPowerHwProtection : public getNmStatistics
+{
+  public:
+    using getNmStatistics::getNmStatistics;
+};
+
+/**
+ * @brief Global CPU throttling statistics [%]
+ */
+class GlobalThrottling : public getNmStatistics
+{
+  public:
+    using getNmStatistics::getNmStatistics;
+
+    bool isHostDependent() const
+    {
+        return true;
+    }
+
+  protected:
+    const char *getStatisticsGroup() const
+    {
+        return "Throttling";
+    }
+};
+
+/**
+ * @brief ME to host interface statistics (unhandled requests, response time,
+ * communication failures), read at a low rate
+ */
+class HostInterfaceStatistics : public getNmStatistics
+{
+  public:
+    using getNmStatistics::getNmStatistics;
+
+    bool isHostDependent() const
+    {
+        return true;
+    }
+
+    uint32_t getPollDivider() const
+    {
+        return hostInterfacePollDivider;
+    }
+
+    bool isOptional() const
+    {
+        return true;
+    }
+
+  protected:
+    const char *getStatisticsGroup() const
+    {
+        return "HostInterface";
+    }
+};
+
+/**
+ * @brief Round trip of poll frames through the IPMB transport [seconds],
+ * until the response or the failure of the frame. Compared with the host
+ * interface statistics it tells BMC side slowness apart from the ME side one.
+ */
+class IpmbLatency : public Request
+{
+  public:
+    IpmbLatency(sdbusplus::asio::object_server &server,
+                const std::string &name) :
+        path(propObj + std::string("time/") + name)
+    {
+        iface = server.add_interface(path, nmdSensorIntf);
+
+        double maxValue = static_cast<double>(kIpmbTimeout.count()) / 1000000;
+        iface->register_property("MaxValue", maxValue);
+        iface->register_property("MinValue", 0.0);
+        iface->register_property("Value",
+                                 std::numeric_limits<double>::quiet_NaN());
+        iface->register_property("Unit", std::string(sensorUnitSeconds));
+
+        iface->initialize();
+
+        Reading &reading = readings.emplace_back(name);
+        reading.minValue = 0;
+        reading.maxValue = maxValue;
+    }
+
+    bool isPolled() const
+    {
+        return false;
+    }
+
+    void prepareRequest(uint8_t &netFn, uint8_t &lun, uint8_t &cmd,
+                        std::vector<uint8_t> &dataToSend)
+    {
+    }
+
+    void handleResponse(const uint8_t completionCode,
+                        const std::vector<uint8_t> &dataReceived)
+    {
+    }
+
+    // on the poll side, as round trips complete
+    void sample(double seconds)
+    {
+        sampleReading(0, seconds);
+    }
+
+    void updateProperties()
+    {
+        if (readings[0].valid)
+        {
+            iface->set_property("Value", readings[0].value);
+        }
+    }
+
+    void collectStatistics(AllStatisticsMap &stats) const
+    {
+        stats[path]["Ipmb"] = StatValuesMap{{"Current", getCachedValue(0)}};
+    }
+
+    void createWindowStatistics(sdbusplus::asio::object_server &server,
+                                const std::vector<uint32_t> &windows)
+    {
+        windowStatistics =
+            std::make_unique<WindowStatistics>(server, path, windows);
+    }
+
+    void createQuantiles(sdbusplus::asio::object_server &server,
+                         uint32_t epochSeconds)
+    {
+        quantiles =
+            std::make_unique<SensorQuantiles>(server, path, epochSeconds);
+    }
+
+  private:
+    std::string path;
+};
+
+/**
+ * @brief Sensor computed from readings of other sensors, e.g. platform power
+ * not drawn by CPU and memory. Evaluated on the serving side whenever a
+ * sample of any input changed, NaN while an input is not valid.
+ */
+class DerivedSensor : public Request
+{
+  public:
+    /**
+     * @param inputsArg - readings of the expression inputs, in order of
+     * expressionArg.getInputs(), owned by sensors outliving this one
+     */
+    DerivedSensor(sdbusplus::asio::object_server &server,
+                  const std::string &type, const std::string &name,
+                  DerivedExpression expressionArg,
+                  std::vector<const Reading *> inputsArg) :
+        path(propObj + type + '/' + name),
+        expression(std::move(expressionArg)), inputs(std::move(inputsArg)),
+        seen(inputs.size()), values(inputs.size())
+    {
+        iface = server.add_interface(path, nmdSensorIntf);
+
+        // range follows from the ranges of the inputs
+        std::vector<double> inputMins, inputMaxs;
+        for (const Reading *input : inputs)
+        {
+            inputMins.push_back(input->minValue);
+            inputMaxs.push_back(input->maxValue);
+        }
+        double minValue, maxValue;
+        expression.bounds(inputMins, inputMaxs, minValue, maxValue);
+        iface->register_property("MaxValue", maxValue);
+        iface->register_property("MinValue", minValue);
+        iface->register_property("Value",
+                                 std::numeric_limits<double>::quiet_NaN());
+        const char *unit = sensorUnitOf(type);
+        if (unit != nullptr)
+        {
+            iface->register_property("Unit", std::string(unit));
+        }
+
+        iface->initialize();
+
+        Reading &reading = readings.emplace_back(name);
+        reading.minValue = minValue;
+        reading.maxValue = maxValue;
+    }
+
+    bool isPolled() const
+    {
+        return false;
+    }
+
+    // inputs decide about readiness
+    bool isOptional() const
+    {
+        return true;
+    }
+
+    void prepareRequest(uint8_t &netFn, uint8_t &lun, uint8_t &cmd,
+                        std::vector<uint8_t> &dataToSend)
+    {
+    }
+
+    void handleResponse(const uint8_t completionCode,
+                        const std::vector<uint8_t> &dataReceived)
+    {
+    }
+
+    void createAssociation(sdbusplus::asio::object_server &server,
+                           const std::string &parentPath)
+    {
+        std::vector<Association> associations;
+        associations.push_back(
+            Association("chassis", "all_sensors", parentPath));
+        if (!association)
+        {
+            association = server.add_interface(path, associationInterface);
+            association->register_property("Associations", associations);
+            association->initialize();
+        }
+        else
+        {
+            association->set_property("Associations", associations);
+        }
+    }
+
+    /**
+     * @brief Re-evaluates the expression when any input changed since the
+     * last call, returns true when the reading was updated
+     */
+    bool refresh()
+    {
+        bool changed = false;
+        for (size_t index = 0; index < inputs.size(); index++)
+        {
+            const Reading &input = *inputs[index];
+            if (input.timestampUs != seen[index].timestampUs ||
+                input.valid != seen[index].valid)
+            {
+                seen[index] = {input.timestampUs, input.valid};
+                changed = true;
+            }
+            values[index] = input.valid
+                                ? input.value
+                                : std::numeric_limits<double>::quiet_NaN();
+        }
+        if (!changed)
+        {
+            return false;
+        }
 
-        netFn = ipmiGetNmStatisticsNetFn;
-        lun = ipmiGetNmStatisticsLun;
-        cmd = ipmiGetNmStatisticsCmd;
+        double value = expression.evaluate(values);
+        iface->set_property("Value", value);
+        if (std::isnan(value))
+        {
+            invalidateReadings();
+        }
+        else
+        {
+            updateReading(0, value);
+        }
+        return true;
+    }
 
-        ipmiSetIntelIanaNumber(nmGetStatistics->iana);
-        nmGetStatistics->mode = mode;
-        nmGetStatistics->reserved3B = 0;
-        nmGetStatistics->domainId = domainId;
-        nmGetStatistics->statsSide = 0;
-        nmGetStatistics->reserved = 0;
-        nmGetStatistics->perComponent = 0;
-        nmGetStatistics->policyId = policyId;
+    void collectStatistics(AllStatisticsMap &stats) const
+    {
+        stats[path]["Derived"] = StatValuesMap{{"Current", getCachedValue(0)}};
     }
 
-  private:
-    uint8_t mode;
-    uint8_t domainId;
-    uint8_t policyId;
-    std::string type;
-    std::string name;
-};
+    void createWindowStatistics(sdbusplus::asio::object_server &server,
+                                const std::vector<uint32_t> &windows)
+    {
+        windowStatistics =
+            std::make_unique<WindowStatistics>(server, path, windows);
+    }
 
-/**
- * @brief Global power statistics [Watts]
- */
-class GlobalPowerPlatform : public getNmStatistics
-{
-  public:
-    using getNmStatistics::getNmStatistics;
-};
+    void createQuantiles(sdbusplus::asio::object_server &server,
+                         uint32_t epochSeconds)
+    {
+        quantiles =
+            std::make_unique<SensorQuantiles>(server, path, epochSeconds);
+    }
 
-class GlobalPowerCpu : public getNmStatistics
-{
-  public:
-    using getNmStatistics::getNmStatistics;
-};
+    /**
+     * @brief Sensor.Value unit of a sensor type, nullptr when it has none
+     */
+    static const char *sensorUnitOf(const std::string &type)
+    {
+        if (type == "power")
+        {
+            return sensorUnitWatts;
+        }
+        if (type == "utilization")
+        {
+            return sensorUnitPercent;
+        }
+        if (type == "time")
+        {
+            return sensorUnitSeconds;
+        }
+        return nullptr;
+    }
 
-class GlobalPowerMemory : public getNmStatistics
-{
-  public:
-    using getNmStatistics::getNmStatistics;
-};
+  private:
+    struct Seen
+    {
+        uint64_t timestampUs{0};
+        bool valid{false};
+    };
 
-class GlobalPowerHwProtection : public getNmStatistics
-{
-  public:
-    using getNmStatistics::getNmStatistics;
+    std::string path;
+    DerivedExpression expression;
+    std::vector<const Reading *> inputs;
+    std::vector<Seen> seen;
+    std::vector<double> values;
 };
 
 struct HealthData
 {
-    HealthData(std::shared_ptr<sdbusplus::asio::dbus_interface> interface) :
-        interface(interface)
+    HealthData(std::shared_ptr<sdbusplus::asio::dbus_interface> interface,
+               const std::string &statusPath) :
+        interface(interface),
+        statusPath(statusPath)
     {
     }
 
@@ -709,17 +1903,17 @@ struct HealthData
         if (fatal.size())
         {
             association.emplace_back("", "critical", globalInventoryPath);
-            association.emplace_back("", "critical", meStatusPath);
+            association.emplace_back("", "critical", statusPath);
         }
         else if (critical.size())
         {
             association.emplace_back("", "warning", globalInventoryPath);
-            association.emplace_back("", "critical", meStatusPath);
+            association.emplace_back("", "critical", statusPath);
         }
         else if (warning.size())
         {
             association.emplace_back("", "warning", globalInventoryPath);
-            association.emplace_back("", "warning", meStatusPath);
+            association.emplace_back("", "warning", statusPath);
         }
         interface->set_property("Associations", association);
     }
@@ -733,6 +1927,7 @@ struct HealthData
     }
 
     std::shared_ptr<sdbusplus::asio::dbus_interface> interface;
+    std::string statusPath;
     boost::container::flat_set<std::string> fatal;
     boost::container::flat_set<std::string> critical;
     boost::container::flat_set<std::string> warning;
@@ -881,15 +2076,120 @@ struct PolicyParams
 };
 
 /**
- * @brief Statistics type provided on DBus as return type for GetStatistics
+ * @brief Serializes policy parameters and enabled state for the policy
+ * journal
  */
-using StatValuesMap = std::map<std::string, std::variant<double, uint32_t>>;
+std::vector<uint8_t> serializePolicyState(const PolicyParams &params,
+                                          bool enabled)
+{
+    JournalWriter writer;
+    writer.put8(enabled);
+    writer.put32(params.correctionInMs);
+    writer.put16(params.limit);
+    writer.put16(params.statReportingPeriod);
+    writer.put32(static_cast<uint32_t>(params.policyStorage));
+    writer.put32(static_cast<uint32_t>(params.powerCorrectionType));
+    writer.put32(static_cast<uint32_t>(params.limitException));
+    writer.put16(static_cast<uint16_t>(params.suspendPeriods.size()));
+    for (const auto &period : params.suspendPeriods)
+    {
+        writer.put16(static_cast<uint16_t>(period.size()));
+        for (const auto &[name, value] : period)
+        {
+            writer.putString(name);
+            if (const auto *text = std::get_if<std::string>(&value))
+            {
+                writer.put8(0);
+                writer.putString(*text);
+                continue;
+            }
+            const auto &list = std::get<std::vector<std::string>>(value);
+            writer.put8(1);
+            writer.put16(static_cast<uint16_t>(list.size()));
+            for (const auto &item : list)
+            {
+                writer.putString(item);
+            }
+        }
+    }
+    writer.put16(static_cast<uint16_t>(params.thresholds.size()));
+    for (const auto &[name, values] : params.thresholds)
+    {
+        writer.putString(name);
+        writer.put16(static_cast<uint16_t>(values.size()));
+        for (uint16_t value : values)
+        {
+            writer.put16(value);
+        }
+    }
+    writer.put8(params.componentId);
+    writer.put16(params.triggerLimit);
+    writer.putString(params.triggerType);
+    return writer.getData();
+}
+
+/**
+ * @brief Counterpart of serializePolicyState, false when data is malformed
+ */
+bool deserializePolicyState(const std::vector<uint8_t> &data,
+                            PolicyParams &params, bool &enabled)
+{
+    JournalReader reader(data.data(), data.size());
+    enabled = reader.get8() != 0;
+    params.correctionInMs = reader.get32();
+    params.limit = reader.get16();
+    params.statReportingPeriod = reader.get16();
+    params.policyStorage = static_cast<int>(reader.get32());
+    params.powerCorrectionType = static_cast<int>(reader.get32());
+    params.limitException = static_cast<int>(reader.get32());
+    params.suspendPeriods.resize(reader.get16());
+    for (auto &period : params.suspendPeriods)
+    {
+        for (size_t entries = reader.get16();
+             entries > 0 && reader.isValid(); entries--)
+        {
+            std::string name = reader.getString();
+            if (reader.get8() == 0)
+            {
+                period[name] = reader.getString();
+                continue;
+            }
+            std::vector<std::string> list(reader.get16());
+            for (auto &item : list)
+            {
+                item = reader.getString();
+            }
+            period[name] = std::move(list);
+        }
+    }
+    for (size_t entries = reader.get16(); entries > 0 && reader.isValid();
+         entries--)
+    {
+        std::string name = reader.getString();
+        std::vector<uint16_t> values(reader.get16());
+        for (auto &value : values)
+        {
+            value = reader.get16();
+        }
+        params.thresholds[name] = std::move(values);
+    }
+    params.componentId = reader.get8();
+    params.triggerLimit = reader.get16();
+    params.triggerType = reader.getString();
+    return reader.isValid();
+}
 
 /**
  * @brief Node Manager Statistics DBus interface
  * The following methods shall be supported:
  * * GetStatistics
  * * * return StatValuesMap - statistics collection
+ * Policies additionally provide their cached power statistics as properties:
+ * * double Current
+ * * double Min
+ * * double Max
+ * * double Average
+ * * double StatisticsReportingPeriod
  */
 constexpr const char *nmStatisitcsIf =
     "xyz.openbmc_project.NodeManager.Statistics";
@@ -898,6 +2198,9 @@ constexpr const char *nmStatisitcsIf =
  * @brief Node Manager Policy Attributes DBus interface
  * The following properties shall be supported:
  * * uint16_t Limit
+ * * string LastApplyStatus - result of the last change sent to the ME, one
+ *   of Pending, Applied, Rejected (non-success completion code) or Failed
+ *   (no answer)
  */
 constexpr const char *nmPolicyAttributesIf =
     "xyz.openbmc_project.NodeManager.PolicyAttributes";
@@ -905,67 +2208,104 @@ constexpr const char *nmPolicyAttributesIf =
 /**
  * @brief Generic function used to send and receive IPMI message
  *
- * @tparam Req - IPMI request type
- * @tparam Resp - IPMI response type
- * @param conn  - DBus connection
- * @param netFnReq - IPMI Net Function
- * @param lunReq - IPMI LUN
- * @param cmdReq - IPMI command
+ * @tparam Req - IPMI request type, its IpmiCommand descriptor selects the
+ * command and response type
+ * @param transport - IPMB transport
+ * @param io - serving io_context the calling coroutine runs on
+ * @param yield - calling coroutine, suspended until the ME answers
+ * @param channel - IPMB channel of the ME
  * @param req - IPMI request
  * @param resp - IPMI response
+ * @param traceId - id recorded with request trace events
  */
-template <typename Req, typename Resp>
-void ipmiSendReceive(std::shared_ptr<sdbusplus::asio::connection> conn,
-                     uint8_t netFnReq, uint8_t lunReq, uint8_t cmdReq,
-                     const Req &req, Resp &resp)
-{
-    IpmbDbusRspType ipmbResponse;
-    std::vector<uint8_t> dataToSend(reinterpret_cast<const uint8_t *>(&req),
-                                    reinterpret_cast<const uint8_t *>(&req) +
-                                        sizeof(req));
-
-    int sendStatus = ipmbSendRequest(*conn, ipmbResponse, dataToSend, netFnReq,
-                                     lunReq, cmdReq);
-    if (sendStatus != 0)
-    {
-        phosphor::logging::log<phosphor::logging::level::ERR>(
-            "dbus error while sending IPMB request ",
-            phosphor::logging::entry("%d", sendStatus));
+template <typename Req>
+void ipmiSendReceive(IpmbTransport &transport, boost::asio::io_context &io,
+                     boost::asio::yield_context yield, uint8_t channel,
+                     const Req &req,
+                     typename IpmiCommand<Req>::Response &resp,
+                     uint32_t traceId = traceClientRequest)
+{
+    constexpr uint8_t netFnReq = IpmiCommand<Req>::netFn;
+    constexpr uint8_t lunReq = IpmiCommand<Req>::lun;
+    constexpr uint8_t cmdReq = IpmiCommand<Req>::cmd;
+
+    std::vector<uint8_t> dataToSend;
+    ipmiSerialize(req, dataToSend);
+
+    NM_TRACE(sent, traceId, netFnReq, cmdReq, 0, 0);
+    boost::system::error_code ec;
+    IpmbDbusRspType ipmbResponse =
+        ipmbYieldRequest(transport, io, yield, channel, dataToSend, netFnReq,
+                         lunReq, cmdReq, ec);
+    if (ec)
+    {
+        NM_TRACE(failed, traceId, netFnReq, cmdReq, ec.value(), 0);
+        NM_LOG_RATE_LIMITED(ERR, "dbus error while sending IPMB request",
+                            phosphor::logging::entry("NETFN=0x%02x", netFnReq),
+                            phosphor::logging::entry("CMD=0x%02x", cmdReq),
+                            phosphor::logging::entry("ERROR=%s",
+                                                     ec.message().c_str()));
         throw InternalFailure();
     }
 
     const auto &[status, netfnResp, lunResp, cmdResp, cc, dataReceived] =
         ipmbResponse;
+    NM_TRACE(answered, traceId, netFnReq, cmdReq, status, cc);
     if (status)
     {
-        phosphor::logging::log<phosphor::logging::level::ERR>(
-            "transport error while sending IPMB request ",
-            phosphor::logging::entry("%d", status));
+        NM_LOG_RATE_LIMITED(ERR, "transport error while sending IPMB request",
+                            phosphor::logging::entry("NETFN=0x%02x", netFnReq),
+                            phosphor::logging::entry("CMD=0x%02x", cmdReq),
+                            phosphor::logging::entry("STATUS=%d", status));
         throw InternalFailure();
     }
 
     if (cc != 0x00)
     {
-        phosphor::logging::log<phosphor::logging::level::ERR>(
-            "error while sending IPMB request, wrong cc: ",
-            phosphor::logging::entry("%d", cc));
+        NM_LOG_RATE_LIMITED(ERR, "error while sending IPMB request, wrong cc",
+                            phosphor::logging::entry("NETFN=0x%02x", netFnReq),
+                            phosphor::logging::entry("CMD=0x%02x", cmdReq),
+                            phosphor::logging::entry("CC=0x%02x", cc));
         throw NonSuccessCompletionCode();
     }
 
-    if (dataReceived.size() != sizeof(resp))
+    if (!ipmiDeserialize<Req>(dataReceived, resp))
     {
-        phosphor::logging::log<phosphor::logging::level::WARNING>(
-            "wrong response size");
+        NM_LOG_RATE_LIMITED(WARNING, "wrong response size",
+                            phosphor::logging::entry("NETFN=0x%02x", netFnReq),
+                            phosphor::logging::entry("CMD=0x%02x", cmdReq),
+                            phosphor::logging::entry("SIZE=%zu",
+                                                     dataReceived.size()));
         throw WrongResponseSize();
     }
-
-    std::copy(dataReceived.begin(), dataReceived.end(),
-              reinterpret_cast<uint8_t *>(&resp));
 }
 
+/**
+ * @brief Ranges of policy parameters accepted by the ME in the domain, NaN
+ * until read
+ */
+struct DomainCapabilities
+{
+    double minLimit{std::numeric_limits<double>::quiet_NaN()};
+    double maxLimit{std::numeric_limits<double>::quiet_NaN()};
+    double minCorrectionMs{std::numeric_limits<double>::quiet_NaN()};
+    double maxCorrectionMs{std::numeric_limits<double>::quiet_NaN()};
+};
+
 using DeleteCallback = std::function<void(const std::string policyId)>;
+class Policy;
+// called on the serving side once the state requested for the policy
+// changed, before the change is acknowledged to the client, and again when
+// the ME rejected it
+using JournalCallback = std::function<void(const Policy &, bool deleted)>;
+// called on the serving side once the ME answered a change of the policy
+using ApplyCallback =
+    std::function<void(boost::system::error_code ec, uint8_t cc)>;
 /**
- * @brief Node Manager Policy
+ * @brief Node Manager Policy. Properties publish the state requested by the
+ * clients, which is journaled right away, applied to the ME in the
+ * background and reverted to the last applied one when the ME rejects it.
+ * Values out of the domain capabilities are rejected right away.
  */
 class Policy
 {
@@ -977,24 +2317,40 @@ class Policy
     Policy &operator=(Policy &&) = delete;
 
     Policy(std::shared_ptr<sdbusplus::asio::connection> connArg,
+           std::shared_ptr<IpmbTransport> transportArg,
            sdbusplus::asio::object_server &server, std::string &domainDbusPath,
-           uint8_t domainIdArg, std::string idArg, DeleteCallback deleteArg) :
+           uint8_t channelArg, uint8_t domainIdArg, std::string idArg,
+           const DomainCapabilities &capabilitiesArg,
+           DeleteCallback deleteArg, JournalCallback journalArg) :
         conn(connArg),
-        dbusPath(domainDbusPath + "/Policy/" + idArg), domainId(domainIdArg),
-        id(idArg), deleteCallback(deleteArg), sdserver(server)
+        transport(transportArg),
+        dbusPath(domainDbusPath + "/Policy/" + idArg), channel(channelArg),
+        domainId(domainIdArg), id(idArg), capabilities(capabilitiesArg),
+        deleteCallback(deleteArg), journalCallback(std::move(journalArg)),
+        sdserver(server)
     {
         createAttributesInterface(server);
         createStatisticsInterface(server);
         createEnabledInterface(server);
         createDeleteInterface(server);
+        createAnalyticsInterface(server);
     }
 
     ~Policy()
     {
+        for (auto &waiter : nextWaiters)
+        {
+            boost::asio::post(conn->get_io_context(),
+                              [waiter{std::move(waiter)}]() {
+                                  waiter(boost::asio::error::operation_aborted,
+                                         0);
+                              });
+        }
         sdserver.remove_interface(attributesIf);
         sdserver.remove_interface(statisticsIf);
         sdserver.remove_interface(enabledIf);
         sdserver.remove_interface(deleteIf);
+        sdserver.remove_interface(analyticsIf);
     }
 
     static constexpr uint8_t dmtfPowerPolicyId = 254;
@@ -1007,7 +2363,7 @@ class Policy
         {3, "TimeAfterHostReset"},
         {6, "GPIO"}};
 
-    uint8_t triggerIdFromName(const std::string &nameToBeFound)
+    uint8_t triggerIdFromName(const std::string &nameToBeFound) const
     {
         for (const auto &[id, name] : triggerIdToName)
         {
@@ -1020,34 +2376,121 @@ class Policy
         return 255;
     }
 
-    std::string setOrUpdatePolicy(PolicyParams &params)
+    /**
+     * @brief Creates or updates the policy on the ME from a Dbus method
+     * coroutine, returns once the ME applied it
+     */
+    std::string setOrUpdatePolicy(PolicyParams &newParams,
+                                  boost::asio::yield_context yield)
     {
-        nmIpmiSetNmPolicyReq req = {0};
+        checkLimit(newParams.limit);
+        checkCorrectionTime(newParams.correctionInMs);
+        checkLimitException(newParams.limitException);
+        if (params.limit != newParams.limit)
+        {
+            resetAnalytics(newParams.limit);
+        }
+        params = newParams;
+        // Policy disabled during creation
+        if (enabled)
+        {
+            enabled = false;
+            clearStatistics();
+            enabledIf->signal_property("Enabled");
+        }
+        attributesIf->signal_property("Limit");
+        attributesIf->signal_property("LimitException");
+        attributesIf->signal_property("CorrectionInMs");
+        journal();
+        applyAndWait(yield);
+
+        return dbusPath;
+    }
+
+    /**
+     * @brief Restores policy from the journal, without asking the ME
+     */
+    void restore(const PolicyParams &restoredParams, bool restoredEnabled)
+    {
+        params = restoredParams;
+        enabled = restoredEnabled;
+        appliedParams = params;
+        appliedEnabled = enabled;
+        applied = true;
+        attributesIf->set_property("LastApplyStatus",
+                                   std::string(applyStatusApplied));
+        if (enabled)
+        {
+            resetAnalytics(params.limit);
+        }
+    }
+
+    /**
+     * @brief Sends the requested state of the policy to the ME, e.g. after
+     * the ME lost it on reset. One Set request is in flight at a time and
+     * changes made meanwhile are coalesced into the next one. Called on the
+     * serving side, callback is posted there once the ME answered a request
+     * carrying the state as of the call.
+     */
+    void apply(ApplyCallback callback = nullptr)
+    {
+        if (deleted)
+        {
+            if (callback)
+            {
+                boost::asio::post(conn->get_io_context(),
+                                  [callback{std::move(callback)}]() {
+                                      callback(
+                                          boost::asio::error::operation_aborted,
+                                          0);
+                                  });
+            }
+            return;
+        }
+        if (callback)
+        {
+            nextWaiters.emplace_back(std::move(callback));
+        }
+        if (applying)
+        {
+            applyPending = true;
+            return;
+        }
+        sendApply();
+    }
 
+    bool isApplied() const
+    {
+        return applied;
+    }
+
+    const PolicyParams &getParams() const
+    {
+        return params;
+    }
+
+    nmIpmiGetNmPolicyReq makeGetPolicyRequest() const
+    {
+        nmIpmiGetNmPolicyReq req = {0};
         ipmiSetIntelIanaNumber(req.iana);
         req.domainId = domainId;
-        req.policyEnabled = 0x0; // Policy disabled during creation
         req.policyId = getIdAsInt();
-        req.triggerType = triggerIdFromName(params.triggerType);
-        req.configurationAction = 0x1; // Create or modify policy
-        req.cpuPowerCorrection = params.powerCorrectionType;
-        req.storageOption = params.policyStorage;
-        uint8_t sendAlert, shutdownSystem;
-        parseLimitException(params.limitException, sendAlert, shutdownSystem);
-        req.sendAlert = sendAlert;
-        req.shutdownSystem = shutdownSystem;
-        req.limit = params.limit;
-        req.correctionTime = params.correctionInMs;
-        req.triggerLimit = params.triggerLimit;
-        req.statsPeriod = params.statReportingPeriod;
-
-        setPolicyIpmi(req);
+        return req;
+    }
 
-        limit = params.limit;
-        failureAction = params.limitException;
-        correctionTime = params.correctionInMs;
+    /**
+     * @brief Checks policy read from the ME against the state known to the
+     * proxy
+     */
+    bool matchesState(const nmIpmiGetNmPolicyResp &resp) const
+    {
+        return resp.policyEnabled == enabled && resp.limit == params.limit &&
+               resp.correctionTime == params.correctionInMs;
+    }
 
-        return dbusPath;
+    uint16_t getLimit() const
+    {
+        return params.limit;
     }
 
     std::string getId() const
@@ -1055,6 +2498,78 @@ class Policy
         return id;
     }
 
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+
+    /**
+     * @brief Accounts platform power and throttling sample into limit
+     * effectiveness, while the policy is enabled
+     */
+    void sampleAnalytics(uint64_t timestampUs, double power,
+                         double throttling)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        analytics.sample(timestampUs, power, throttling);
+        analyticsIf->set_property("TimeOverLimit",
+                                  analytics.getTimeOverLimit());
+        analyticsIf->set_property("MaxOvershoot", analytics.getMaxOvershoot());
+        analyticsIf->set_property("AverageOvershoot",
+                                  analytics.getAverageOvershoot());
+        analyticsIf->set_property("SettleTime", analytics.getSettleTime());
+        analyticsIf->set_property("AverageThrottling",
+                                  analytics.getAverageThrottling());
+        analyticsIf->set_property("ObservedTime", analytics.getObservedTime());
+    }
+
+    // adds statistics cached by the background refresh, if any
+    void collectStatistics(AllStatisticsMap &stats) const
+    {
+        if (statsCached)
+        {
+            stats[dbusPath]["Power"] = cachedStats;
+        }
+    }
+
+    nmIpmiGetNmStatisticsReq makeStatisticsRequest() const
+    {
+        nmIpmiGetNmStatisticsReq req = {0};
+
+        ipmiSetIntelIanaNumber(req.iana);
+        req.mode = policyPowerStats;
+        req.domainId = domainId;
+        req.statsSide = 0;
+        req.perComponent = 0; // Accumulated data from whole domain
+        req.policyId = getIdAsInt();
+        return req;
+    }
+
+    /**
+     * @brief Caches statistics read by the background refresh. Failed or
+     * malformed response drops the cache, GetStatistics asks the ME then.
+     */
+    void updateStatistics(bool answered, uint8_t cc,
+                          const std::vector<uint8_t> &dataReceived)
+    {
+        nmIpmiGetNmStatisticsResp resp = {0};
+        if (!answered || cc != 0 || !enabled ||
+            !ipmiDeserialize<nmIpmiGetNmStatisticsReq>(dataReceived, resp))
+        {
+            clearStatistics();
+            return;
+        }
+        cacheStatistics(resp);
+    }
+
+    uint32_t getTraceId() const
+    {
+        return tracePolicyFlag | channel << 8 | getIdAsInt();
+    }
+
     uint8_t getIdAsInt() const
     {
         if (id == "DmtfPower")
@@ -1065,58 +2580,269 @@ class Policy
         {
             return dmtfPowerOemPolicyId;
         }
-        try
+        try
+        {
+            return std::stoi(id);
+        }
+        catch (...)
+        {
+            throw PoliciesCannotBeCreated();
+        }
+    }
+
+  private:
+    std::shared_ptr<sdbusplus::asio::connection> conn;
+    std::shared_ptr<IpmbTransport> transport;
+    std::string dbusPath;
+    uint8_t channel;
+    uint8_t domainId;
+    std::string id;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> attributesIf;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> statisticsIf;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> enabledIf;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> deleteIf;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> analyticsIf;
+    const DomainCapabilities &capabilities;
+    PolicyAnalytics analytics;
+    // state requested by the clients, published on Dbus
+    PolicyParams params{};
+    bool enabled{false};
+    // state last applied by the ME
+    PolicyParams appliedParams{};
+    bool appliedEnabled{false};
+    bool applied{false};
+    bool applying{false};
+    bool applyPending{false};
+    bool deleting{false};
+    bool deleted{false};
+    std::vector<ApplyCallback> nextWaiters;
+    // expires with the policy, checked by completions running after it
+    std::shared_ptr<int> lifetime{std::make_shared<int>(0)};
+    bool statsCached{false};
+    StatValuesMap cachedStats;
+    DeleteCallback deleteCallback;
+    JournalCallback journalCallback;
+    sdbusplus::asio::object_server &sdserver;
+
+    void journal(bool removed = false)
+    {
+        if (journalCallback)
+        {
+            journalCallback(*this, removed);
+        }
+    }
+
+    static constexpr const char *applyStatusPending = "Pending";
+    static constexpr const char *applyStatusApplied = "Applied";
+    static constexpr const char *applyStatusRejected = "Rejected";
+    static constexpr const char *applyStatusFailed = "Failed";
+
+    void sendApply()
+    {
+        applying = true;
+        applyPending = false;
+        attributesIf->set_property("LastApplyStatus",
+                                   std::string(applyStatusPending));
+        std::vector<ApplyCallback> waiters;
+        waiters.swap(nextWaiters);
+
+        using Command = IpmiCommand<nmIpmiSetNmPolicyReq>;
+        nmIpmiSetNmPolicyReq req = makeSetPolicyRequest(params, enabled);
+        if (deleting)
+        {
+            req.configurationAction = 0x0; // Delete policy
+        }
+        std::vector<uint8_t> dataToSend;
+        ipmiSerialize(req, dataToSend);
+        NM_TRACE(sent, getTraceId(), Command::netFn, Command::cmd, 0, 0);
+        transport->asyncSendRequest(
+            channel, dataToSend, Command::netFn, Command::lun, Command::cmd,
+            [this, &io = conn->get_io_context(),
+             alive{std::weak_ptr<int>(lifetime)}, sentParams{params},
+             sentEnabled{enabled}, sentDelete{deleting},
+             waiters{std::move(waiters)}](boost::system::error_code ec,
+                                          IpmbDbusRspType &response) mutable {
+                auto &[status, netFn, lun, cmd, cc, dataReceived] = response;
+                if (!ec && status != 0)
+                {
+                    ec = boost::system::errc::make_error_code(
+                        boost::system::errc::io_error);
+                }
+                boost::asio::post(
+                    io,
+                    [this, alive, sentParams, sentEnabled, sentDelete, ec,
+                     cc{cc}, waiters{std::move(waiters)}]() {
+                        if (!alive.expired())
+                        {
+                            HandlerScope scope("Policy.Applied");
+                            appliedRequest(sentParams, sentEnabled,
+                                           sentDelete, ec, cc);
+                        }
+                        for (const auto &waiter : waiters)
+                        {
+                            waiter(alive.expired()
+                                       ? boost::asio::error::operation_aborted
+                                       : ec,
+                                   cc);
+                        }
+                    });
+            });
+    }
+
+    void appliedRequest(const PolicyParams &sentParams, bool sentEnabled,
+                        bool sentDelete, boost::system::error_code ec,
+                        uint8_t cc)
+    {
+        applying = false;
+        bool success = !ec && cc == 0;
+        attributesIf->set_property(
+            "LastApplyStatus",
+            std::string(success ? applyStatusApplied
+                                : ec ? applyStatusFailed
+                                     : applyStatusRejected));
+        if (success)
+        {
+            NM_TRACE(published, getTraceId(), ipmiSetNmPolicyNetFn,
+                     ipmiSetNmPolicyCmd, 0, 0);
+        }
+        else
+        {
+            NM_TRACE(failed, getTraceId(), ipmiSetNmPolicyNetFn,
+                     ipmiSetNmPolicyCmd, ec.value(), cc);
+            NM_LOG_RATE_LIMITED(ERR, "Policy not applied by the ME",
+                                phosphor::logging::entry("POLICY=%s",
+                                                         id.c_str()),
+                                phosphor::logging::entry("CC=0x%02x", cc),
+                                phosphor::logging::entry("CHANNEL=%d",
+                                                         channel));
+        }
+
+        if (sentDelete)
+        {
+            deleted = success;
+            deleting = success;
+        }
+        else if (success)
+        {
+            appliedParams = sentParams;
+            appliedEnabled = sentEnabled;
+            applied = true;
+        }
+
+        if (deleted)
+        {
+            for (auto &waiter : nextWaiters)
+            {
+                boost::asio::post(conn->get_io_context(),
+                                  [waiter{std::move(waiter)}]() {
+                                      waiter(
+                                          boost::asio::error::operation_aborted,
+                                          0);
+                                  });
+            }
+            nextWaiters.clear();
+            return;
+        }
+        if (sentDelete && !success)
+        {
+            // the policy stays, Delete removed it from the journal
+            journal();
+        }
+        if (applyPending)
+        {
+            sendApply();
+            return;
+        }
+        if (!success && applied && !sentDelete)
+        {
+            revert();
+            journal();
+        }
+    }
+
+    // publishes the state last applied by the ME again
+    void revert()
+    {
+        if (params.limit != appliedParams.limit)
+        {
+            resetAnalytics(appliedParams.limit);
+        }
+        params = appliedParams;
+        attributesIf->signal_property("Limit");
+        attributesIf->signal_property("LimitException");
+        attributesIf->signal_property("CorrectionInMs");
+        if (enabled != appliedEnabled)
+        {
+            enabled = appliedEnabled;
+            if (enabled)
+            {
+                resetAnalytics(params.limit);
+            }
+            else
+            {
+                clearStatistics();
+            }
+            enabledIf->signal_property("Enabled");
+        }
+    }
+
+    /**
+     * @brief Applies the requested state from a Dbus method coroutine,
+     * throws when the ME did not apply it
+     */
+    void applyAndWait(boost::asio::yield_context yield)
+    {
+        std::weak_ptr<int> alive = lifetime;
+        boost::system::error_code ec;
+        auto token = yield[ec];
+        uint8_t cc = boost::asio::async_initiate<
+            decltype(token), void(boost::system::error_code, uint8_t)>(
+            [this](auto handler) {
+                apply([handler](boost::system::error_code ec,
+                                uint8_t cc) mutable { handler(ec, cc); });
+            },
+            token);
+        if (alive.expired() || ec)
         {
-            return std::stoi(id);
+            throw InternalFailure();
         }
-        catch (...)
+        if (cc != 0)
         {
-            throw PoliciesCannotBeCreated();
+            throw NonSuccessCompletionCode();
         }
     }
 
-  private:
-    std::shared_ptr<sdbusplus::asio::connection> conn;
-    std::string dbusPath;
-    uint8_t domainId;
-    std::string id;
-    std::shared_ptr<sdbusplus::asio::dbus_interface> attributesIf;
-    std::shared_ptr<sdbusplus::asio::dbus_interface> statisticsIf;
-    std::shared_ptr<sdbusplus::asio::dbus_interface> enabledIf;
-    std::shared_ptr<sdbusplus::asio::dbus_interface> deleteIf;
-    uint16_t limit{0};
-    int failureAction{0};
-    uint32_t correctionTime{0};
-    bool enabled{false};
-    DeleteCallback deleteCallback;
-    sdbusplus::asio::object_server &sdserver;
-
     void createAttributesInterface(sdbusplus::asio::object_server &server)
     {
         attributesIf = server.add_interface(dbusPath, nmPolicyAttributesIf);
         attributesIf->register_property_rw(
             "Limit", uint16_t{0}, sdbusplus::vtable::property_::emits_change,
             [this](const auto &newPropertyValue, const auto &) {
+                HandlerScope scope("Policy.Limit.Set");
                 updatePolicyLimit(newPropertyValue);
                 return 1;
             },
-            [this](const auto &) { return limit; });
+            [this](const auto &) { return params.limit; });
         attributesIf->register_property_rw(
             "LimitException", int{0},
             sdbusplus::vtable::property_::emits_change,
             [this](const auto &newPropertyValue, const auto &) {
+                HandlerScope scope("Policy.LimitException.Set");
                 updatePolicyLimitException(newPropertyValue);
                 return 1;
             },
-            [this](const auto &) { return failureAction; });
+            [this](const auto &) { return params.limitException; });
         attributesIf->register_property_rw(
             "CorrectionInMs", uint32_t{0},
             sdbusplus::vtable::property_::emits_change,
             [this](const auto &newPropertyValue, const auto &) {
+                HandlerScope scope("Policy.CorrectionInMs.Set");
                 updatePolicyCorrectionTime(newPropertyValue);
                 return 1;
             },
-            [this](const auto &) { return correctionTime; });
+            [this](const auto &) { return params.correctionInMs; });
+        attributesIf->register_property("LastApplyStatus",
+                                        std::string(applyStatusPending));
 
         attributesIf->initialize();
     }
@@ -1128,6 +2854,7 @@ class Policy
         enabledIf->register_property_rw(
             "Enabled", bool{false}, sdbusplus::vtable::property_::emits_change,
             [this](const auto &newPropertyValue, const auto &) {
+                HandlerScope scope("Policy.Enabled.Set");
                 updatePolicyEnablament(newPropertyValue);
                 return 1;
             },
@@ -1139,166 +2866,229 @@ class Policy
     {
         deleteIf =
             server.add_interface(dbusPath, "xyz.openbmc_project.Object.Delete");
-        deleteIf->register_method("Delete", [this]() {
-            deletePolicy();
-            conn->get_io_context().post(
-                [id = getId(), deleteFun = deleteCallback]() {
-                    if (deleteFun)
-                    {
-                        deleteFun(id);
-                    }
-                });
-        });
+        deleteIf->register_method(
+            "Delete", [this](boost::asio::yield_context yield) {
+                ServingScope scope("Policy.Delete");
+                deleting = true;
+                journal(true);
+                applyAndWait(yield);
+                conn->get_io_context().post(
+                    [id = getId(), deleteFun = deleteCallback]() {
+                        if (deleteFun)
+                        {
+                            deleteFun(id);
+                        }
+                    });
+            });
         deleteIf->initialize();
     }
 
+    void createAnalyticsInterface(sdbusplus::asio::object_server &server)
+    {
+        analyticsIf = server.add_interface(dbusPath, nmPolicyAnalyticsIf);
+        for (const char *name : {"TimeOverLimit", "MaxOvershoot",
+                                 "AverageOvershoot", "AverageThrottling",
+                                 "ObservedTime"})
+        {
+            analyticsIf->register_property(name, 0.0);
+        }
+        analyticsIf->register_property(
+            "SettleTime", std::numeric_limits<double>::quiet_NaN());
+        analyticsIf->initialize();
+    }
+
+    void resetAnalytics(uint16_t newLimit)
+    {
+        uint64_t nowUs = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                ProxyClock::now().time_since_epoch())
+                .count());
+        analytics.reset(nowUs, newLimit);
+    }
+
     void createStatisticsInterface(sdbusplus::asio::object_server &server)
     {
         statisticsIf = server.add_interface(dbusPath, nmStatisitcsIf);
-        statisticsIf->register_method("GetStatistics", [this]() {
-            std::map<std::string, StatValuesMap> stats{
-                {"Power", getPowerStatistics()}};
-            return stats;
-        });
+        statisticsIf->register_method(
+            "GetStatistics", [this](boost::asio::yield_context yield) {
+                ServingScope scope("Policy.GetStatistics");
+                std::map<std::string, StatValuesMap> stats{
+                    {"Power", getPowerStatistics(yield)}};
+                return stats;
+            });
+        for (const char *name : {"Current", "Min", "Max", "Average",
+                                 "StatisticsReportingPeriod"})
+        {
+            statisticsIf->register_property(
+                name, std::numeric_limits<double>::quiet_NaN());
+        }
         statisticsIf->initialize();
     }
 
-    StatValuesMap getPowerStatistics()
+    /**
+     * @brief Returns statistics cached by the background refresh, the ME is
+     * asked only when there are none yet
+     */
+    StatValuesMap getPowerStatistics(boost::asio::yield_context yield)
     {
-        nmIpmiGetNmStatisticsReq req = {0};
-        nmIpmiGetNmStatisticsResp resp = {0};
+        if (statsCached)
+        {
+            return cachedStats;
+        }
 
-        ipmiSetIntelIanaNumber(req.iana);
-        req.mode = policyPowerStats;
-        req.domainId = domainId;
-        req.statsSide = 0;
-        req.perComponent = 0; // Accumulated data from whole domain
-        req.policyId = getIdAsInt();
+        std::weak_ptr<int> alive = lifetime;
+        nmIpmiGetNmStatisticsResp resp = {0};
+        ipmiSendReceive(*transport, conn->get_io_context(), yield, channel,
+                        makeStatisticsRequest(), resp,
+                        NM_TRACE_ID(getTraceId()));
+        if (alive.expired())
+        {
+            throw InternalFailure();
+        }
+        NM_TRACE(published, getTraceId(), ipmiGetNmStatisticsNetFn,
+                 ipmiGetNmStatisticsCmd, 0, 0);
 
-        ipmiSendReceive<nmIpmiGetNmStatisticsReq, nmIpmiGetNmStatisticsResp>(
-            conn, ipmiGetNmStatisticsNetFn, ipmiGetNmStatisticsLun,
-            ipmiGetNmStatisticsCmd, req, resp);
+        if (enabled)
+        {
+            cacheStatistics(resp);
+            return cachedStats;
+        }
+        return makeStatValues(resp);
+    }
 
-        StatValuesMap stats{
+    static StatValuesMap makeStatValues(const nmIpmiGetNmStatisticsResp &resp)
+    {
+        return StatValuesMap{
             {"Current", static_cast<double>(resp.data.stats.cur)},
             {"Max", static_cast<double>(resp.data.stats.max)},
             {"Min", static_cast<double>(resp.data.stats.min)},
             {"Average", static_cast<double>(resp.data.stats.avg)},
             {"StatisticsReportingPeriod",
              static_cast<double>(resp.statsReportPeriod)}};
+    }
 
-        return stats;
+    void cacheStatistics(const nmIpmiGetNmStatisticsResp &resp)
+    {
+        cachedStats = makeStatValues(resp);
+        statsCached = true;
+        for (const auto &[name, value] : cachedStats)
+        {
+            statisticsIf->set_property(name, std::get<double>(value));
+        }
     }
 
-    void setPolicyIpmi(const nmIpmiSetNmPolicyReq &req)
+    void clearStatistics()
     {
-        nmIpmiSetNmPolicyResp resp = {0};
-        ipmiSendReceive<nmIpmiSetNmPolicyReq, nmIpmiSetNmPolicyResp>(
-            conn, ipmiSetNmPolicyNetFn, ipmiSetNmPolicyLun, ipmiSetNmPolicyCmd,
-            req, resp);
+        if (!statsCached)
+        {
+            return;
+        }
+        statsCached = false;
+        for (const auto &[name, value] : cachedStats)
+        {
+            statisticsIf->set_property(
+                name, std::numeric_limits<double>::quiet_NaN());
+        }
     }
 
-    void getPolicyIpmi(const nmIpmiGetNmPolicyReq &req,
-                       nmIpmiGetNmPolicyResp &resp)
+    nmIpmiSetNmPolicyReq makeSetPolicyRequest(const PolicyParams &policyParams,
+                                              bool policyEnabled) const
     {
-        ipmiSendReceive<nmIpmiGetNmPolicyReq, nmIpmiGetNmPolicyResp>(
-            conn, ipmiGetNmPolicyNetFn, ipmiGetNmPolicyLun, ipmiGetNmPolicyCmd,
-            req, resp);
+        nmIpmiSetNmPolicyReq req = {0};
+
+        ipmiSetIntelIanaNumber(req.iana);
+        req.domainId = domainId;
+        req.policyEnabled = policyEnabled;
+        req.policyId = getIdAsInt();
+        req.triggerType = triggerIdFromName(policyParams.triggerType);
+        req.configurationAction = 0x1; // Create or modify policy
+        req.cpuPowerCorrection = policyParams.powerCorrectionType;
+        req.storageOption = policyParams.policyStorage;
+        uint8_t sendAlert, shutdownSystem;
+        parseLimitException(policyParams.limitException, sendAlert,
+                            shutdownSystem);
+        req.sendAlert = sendAlert;
+        req.shutdownSystem = shutdownSystem;
+        req.limit = policyParams.limit;
+        req.correctionTime = policyParams.correctionInMs;
+        req.triggerLimit = policyParams.triggerLimit;
+        req.statsPeriod = policyParams.statReportingPeriod;
+        return req;
     }
 
-    void updatePolicy(std::function<void(nmIpmiSetNmPolicyReq &)> callback)
+    static bool outOfRange(double value, double min, double max)
     {
-        nmIpmiGetNmPolicyReq getPolicyReq = {0};
-        nmIpmiGetNmPolicyResp getPolicyResp = {0};
-        nmIpmiSetNmPolicyReq setPolicyReq = {0};
+        // false for ranges not read yet, the ME checks them then
+        return value < min || value > max;
+    }
 
-        ipmiSetIntelIanaNumber(getPolicyReq.iana);
-        getPolicyReq.domainId = domainId;
-        getPolicyReq.policyId = getIdAsInt();
-        getPolicyIpmi(getPolicyReq, getPolicyResp);
+    void checkLimit(uint16_t checkedLimit) const
+    {
+        if (outOfRange(checkedLimit, capabilities.minLimit,
+                       capabilities.maxLimit))
+        {
+            throw NonSuccessCompletionCode();
+        }
+    }
 
-        ipmiSetIntelIanaNumber(setPolicyReq.iana);
-        setPolicyReq.domainId = getPolicyResp.domainId;
-        setPolicyReq.policyEnabled = getPolicyResp.policyEnabled;
-        setPolicyReq.policyId = getIdAsInt();
-        setPolicyReq.triggerType = getPolicyResp.triggerType;
-        setPolicyReq.configurationAction = 0x1; // Create or modify policy
-        setPolicyReq.cpuPowerCorrection = getPolicyResp.cpuPowerCorrection;
-        setPolicyReq.storageOption = getPolicyResp.storageOption;
-        setPolicyReq.sendAlert = getPolicyResp.sendAlert;
-        setPolicyReq.shutdownSystem = getPolicyResp.shutdownSystem;
-        setPolicyReq.limit = getPolicyResp.limit;
-        setPolicyReq.correctionTime = getPolicyResp.correctionTime;
-        setPolicyReq.triggerLimit = getPolicyResp.triggerLimit;
-        setPolicyReq.statsPeriod = getPolicyResp.statsPeriod;
+    void checkCorrectionTime(uint32_t checkedCorrectionTime) const
+    {
+        if (outOfRange(checkedCorrectionTime, capabilities.minCorrectionMs,
+                       capabilities.maxCorrectionMs))
+        {
+            throw NonSuccessCompletionCode();
+        }
+    }
 
-        callback(setPolicyReq);
-        setPolicyIpmi(setPolicyReq);
+    static void checkLimitException(int checkedLimitException)
+    {
+        if (checkedLimitException < 0 || checkedLimitException > 3)
+        {
+            throw NonSuccessCompletionCode();
+        }
     }
 
     void updatePolicyLimit(uint16_t newLimit)
     {
-        updatePolicy([newLimit](nmIpmiSetNmPolicyReq &setPolicyReq) {
-            setPolicyReq.limit = newLimit;
-        });
-        limit = newLimit;
+        checkLimit(newLimit);
+        if (params.limit != newLimit)
+        {
+            resetAnalytics(newLimit);
+        }
+        params.limit = newLimit;
+        journal();
+        apply();
     }
 
-    void updatePolicyLimitException(uint8_t newLimitException)
+    void updatePolicyLimitException(int newLimitException)
     {
-        updatePolicy([newLimitException,
-                      this](nmIpmiSetNmPolicyReq &setPolicyReq) {
-            uint8_t sendAlert, shutdownSystem;
-            parseLimitException(newLimitException, sendAlert, shutdownSystem);
-            setPolicyReq.sendAlert = sendAlert;
-            setPolicyReq.shutdownSystem = shutdownSystem;
-        });
-        failureAction = newLimitException;
+        checkLimitException(newLimitException);
+        params.limitException = newLimitException;
+        journal();
+        apply();
     }
 
     void updatePolicyCorrectionTime(uint32_t newCorrectionTime)
     {
-        updatePolicy([newCorrectionTime](nmIpmiSetNmPolicyReq &setPolicyReq) {
-            setPolicyReq.correctionTime = newCorrectionTime;
-        });
-        correctionTime = newCorrectionTime;
+        checkCorrectionTime(newCorrectionTime);
+        params.correctionInMs = newCorrectionTime;
+        journal();
+        apply();
     }
 
     void updatePolicyEnablament(bool newEnabledState)
     {
-        updatePolicy([newEnabledState](nmIpmiSetNmPolicyReq &setPolicyReq) {
-            setPolicyReq.policyEnabled = newEnabledState;
-        });
+        if (newEnabledState && !enabled)
+        {
+            resetAnalytics(params.limit);
+        }
         enabled = newEnabledState;
-    }
-
-    void deletePolicy()
-    {
-        nmIpmiGetNmPolicyReq getPolicyReq = {0};
-        nmIpmiGetNmPolicyResp getPolicyResp = {0};
-        nmIpmiSetNmPolicyReq setPolicyReq = {0};
-
-        ipmiSetIntelIanaNumber(getPolicyReq.iana);
-        getPolicyReq.domainId = domainId;
-        getPolicyReq.policyId = getIdAsInt();
-        getPolicyIpmi(getPolicyReq, getPolicyResp);
-
-        ipmiSetIntelIanaNumber(setPolicyReq.iana);
-        setPolicyReq.domainId = getPolicyResp.domainId;
-        setPolicyReq.policyEnabled = getPolicyResp.policyEnabled;
-        setPolicyReq.policyId = getIdAsInt();
-        setPolicyReq.triggerType = getPolicyResp.triggerType;
-        setPolicyReq.configurationAction = 0x0; // Delete policy
-        setPolicyReq.cpuPowerCorrection = getPolicyResp.cpuPowerCorrection;
-        setPolicyReq.storageOption = getPolicyResp.storageOption;
-        setPolicyReq.sendAlert = getPolicyResp.sendAlert;
-        setPolicyReq.shutdownSystem = getPolicyResp.shutdownSystem;
-        setPolicyReq.limit = getPolicyResp.limit;
-        setPolicyReq.correctionTime = getPolicyResp.correctionTime;
-        setPolicyReq.triggerLimit = getPolicyResp.triggerLimit;
-        setPolicyReq.statsPeriod = getPolicyResp.statsPeriod;
-
-        setPolicyIpmi(setPolicyReq);
+        if (!enabled)
+        {
+            clearStatistics();
+        }
+        journal();
+        apply();
     }
 
     /**
@@ -1309,8 +3099,8 @@ class Policy
      *  logEvent = 2,
      *  logEventAndPowerOff = 3
      */
-    void parseLimitException(const int &limitException, uint8_t &sendAlert,
-                             uint8_t &shutdown)
+    static void parseLimitException(const int &limitException,
+                                    uint8_t &sendAlert, uint8_t &shutdown)
     {
         if (limitException == 0)
         {
@@ -1421,11 +3211,14 @@ class Domain
     Domain &operator=(Domain &&) = delete;
 
     Domain(std::shared_ptr<sdbusplus::asio::connection> connArg,
-           sdbusplus::asio::object_server &server, uint8_t idArg) :
-        id(idArg),
-        dbusPath("/xyz/openbmc_project/NodeManager/Domain/" +
-                 domainIdToName[idArg]),
-        conn(connArg)
+           std::shared_ptr<IpmbTransport> transportArg,
+           sdbusplus::asio::object_server &server, uint8_t channelArg,
+           const std::string &rootPath, uint8_t idArg,
+           std::shared_ptr<PolicyJournal> journalArg = nullptr) :
+        channel(channelArg),
+        id(idArg), dbusPath(rootPath + "/Domain/" + domainIdToName[idArg]),
+        conn(connArg), transport(transportArg), journal(std::move(journalArg)),
+        capabilitiesTimer(connArg->get_io_context())
     {
         // SPS NM does not support DC Total so need to remap to AC Total (entire
         // platform)
@@ -1438,25 +3231,372 @@ class Domain
         createStatisticsInterface(server);
     }
 
+    /**
+     * @brief Adds statistics of the domain and of its policies
+     *
+     * @param platformStats - entire platform power statistics polled for the
+     * sensors, which are the ones of the domain as it is remapped
+     */
+    void collectStatistics(AllStatisticsMap &stats,
+                           const StatValuesMap &platformStats) const
+    {
+        stats[dbusPath]["Power"] = platformStats;
+        for (const auto &policy : policies)
+        {
+            policy->collectStatistics(stats);
+        }
+    }
+
+    /**
+     * @brief Passes platform power and throttling sample to the policies
+     */
+    void sampleAnalytics(uint64_t timestampUs, double power,
+                         double throttling)
+    {
+        for (auto &policy : policies)
+        {
+            policy->sampleAnalytics(timestampUs, power, throttling);
+        }
+    }
+
+    /**
+     * @brief Refreshes cached statistics of enabled policies, one request at
+     * a time starting with the policy at given position. Called by the
+     * channel scheduler on the serving side, only the cache is updated here
+     * while requests are issued by the poll loop.
+     * @param done - called once all policies were refreshed
+     */
+    void refreshPolicyStatistics(std::function<void()> done, size_t first = 0)
+    {
+        auto policy = std::find_if(
+            policies.begin() + std::min(first, policies.size()),
+            policies.end(), [](const auto &policy) {
+                return policy->isEnabled();
+            });
+        if (policy == policies.end())
+        {
+            done();
+            return;
+        }
+
+        using Command = IpmiCommand<nmIpmiGetNmStatisticsReq>;
+        std::vector<uint8_t> dataToSend;
+        ipmiSerialize((*policy)->makeStatisticsRequest(), dataToSend);
+        transport->asyncSendRequest(
+            channel, dataToSend, Command::netFn, Command::lun, Command::cmd,
+            [this, policyId{(*policy)->getId()},
+             done{std::move(done)}](boost::system::error_code ec,
+                                    IpmbDbusRspType &response) mutable {
+                auto &[status, netFn, lun, cmd, cc, dataReceived] = response;
+                boost::asio::post(
+                    conn->get_io_context(),
+                    [this, policyId, done{std::move(done)},
+                     answered{!ec && status == 0}, cc{cc},
+                     dataReceived{std::move(dataReceived)}]() {
+                        HandlerScope scope("Policy.RefreshStatistics");
+                        auto policy = std::find_if(
+                            policies.begin(), policies.end(),
+                            [&policyId](const auto &policy) {
+                                return policy->getId() == policyId;
+                            });
+                        if (policy == policies.end())
+                        {
+                            // deleted in the meantime, the rest is
+                            // refreshed next time
+                            done();
+                            return;
+                        }
+                        if (answered && cc == nmCcInvalidPolicyId)
+                        {
+                            phosphor::logging::log<
+                                phosphor::logging::level::WARNING>(
+                                "Policy missing on the ME",
+                                phosphor::logging::entry("POLICY=%s",
+                                                         policyId.c_str()),
+                                phosphor::logging::entry("CHANNEL=%d",
+                                                         channel));
+                            reprovisionPolicies();
+                        }
+                        (*policy)->updateStatistics(answered, cc,
+                                                    dataReceived);
+                        refreshPolicyStatistics(
+                            done, policy - policies.begin() + 1);
+                    });
+            });
+    }
+
+    /**
+     * @brief Re-creates all policies after the ME lost them on reset. Set
+     * requests of all policies are sent at once, without waiting for one
+     * another, then the policies and capabilities are read back to verify
+     * the ME enforces what the proxy publishes. Called on the serving side.
+     */
+    void reprovisionPolicies()
+    {
+        if (reprovisioning || policies.empty())
+        {
+            return;
+        }
+        reprovisioning = true;
+        reprovisionStart = std::chrono::steady_clock::now();
+        reprovisionPending = policies.size();
+
+        for (const auto &policy : policies)
+        {
+            policy->apply([this, policyId{policy->getId()}](
+                              boost::system::error_code ec, uint8_t cc) {
+                HandlerScope scope("Policy.Reprovision");
+                if (ec || cc != 0)
+                {
+                    phosphor::logging::log<phosphor::logging::level::ERR>(
+                        "Policy re-provisioning failed",
+                        phosphor::logging::entry("POLICY=%s",
+                                                 policyId.c_str()),
+                        phosphor::logging::entry("CC=0x%02x", cc),
+                        phosphor::logging::entry("CHANNEL=%d", channel));
+                }
+                if (--reprovisionPending == 0)
+                {
+                    revalidatePolicies();
+                }
+            });
+        }
+    }
+
+    /**
+     * @brief Reads capabilities of the domain in the background, they are
+     * published once the ME answers and the read is retried until it does
+     */
+    void refreshCapabilities()
+    {
+        sendRevalidation(makeCapabilitiesRequest(), "");
+    }
+
+    /**
+     * @brief Rebuilds policies of the domain from the journal, so they are
+     * on Dbus right after the proxy restart, then reconciles them with the
+     * ME. Called once, before the io runs.
+     */
+    void restorePolicies(sdbusplus::asio::object_server &server)
+    {
+        if (!journal)
+        {
+            return;
+        }
+        std::string prefix = getJournalPrefix();
+        for (const auto &[key, state] : journal->getEntries(prefix))
+        {
+            std::string policyId = key.substr(prefix.size());
+            PolicyParams params{};
+            bool enabled = false;
+            if (!deserializePolicyState(state, params, enabled))
+            {
+                phosphor::logging::log<phosphor::logging::level::WARNING>(
+                    "Journaled policy malformed, dropped",
+                    phosphor::logging::entry("POLICY=%s", policyId.c_str()));
+                journal->remove(key);
+                continue;
+            }
+            auto policy = makePolicy(server, policyId);
+            policy->restore(params, enabled);
+            policies.emplace_back(std::move(policy));
+        }
+        journal->commit();
+        if (policies.empty())
+        {
+            return;
+        }
+        phosphor::logging::log<phosphor::logging::level::INFO>(
+            "Policies restored from journal",
+            phosphor::logging::entry("COUNT=%zu", policies.size()),
+            phosphor::logging::entry("CHANNEL=%d", channel));
+        reconcilePolicies();
+    }
+
   private:
+    uint8_t channel;
     uint8_t id;
     std::string dbusPath;
     std::shared_ptr<sdbusplus::asio::dbus_interface> capabilitesIf;
     std::shared_ptr<sdbusplus::asio::dbus_interface> policyManagerIf;
     std::shared_ptr<sdbusplus::asio::dbus_interface> statisticsIf;
     std::shared_ptr<sdbusplus::asio::connection> conn;
+    std::shared_ptr<IpmbTransport> transport;
     std::vector<std::unique_ptr<Policy>> policies;
+    std::shared_ptr<PolicyJournal> journal;
+    size_t reconcilePending{0};
+    bool reconcileMismatch{false};
+    bool reprovisioning{false};
+    size_t reprovisionPending{0};
+    std::chrono::steady_clock::time_point reprovisionStart;
+    DomainCapabilities capabilities;
+    ProxyTimer capabilitiesTimer;
+
+    nmIpmiGetNmCapabilitesReq makeCapabilitiesRequest() const
+    {
+        nmIpmiGetNmCapabilitesReq req = {0};
+        ipmiSetIntelIanaNumber(req.iana);
+        req.domainId = id;
+        req.policyTriggerType = 0; // No Policy Trigger
+        req.policyType = 1;        // Power Control Policy
+        return req;
+    }
+
+    /**
+     * @brief Reads back capabilities of the domain and all policies after
+     * re-provisioning, reporting whatever differs from the proxy state
+     */
+    void revalidatePolicies()
+    {
+        reprovisionPending = policies.size() + 1;
+
+        sendRevalidation(makeCapabilitiesRequest(), "");
+
+        for (const auto &policy : policies)
+        {
+            sendRevalidation(policy->makeGetPolicyRequest(), policy->getId());
+        }
+    }
+
+    /**
+     * @brief Sends request verifying re-provisioned state, of the policy
+     * with given id or of the capabilities when it is empty. Capabilities
+     * are read this way on start as well, outside of re-provisioning.
+     */
+    template <typename Req>
+    void sendRevalidation(const Req &req, const std::string &policyId)
+    {
+        using Command = IpmiCommand<Req>;
+        std::vector<uint8_t> dataToSend;
+        ipmiSerialize(req, dataToSend);
+        transport->asyncSendRequest(
+            channel, dataToSend, Command::netFn, Command::lun, Command::cmd,
+            [this, policyId](boost::system::error_code ec,
+                             IpmbDbusRspType &response) {
+                auto &[status, netFn, lun, cmd, cc, dataReceived] = response;
+                boost::asio::post(
+                    conn->get_io_context(),
+                    [this, policyId, answered{!ec && status == 0}, cc{cc},
+                     dataReceived{std::move(dataReceived)}]() {
+                        HandlerScope scope("Policy.Revalidate");
+                        typename Command::Response resp = {0};
+                        bool valid = answered && cc == 0 &&
+                                     ipmiDeserialize<Req>(dataReceived, resp);
+                        if (valid)
+                        {
+                            verifyReprovisioned(resp, policyId);
+                        }
+                        else if (reprovisioning)
+                        {
+                            phosphor::logging::log<
+                                phosphor::logging::level::ERR>(
+                                "Policy re-provisioning not verified",
+                                phosphor::logging::entry("POLICY=%s",
+                                                         policyId.c_str()),
+                                phosphor::logging::entry("CC=0x%02x", cc),
+                                phosphor::logging::entry("CHANNEL=%d",
+                                                         channel));
+                        }
+                        if constexpr (std::is_same_v<
+                                          Req, nmIpmiGetNmCapabilitesReq>)
+                        {
+                            if (!valid && std::isnan(capabilities.minLimit))
+                            {
+                                retryCapabilities();
+                            }
+                        }
+                        if (reprovisioning && --reprovisionPending == 0)
+                        {
+                            finishReprovisioning();
+                        }
+                    });
+            });
+    }
+
+    void retryCapabilities()
+    {
+        capabilitiesTimer.expires_after(
+            std::chrono::seconds(readingsInterval));
+        capabilitiesTimer.async_wait(
+            [this](const boost::system::error_code &ec) {
+                if (!ec && std::isnan(capabilities.minLimit))
+                {
+                    refreshCapabilities();
+                }
+            });
+    }
+
+    void verifyReprovisioned(const nmIpmiGetNmCapabilitesResp &resp,
+                             const std::string &)
+    {
+        capabilities.minLimit = static_cast<double>(resp.minLimit);
+        capabilities.maxLimit = static_cast<double>(resp.maxLimit);
+        capabilities.minCorrectionMs =
+            static_cast<double>(resp.minCorrectionTime);
+        capabilities.maxCorrectionMs =
+            static_cast<double>(resp.maxCorrectionTime);
+        capabilitesIf->set_property("Min", capabilities.minLimit);
+        capabilitesIf->set_property("Max", capabilities.maxLimit);
+        if (!reprovisioning)
+        {
+            return;
+        }
+        for (const auto &policy : policies)
+        {
+            if (policy->getLimit() < resp.minLimit ||
+                policy->getLimit() > resp.maxLimit)
+            {
+                phosphor::logging::log<phosphor::logging::level::WARNING>(
+                    "Policy limit out of domain capabilities",
+                    phosphor::logging::entry("POLICY=%s",
+                                             policy->getId().c_str()),
+                    phosphor::logging::entry("LIMIT=%u", policy->getLimit()),
+                    phosphor::logging::entry(
+                        "MIN=%u", static_cast<unsigned>(resp.minLimit)),
+                    phosphor::logging::entry(
+                        "MAX=%u", static_cast<unsigned>(resp.maxLimit)));
+            }
+        }
+    }
+
+    void verifyReprovisioned(const nmIpmiGetNmPolicyResp &resp,
+                             const std::string &policyId)
+    {
+        auto policy = std::find_if(policies.begin(), policies.end(),
+                                   [&policyId](const auto &policy) {
+                                       return policy->getId() == policyId;
+                                   });
+        if (policy != policies.end() && !(*policy)->matchesState(resp))
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Policy on the ME differs after re-provisioning",
+                phosphor::logging::entry("POLICY=%s", policyId.c_str()),
+                phosphor::logging::entry("LIMIT=%d",
+                                         static_cast<int>(resp.limit)),
+                phosphor::logging::entry(
+                    "ENABLED=%d", static_cast<int>(resp.policyEnabled)));
+        }
+    }
+
+    void finishReprovisioning()
+    {
+        reprovisioning = false;
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - reprovisionStart);
+        phosphor::logging::log<phosphor::logging::level::INFO>(
+            "Policies re-provisioned",
+            phosphor::logging::entry("COUNT=%zu", policies.size()),
+            phosphor::logging::entry("DURATION_MS=%lld",
+                                     static_cast<long long>(duration.count())),
+            phosphor::logging::entry("CHANNEL=%d", channel));
+    }
 
     void createCapabilitesInterface(sdbusplus::asio::object_server &server)
     {
         capabilitesIf = server.add_interface(dbusPath, nmDomainCapabilitesIf);
-        capabilitesIf->register_property_r(
-            "Min", double{0}, sdbusplus::vtable::property_::const_,
-            [this](const auto &) { return getCapabilityMin(); });
-        capabilitesIf->register_property_r(
-            "Max", double{std::numeric_limits<double>::max()},
-            sdbusplus::vtable::property_::const_,
-            [this](const auto &) { return getCapabilityMax(); });
+        // NaN until read from the ME, updated on re-provisioning
+        capabilitesIf->register_property("Min", capabilities.minLimit);
+        capabilitesIf->register_property("Max", capabilities.maxLimit);
         capabilitesIf->initialize();
     }
 
@@ -1466,10 +3606,12 @@ class Domain
             server.add_interface(dbusPath, nmDomainPolicyManagerIf);
         policyManagerIf->register_method(
             "CreateWithId",
-            [this, &server](std::string policyId, PolicyParamsTuple t) {
+            [this, &server](boost::asio::yield_context yield,
+                            std::string policyId, PolicyParamsTuple t) {
+                ServingScope scope("Domain.CreateWithId");
                 auto params = makeFromTuple<PolicyParams>(t);
                 return sdbusplus::message::object_path{
-                    createOrUpdatePolicy(server, policyId, params)};
+                    createOrUpdatePolicy(server, policyId, params, yield)};
             });
         policyManagerIf->initialize();
     }
@@ -1477,41 +3619,63 @@ class Domain
     void createStatisticsInterface(sdbusplus::asio::object_server &server)
     {
         statisticsIf = server.add_interface(dbusPath, nmStatisitcsIf);
-        statisticsIf->register_method("GetStatistics", [this]() {
-            std::map<std::string, StatValuesMap> stats{
-                {"Power", getPowerStatistics()}};
-            return stats;
-        });
+        statisticsIf->register_method(
+            "GetStatistics", [this](boost::asio::yield_context yield) {
+                ServingScope scope("Domain.GetStatistics");
+                std::map<std::string, StatValuesMap> stats{
+                    {"Power", getPowerStatistics(yield)}};
+                return stats;
+            });
         statisticsIf->initialize();
     }
 
-    double getCapabilityMin()
-    {
-        double min, max;
-        getCapabilites(min, max);
-        return min;
-    }
-
-    double getCapabilityMax()
-    {
-        double min, max;
-        getCapabilites(min, max);
-        return max;
-    }
-
+    /**
+     * @brief Creates the policy, or updates it when it exists, from a Dbus
+     * method coroutine. New policy is on Dbus while the ME creates it and is
+     * removed again when the ME rejects it.
+     */
     std::string createOrUpdatePolicy(sdbusplus::asio::object_server &server,
                                      std::string policyId,
-                                     PolicyParams &policyParams)
+                                     PolicyParams &policyParams,
+                                     boost::asio::yield_context yield)
     {
         for (auto &policy : policies)
         {
             if (policy->getId() == policyId)
             {
-                return policy->setOrUpdatePolicy(policyParams);
+                return policy->setOrUpdatePolicy(policyParams, yield);
+            }
+        }
+        auto policyTmp = makePolicy(server, policyId);
+        // rejects ids which are not numbers before anything is sent
+        policyTmp->getIdAsInt();
+        Policy *policy = policyTmp.get();
+        policies.emplace_back(std::move(policyTmp));
+        try
+        {
+            return policy->setOrUpdatePolicy(policyParams, yield);
+        }
+        catch (const sdbusplus::exception_t &)
+        {
+            auto it = std::find_if(policies.begin(), policies.end(),
+                                   [policy](const auto &candidate) {
+                                       return candidate.get() == policy;
+                                   });
+            if (it != policies.end() && !(*it)->isApplied())
+            {
+                journalPolicy(**it, true);
+                policies.erase(it);
             }
+            throw;
         }
-        auto policyTmp = std::make_unique<Policy>(
-            conn, server, dbusPath, id, policyId,
+    }
+
+    std::unique_ptr<Policy> makePolicy(sdbusplus::asio::object_server &server,
+                                       const std::string &policyId)
+    {
+        return std::make_unique<Policy>(
+            conn, transport, server, dbusPath, channel, id, policyId,
+            capabilities,
             [this](const std::string policyId) {
                 for (auto it = policies.cbegin(); it != policies.cend(); it++)
                 {
@@ -1521,44 +3685,95 @@ class Domain
                         break;
                     }
                 }
+            },
+            [this](const Policy &policy, bool deleted) {
+                journalPolicy(policy, deleted);
             });
-        std::string policyPath = policyTmp->setOrUpdatePolicy(policyParams);
-        policies.emplace_back(std::move(policyTmp));
-        return policyPath;
     }
 
-    void getCapabilites(double &minLimit, double &maxLimit)
+    // policies of the domain are journaled under this prefix
+    std::string getJournalPrefix() const
     {
-        nmIpmiGetNmCapabilitesReq req = {0};
-        nmIpmiGetNmCapabilitesResp resp = {0};
-
-        ipmiSetIntelIanaNumber(req.iana);
-        req.domainId = id;
-        req.policyTriggerType = 0; // No Policy Trigger
-        req.policyType = 1;        // Power Control Policy
+        return std::to_string(channel) + '/' + std::to_string(id) + '/';
+    }
 
-        try
+    void journalPolicy(const Policy &policy, bool deleted)
+    {
+        if (!journal)
         {
-            ipmiSendReceive<nmIpmiGetNmCapabilitesReq,
-                            nmIpmiGetNmCapabilitesResp>(
-                conn, ipmiGetNmCapabilitesNetFn, ipmiGetNmCapabilitesLun,
-                ipmiGetNmCapabilitesCmd, req, resp);
-
-            minLimit = static_cast<double>(resp.minLimit);
-            maxLimit = static_cast<double>(resp.maxLimit);
+            return;
         }
-        catch (sdbusplus::exception_t &e)
+        std::string key = getJournalPrefix() + policy.getId();
+        if (deleted)
         {
-            phosphor::logging::log<phosphor::logging::level::ERR>(
-                "Failed to get domain capabilites: ",
-                phosphor::logging::entry("%s", e.what()));
+            journal->remove(key);
+        }
+        else
+        {
+            journal->put(key, serializePolicyState(policy.getParams(),
+                                                   policy.isEnabled()));
+        }
+        // on file before the change is acknowledged, synced once per loop
+        // turn
+        journal->commitSoon(conn->get_io_context());
+    }
 
-            minLimit = std::numeric_limits<double>::quiet_NaN();
-            maxLimit = std::numeric_limits<double>::quiet_NaN();
+    /**
+     * @brief Reads back the policies restored from the journal, all at once,
+     * and re-provisions them when any is missing or differs on the ME
+     */
+    void reconcilePolicies()
+    {
+        reconcilePending = policies.size();
+        reconcileMismatch = false;
+        using Command = IpmiCommand<nmIpmiGetNmPolicyReq>;
+        std::vector<uint8_t> dataToSend;
+        for (const auto &policy : policies)
+        {
+            ipmiSerialize(policy->makeGetPolicyRequest(), dataToSend);
+            transport->asyncSendRequest(
+                channel, dataToSend, Command::netFn, Command::lun,
+                Command::cmd,
+                [this, policyId{policy->getId()}](boost::system::error_code ec,
+                                                  IpmbDbusRspType &response) {
+                    auto &[status, netFn, lun, cmd, cc, dataReceived] =
+                        response;
+                    boost::asio::post(
+                        conn->get_io_context(),
+                        [this, policyId, answered{!ec && status == 0}, cc{cc},
+                         dataReceived{std::move(dataReceived)}]() {
+                            HandlerScope scope("Policy.Reconcile");
+                            nmIpmiGetNmPolicyResp resp = {0};
+                            auto policy = std::find_if(
+                                policies.begin(), policies.end(),
+                                [&policyId](const auto &policy) {
+                                    return policy->getId() == policyId;
+                                });
+                            if (policy != policies.end() &&
+                                (!answered || cc != 0 ||
+                                 !ipmiDeserialize<nmIpmiGetNmPolicyReq>(
+                                     dataReceived, resp) ||
+                                 !(*policy)->matchesState(resp)))
+                            {
+                                phosphor::logging::log<
+                                    phosphor::logging::level::INFO>(
+                                    "Journaled policy differs on the ME",
+                                    phosphor::logging::entry(
+                                        "POLICY=%s", policyId.c_str()),
+                                    phosphor::logging::entry("CC=0x%02x",
+                                                             cc));
+                                reconcileMismatch = true;
+                            }
+                            if (--reconcilePending == 0 && reconcileMismatch)
+                            {
+                                reprovisionPolicies();
+                            }
+                        });
+                });
         }
     }
 
-    StatValuesMap getPowerStatistics()
+    StatValuesMap getPowerStatistics(boost::asio::yield_context yield)
     {
         nmIpmiGetNmStatisticsReq req = {0};
         nmIpmiGetNmStatisticsResp resp = {0};
@@ -1570,9 +3785,8 @@ class Domain
         req.perComponent = 0; // Accumulated data from whole domain
         req.policyId = 0;
 
-        ipmiSendReceive<nmIpmiGetNmStatisticsReq, nmIpmiGetNmStatisticsResp>(
-            conn, ipmiGetNmStatisticsNetFn, ipmiGetNmStatisticsLun,
-            ipmiGetNmStatisticsCmd, req, resp);
+        ipmiSendReceive(*transport, conn->get_io_context(), yield, channel,
+                        req, resp);
 
         StatValuesMap stats{
             {"Current", static_cast<double>(resp.data.stats.cur)},
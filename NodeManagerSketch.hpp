@@ -0,0 +1,238 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Header-only quantile sketch of Node Manager Proxy sensor readings.
+ *
+ * The proxy feeds every sensor reading into a fixed-size log-linear
+ * histogram, returned serialized by the GetQuantiles method of the sensor.
+ * Sketches of many sensors or nodes are merged by adding their buckets, so a
+ * rack controller gets percentiles of the whole rack without raw samples:
+ *
+ *     NmQuantileSketch rack;
+ *     for (const auto &serialized : sketchesFromNodes)
+ *     {
+ *         rack.merge(serialized);
+ *     }
+ *     double p99 = rack.quantile(0.99);
+ *
+ * Serialized layout, little endian:
+ *     uint32 magic, uint16 version, uint8 subBuckets, uint8 octaves,
+ *     uint32 unitsPerValue, uint64 count, uint16 non-empty buckets,
+ *     then per non-empty bucket: uint16 index, uint32 count
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#ifndef NODEMANAGERSKETCH_HPP
+#define NODEMANAGERSKETCH_HPP
+
+constexpr uint32_t nmSketchMagic = 0x4b534e4e; // "NNSK"
+constexpr uint16_t nmSketchVersion = 1;
+constexpr size_t nmSketchSubBuckets = 16; // per power of 2, ~3% error
+constexpr size_t nmSketchOctaves = 28;    // units, up to ~2^31
+constexpr uint32_t nmSketchUnitsPerValue = 1000; // e.g. mW for Watts
+
+/**
+ * @brief Histogram of non-negative values, counted in units of
+ * 1/nmSketchUnitsPerValue with nmSketchSubBuckets linear buckets per power of
+ * 2. Negative values are counted as 0.
+ */
+class NmQuantileSketch
+{
+  public:
+    void add(double value)
+    {
+        double units = value * nmSketchUnitsPerValue;
+        uint64_t scaled =
+            !(units > 0) ? 0
+                         : static_cast<uint64_t>(std::min(
+                               units, static_cast<double>(UINT64_MAX >> 1)));
+        buckets[bucketFor(scaled)]++;
+        samples++;
+    }
+
+    void clear()
+    {
+        buckets.fill(0);
+        samples = 0;
+    }
+
+    uint64_t count() const
+    {
+        return samples;
+    }
+
+    /**
+     * @brief Returns middle of the bucket holding the quantile, NaN when
+     * empty
+     */
+    double quantile(double q) const
+    {
+        if (samples == 0)
+        {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        q = std::clamp(q, 0.0, 1.0);
+        uint64_t rank = std::min<uint64_t>(
+            static_cast<uint64_t>(q * samples), samples - 1);
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+        {
+            seen += buckets[bucket];
+            if (seen > rank)
+            {
+                return (lowerBound(bucket) + lowerBound(bucket + 1)) / 2 /
+                       nmSketchUnitsPerValue;
+            }
+        }
+        return lowerBound(buckets.size()) / nmSketchUnitsPerValue;
+    }
+
+    std::vector<uint8_t> serialize() const
+    {
+        std::vector<uint8_t> data;
+        put(data, nmSketchMagic, 4);
+        put(data, nmSketchVersion, 2);
+        put(data, nmSketchSubBuckets, 1);
+        put(data, nmSketchOctaves, 1);
+        put(data, nmSketchUnitsPerValue, 4);
+        put(data, samples, 8);
+        size_t nonEmpty = static_cast<size_t>(
+            std::count_if(buckets.begin(), buckets.end(),
+                          [](uint32_t count) { return count != 0; }));
+        put(data, nonEmpty, 2);
+        for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+        {
+            if (buckets[bucket] != 0)
+            {
+                put(data, bucket, 2);
+                put(data, buckets[bucket], 4);
+            }
+        }
+        return data;
+    }
+
+    /**
+     * @brief Adds serialized sketch, returns false when its layout differs or
+     * it is not consistent, leaving this sketch untouched then
+     */
+    bool merge(const std::vector<uint8_t> &data)
+    {
+        size_t pos = 0;
+        if (get(data, pos, 4) != nmSketchMagic ||
+            get(data, pos, 2) != nmSketchVersion ||
+            get(data, pos, 1) != nmSketchSubBuckets ||
+            get(data, pos, 1) != nmSketchOctaves ||
+            get(data, pos, 4) != nmSketchUnitsPerValue)
+        {
+            return false;
+        }
+        uint64_t count = get(data, pos, 8);
+        uint64_t nonEmpty = get(data, pos, 2);
+        if (data.size() != pos + nonEmpty * 6)
+        {
+            return false;
+        }
+
+        // validated as a whole first, a rejected sketch adds nothing
+        size_t entries = pos;
+        uint64_t total = 0;
+        uint64_t previous = 0;
+        for (uint64_t entry = 0; entry < nonEmpty; entry++)
+        {
+            uint64_t bucket = get(data, pos, 2);
+            uint64_t bucketCount = get(data, pos, 4);
+            // serialized in increasing order, so no bucket repeats
+            if (bucket >= buckets.size() ||
+                (entry != 0 && bucket <= previous) || bucketCount == 0 ||
+                buckets[bucket] > UINT32_MAX - bucketCount)
+            {
+                return false;
+            }
+            previous = bucket;
+            total += bucketCount;
+        }
+        if (total != count || samples > UINT64_MAX - count)
+        {
+            return false;
+        }
+
+        pos = entries;
+        for (uint64_t entry = 0; entry < nonEmpty; entry++)
+        {
+            uint64_t bucket = get(data, pos, 2);
+            buckets[bucket] += static_cast<uint32_t>(get(data, pos, 4));
+        }
+        samples += count;
+        return true;
+    }
+
+  private:
+    std::array<uint32_t, nmSketchOctaves * nmSketchSubBuckets> buckets{};
+    uint64_t samples{0};
+
+    // Octave 0 holds [0, nmSketchSubBuckets) units linearly, octave N > 0
+    // holds [2^(N-1), 2^N) * nmSketchSubBuckets split into nmSketchSubBuckets
+    static size_t bucketFor(uint64_t units)
+    {
+        size_t octave = 0;
+        while (octave < nmSketchOctaves - 1 &&
+               units >= (nmSketchSubBuckets << octave))
+        {
+            octave++;
+        }
+        uint64_t base = octave == 0 ? 0 : nmSketchSubBuckets << (octave - 1);
+        uint64_t width = octave == 0 ? 1 : uint64_t{1} << (octave - 1);
+        uint64_t sub =
+            std::min<uint64_t>((units - base) / width, nmSketchSubBuckets - 1);
+        return octave * nmSketchSubBuckets + sub;
+    }
+
+    static double lowerBound(size_t bucket)
+    {
+        size_t octave = bucket / nmSketchSubBuckets;
+        size_t sub = bucket % nmSketchSubBuckets;
+        uint64_t base = octave == 0 ? 0 : nmSketchSubBuckets << (octave - 1);
+        uint64_t width = octave == 0 ? 1 : uint64_t{1} << (octave - 1);
+        return static_cast<double>(base + sub * width);
+    }
+
+    static void put(std::vector<uint8_t> &data, uint64_t value, size_t size)
+    {
+        for (size_t byte = 0; byte < size; byte++)
+        {
+            data.push_back(static_cast<uint8_t>(value >> (8 * byte)));
+        }
+    }
+
+    static uint64_t get(const std::vector<uint8_t> &data, size_t &pos,
+                        size_t size)
+    {
+        uint64_t value = 0;
+        for (size_t byte = 0; byte < size && pos < data.size(); byte++)
+        {
+            value |= uint64_t{data[pos++]} << (8 * byte);
+        }
+        return value;
+    }
+};
+
+#endif
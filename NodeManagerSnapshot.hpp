@@ -0,0 +1,201 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * Header-only access to the latest Node Manager Proxy readings.
+ *
+ * The proxy keeps a fixed-layout page in /dev/shm with the most recent value,
+ * timestamp and validity of every reading it polls. Each entry is protected by
+ * a seqlock, so once the page is mapped a reader never makes a syscall nor
+ * touches Dbus:
+ *
+ *     NmSnapshotReader reader;
+ *     NmSnapshotValue power;
+ *     int idx = reader.open() ? reader.find("Total_Power") : -1;
+ *     if (idx >= 0 && reader.read(idx, power) && power.valid) { ... }
+ *
+ * Timestamps are CLOCK_MONOTONIC microseconds.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#ifndef NODEMANAGERSNAPSHOT_HPP
+#define NODEMANAGERSNAPSHOT_HPP
+
+constexpr const char *nmSnapshotShmName = "/node-manager-proxy";
+constexpr uint32_t nmSnapshotMagic = 0x534d4e4e; // "NNMS"
+constexpr uint16_t nmSnapshotVersion = 1;
+constexpr uint32_t nmSnapshotMaxEntries = 64;
+constexpr size_t nmSnapshotNameSize = 48;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+/**
+ * @brief Single reading. Sequence is odd while the proxy updates the entry.
+ */
+struct NmSnapshotEntry
+{
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> valid;
+    std::atomic<uint64_t> value; // IEEE 754 double bits
+    std::atomic<uint64_t> timestampUs;
+    char name[nmSnapshotNameSize];
+};
+static_assert(sizeof(NmSnapshotEntry) == 72);
+
+/**
+ * @brief Shared page layout. Entries are only ever appended; entryCount is
+ * published after the entry name is written.
+ */
+struct NmSnapshotPage
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    std::atomic<uint32_t> entryCount;
+    uint32_t reserved;
+    NmSnapshotEntry entries[nmSnapshotMaxEntries];
+};
+
+/**
+ * @brief Consistent copy of a single reading
+ */
+struct NmSnapshotValue
+{
+    double value;
+    uint64_t timestampUs;
+    bool valid;
+};
+
+/**
+ * @brief Read-only mapping of the proxy snapshot page
+ */
+class NmSnapshotReader
+{
+  public:
+    NmSnapshotReader() = default;
+    NmSnapshotReader(const NmSnapshotReader &) = delete;
+    NmSnapshotReader &operator=(const NmSnapshotReader &) = delete;
+
+    ~NmSnapshotReader()
+    {
+        if (page != nullptr)
+        {
+            munmap(const_cast<NmSnapshotPage *>(page), sizeof(NmSnapshotPage));
+        }
+    }
+
+    /**
+     * @brief Maps the page. Fails if the proxy has not created it yet or its
+     * layout version is not supported.
+     */
+    bool open()
+    {
+        int fd = shm_open(nmSnapshotShmName, O_RDONLY, 0);
+        if (fd < 0)
+        {
+            return false;
+        }
+        void *addr = mmap(nullptr, sizeof(NmSnapshotPage), PROT_READ,
+                          MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED)
+        {
+            return false;
+        }
+
+        auto mapped = static_cast<const NmSnapshotPage *>(addr);
+        if (mapped->magic != nmSnapshotMagic ||
+            mapped->version != nmSnapshotVersion ||
+            mapped->entrySize != sizeof(NmSnapshotEntry))
+        {
+            munmap(addr, sizeof(NmSnapshotPage));
+            return false;
+        }
+        page = mapped;
+        return true;
+    }
+
+    uint32_t size() const
+    {
+        if (page == nullptr)
+        {
+            return 0;
+        }
+        return std::min(page->entryCount.load(std::memory_order_acquire),
+                        nmSnapshotMaxEntries);
+    }
+
+    const char *name(uint32_t index) const
+    {
+        return index < size() ? page->entries[index].name : nullptr;
+    }
+
+    /**
+     * @brief Returns index of the reading with the given name or -1
+     */
+    int find(const char *readingName) const
+    {
+        for (uint32_t index = 0; index < size(); index++)
+        {
+            if (std::strncmp(page->entries[index].name, readingName,
+                             nmSnapshotNameSize) == 0)
+            {
+                return static_cast<int>(index);
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Copies the reading, retrying while the proxy is updating it
+     */
+    bool read(uint32_t index, NmSnapshotValue &out) const
+    {
+        if (index >= size())
+        {
+            return false;
+        }
+
+        const NmSnapshotEntry &entry = page->entries[index];
+        uint32_t before, after;
+        uint64_t bits;
+        do
+        {
+            before = entry.sequence.load(std::memory_order_acquire);
+            bits = entry.value.load(std::memory_order_relaxed);
+            out.timestampUs = entry.timestampUs.load(std::memory_order_relaxed);
+            out.valid = entry.valid.load(std::memory_order_relaxed) != 0;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = entry.sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        std::memcpy(&out.value, &bits, sizeof(out.value));
+        return true;
+    }
+
+  private:
+    const NmSnapshotPage *page{nullptr};
+};
+
+#endif
@@ -0,0 +1,146 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#ifndef POLICYANALYTICS_HPP
+#define POLICYANALYTICS_HPP
+
+/**
+ * @brief Node Manager Policy Analytics DBus interface
+ * The following properties shall be supported, all since the policy was
+ * enabled or its limit changed:
+ * * double TimeOverLimit - seconds with power above the limit
+ * * double MaxOvershoot - largest power above the limit [Watts]
+ * * double AverageOvershoot - average power above the limit while over it
+ * * double SettleTime - seconds until power first dropped to the limit, NaN
+ *   while it did not
+ * * double AverageThrottling - average CPU throttling [%]
+ * * double ObservedTime - seconds covered by the samples
+ */
+constexpr const char *nmPolicyAnalyticsIf =
+    "xyz.openbmc_project.NodeManager.PolicyAnalytics";
+
+/**
+ * @brief Effectiveness of a power limit, computed from the platform power and
+ * throttling samples polled while the policy is active. Every sample holds
+ * until the next one, so the results are weighted by time.
+ */
+class PolicyAnalytics
+{
+  public:
+    /**
+     * @brief Starts a new observation, on enabling or limit change
+     */
+    void reset(uint64_t timestampUs, double limitArg)
+    {
+        *this = PolicyAnalytics();
+        limit = limitArg;
+        changeUs = timestampUs;
+    }
+
+    /**
+     * @param throttling - CPU throttling [%], NaN when not known
+     */
+    void sample(uint64_t timestampUs, double power, double throttling)
+    {
+        if (std::isnan(power) || timestampUs < changeUs)
+        {
+            return;
+        }
+
+        if (lastUs != 0 && timestampUs > lastUs)
+        {
+            double seconds = (timestampUs - lastUs) / 1e6;
+            observedTime += seconds;
+            if (lastPower > limit)
+            {
+                timeOverLimit += seconds;
+            }
+            if (!std::isnan(lastThrottling))
+            {
+                throttlingTime += seconds;
+                throttlingIntegral += lastThrottling * seconds;
+            }
+        }
+
+        if (power > limit)
+        {
+            overshootSamples++;
+            overshootSum += power - limit;
+            maxOvershoot = std::max(maxOvershoot, power - limit);
+        }
+        else if (std::isnan(settleTime))
+        {
+            settleTime = (timestampUs - changeUs) / 1e6;
+        }
+
+        lastUs = timestampUs;
+        lastPower = power;
+        lastThrottling = throttling;
+    }
+
+    double getTimeOverLimit() const
+    {
+        return timeOverLimit;
+    }
+
+    double getMaxOvershoot() const
+    {
+        return maxOvershoot;
+    }
+
+    double getAverageOvershoot() const
+    {
+        return overshootSamples ? overshootSum / overshootSamples : 0;
+    }
+
+    double getSettleTime() const
+    {
+        return settleTime;
+    }
+
+    double getAverageThrottling() const
+    {
+        return throttlingTime > 0 ? throttlingIntegral / throttlingTime
+                                  : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    double getObservedTime() const
+    {
+        return observedTime;
+    }
+
+  private:
+    double limit{0};
+    uint64_t changeUs{0};
+    uint64_t lastUs{0};
+    double lastPower{0};
+    double lastThrottling{std::numeric_limits<double>::quiet_NaN()};
+
+    double observedTime{0};
+    double timeOverLimit{0};
+    double maxOvershoot{0};
+    double overshootSum{0};
+    uint64_t overshootSamples{0};
+    double settleTime{std::numeric_limits<double>::quiet_NaN()};
+    double throttlingTime{0};
+    double throttlingIntegral{0};
+};
+
+#endif
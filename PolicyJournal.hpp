@@ -0,0 +1,608 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <phosphor-logging/log.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef POLICYJOURNAL_HPP
+#define POLICYJOURNAL_HPP
+
+constexpr uint32_t policyJournalMagic = 0x4a504d4e; // "NMPJ"
+constexpr uint16_t policyJournalVersion = 1;
+constexpr size_t policyJournalCompactRecords =
+    64; // records in the file triggering compaction, when also more than
+        // twice the live entries
+
+/**
+ * @brief Little endian serialization into a growing buffer
+ */
+class JournalWriter
+{
+  public:
+    void put8(uint8_t value)
+    {
+        data.push_back(value);
+    }
+
+    void put16(uint16_t value)
+    {
+        put8(static_cast<uint8_t>(value));
+        put8(static_cast<uint8_t>(value >> 8));
+    }
+
+    void put32(uint32_t value)
+    {
+        put16(static_cast<uint16_t>(value));
+        put16(static_cast<uint16_t>(value >> 16));
+    }
+
+    // length prefixed, longer strings are cut
+    void putString(const std::string &value)
+    {
+        uint16_t size = static_cast<uint16_t>(
+            std::min<size_t>(value.size(), UINT16_MAX));
+        put16(size);
+        data.insert(data.end(), value.begin(), value.begin() + size);
+    }
+
+    void putBytes(const std::vector<uint8_t> &value)
+    {
+        data.insert(data.end(), value.begin(), value.end());
+    }
+
+    const std::vector<uint8_t> &getData() const
+    {
+        return data;
+    }
+
+  private:
+    std::vector<uint8_t> data;
+};
+
+/**
+ * @brief Counterpart of JournalWriter, reading past the end gives zeros and
+ * makes the reader not valid
+ */
+class JournalReader
+{
+  public:
+    JournalReader(const uint8_t *dataArg, size_t sizeArg) :
+        data(dataArg), size(sizeArg)
+    {
+    }
+
+    uint8_t get8()
+    {
+        if (pos >= size)
+        {
+            valid = false;
+            return 0;
+        }
+        return data[pos++];
+    }
+
+    uint16_t get16()
+    {
+        uint16_t low = get8();
+        return static_cast<uint16_t>(low | (get8() << 8));
+    }
+
+    uint32_t get32()
+    {
+        uint32_t low = get16();
+        return low | (static_cast<uint32_t>(get16()) << 16);
+    }
+
+    std::string getString()
+    {
+        size_t length = get16();
+        if (length > size - pos)
+        {
+            valid = false;
+            return {};
+        }
+        std::string value(reinterpret_cast<const char *>(data + pos), length);
+        pos += length;
+        return value;
+    }
+
+    // all bytes left
+    std::vector<uint8_t> getRest()
+    {
+        std::vector<uint8_t> value(data + pos, data + size);
+        pos = size;
+        return value;
+    }
+
+    bool isValid() const
+    {
+        return valid;
+    }
+
+  private:
+    const uint8_t *data;
+    size_t size;
+    size_t pos{0};
+    bool valid{true};
+};
+
+/**
+ * @brief CRC-32 (IEEE 802.3) of a journal record
+ */
+uint32_t journalCrc32(const uint8_t *data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t index = 0; index < size; index++)
+    {
+        crc ^= data[index];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Write-ahead journal of key-value entries, used for the policies
+ * created through the proxy so they survive its restart.
+ *
+ * File starts with uint32 magic, uint16 version and uint16 reserved, then
+ * records of uint32 payload length, uint32 CRC-32 of the payload and the
+ * payload: uint8 operation, key string and, for put, the value. Records are
+ * replayed in order up to the first torn or corrupted one. The file is
+ * rewritten with live entries only on startup and once it grows, into a
+ * temporary file renamed over it, so a crash leaves either version intact.
+ * A file not recognized is kept aside as path.bad, journaling is disabled
+ * when that or reading the file fails, so it is never overwritten.
+ */
+class PolicyJournal
+{
+  public:
+    PolicyJournal(const PolicyJournal &) = delete;
+    PolicyJournal &operator=(const PolicyJournal &) = delete;
+
+    explicit PolicyJournal(const std::string &pathArg) : path(pathArg)
+    {
+        if (!replay())
+        {
+            enabled = false;
+            return;
+        }
+        if (!compact())
+        {
+            reopen();
+        }
+    }
+
+    ~PolicyJournal()
+    {
+        commit();
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    /**
+     * @brief Entries with keys starting with prefix, in key order
+     */
+    std::vector<std::pair<std::string, std::vector<uint8_t>>>
+        getEntries(const std::string &prefix) const
+    {
+        std::vector<std::pair<std::string, std::vector<uint8_t>>> result;
+        for (auto entry = entries.lower_bound(prefix);
+             entry != entries.end() &&
+             entry->first.compare(0, prefix.size(), prefix) == 0;
+             entry++)
+        {
+            result.emplace_back(*entry);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Appends entry, written by the next write() or commit()
+     */
+    void put(const std::string &key, const std::vector<uint8_t> &value)
+    {
+        entries[key] = value;
+        append(opPut, key, value);
+    }
+
+    void remove(const std::string &key)
+    {
+        if (entries.erase(key) != 0)
+        {
+            append(opRemove, key, {});
+        }
+    }
+
+    /**
+     * @brief Writes records appended since the last write without waiting
+     * for the storage, a restarted proxy replays them but a power loss may
+     * lose them until the next commit(). Returns false when not written.
+     */
+    bool write()
+    {
+        if (!enabled)
+        {
+            pending.clear();
+            return false;
+        }
+        if (pending.empty())
+        {
+            return true;
+        }
+        bool written = fd >= 0 && writeAll(fd, pending);
+        pending.clear();
+        if (!written)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Policy journal not written",
+                phosphor::logging::entry("FILE=%s", path.c_str()),
+                phosphor::logging::entry("ERRNO=%d", errno));
+            return false;
+        }
+        unsynced = true;
+        return true;
+    }
+
+    /**
+     * @brief Writes records appended since the last commit and makes all
+     * the written ones durable with a single fdatasync, returns false when
+     * they may not be
+     */
+    bool commit()
+    {
+        if (!write())
+        {
+            return false;
+        }
+        if (!unsynced)
+        {
+            return true;
+        }
+        unsynced = false;
+        if (fdatasync(fd) != 0)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Policy journal not synced",
+                phosphor::logging::entry("FILE=%s", path.c_str()),
+                phosphor::logging::entry("ERRNO=%d", errno));
+            return false;
+        }
+        if (records > policyJournalCompactRecords &&
+            records > 2 * entries.size())
+        {
+            compact();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Writes appended records right away and posts commit() to io,
+     * once for all the records written until it runs, so the changes made
+     * in a loop turn share one fdatasync. Replies waiting for the ME are
+     * posted after it, so they are released once the records are durable.
+     */
+    void commitSoon(boost::asio::io_context &io)
+    {
+        if (!write() || commitPosted)
+        {
+            return;
+        }
+        commitPosted = true;
+        boost::asio::post(io, [this]() {
+            commitPosted = false;
+            commit();
+        });
+    }
+
+  private:
+    static constexpr uint8_t opPut = 1;
+    static constexpr uint8_t opRemove = 2;
+    static constexpr size_t headerSize = 8;
+    static constexpr size_t recordHeaderSize = 8;
+
+    std::string path;
+    int fd{-1};
+    bool enabled{true};
+    size_t validSize{0}; // bytes of the file up to the last valid record
+    std::map<std::string, std::vector<uint8_t>> entries;
+    std::vector<uint8_t> pending;
+    bool unsynced{false};     // written since the last fdatasync
+    bool commitPosted{false}; // by commitSoon(), not run yet
+    size_t records{0};        // in the file, including pending ones
+
+    void append(uint8_t op, const std::string &key,
+                const std::vector<uint8_t> &value)
+    {
+        JournalWriter payload;
+        payload.put8(op);
+        payload.putString(key);
+        payload.putBytes(value);
+        appendRecord(pending, payload.getData());
+        records++;
+    }
+
+    static void appendRecord(std::vector<uint8_t> &buffer,
+                             const std::vector<uint8_t> &payload)
+    {
+        JournalWriter record;
+        record.put32(static_cast<uint32_t>(payload.size()));
+        record.put32(journalCrc32(payload.data(), payload.size()));
+        record.putBytes(payload);
+        buffer.insert(buffer.end(), record.getData().begin(),
+                      record.getData().end());
+    }
+
+    static bool writeAll(int file, const std::vector<uint8_t> &data)
+    {
+        size_t written = 0;
+        while (written < data.size())
+        {
+            ssize_t ret =
+                ::write(file, data.data() + written, data.size() - written);
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret <= 0)
+            {
+                return false;
+            }
+            written += static_cast<size_t>(ret);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Rebuilds entries from the file in one pass, returns false when
+     * the file has to be left alone
+     */
+    bool replay()
+    {
+        int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0)
+        {
+            if (errno == ENOENT)
+            {
+                return true;
+            }
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Policy journal cannot be read, journaling disabled",
+                phosphor::logging::entry("FILE=%s", path.c_str()),
+                phosphor::logging::entry("ERRNO=%d", errno));
+            return false;
+        }
+        std::vector<uint8_t> data;
+        uint8_t chunk[4096];
+        ssize_t ret;
+        while ((ret = ::read(file, chunk, sizeof(chunk))) != 0)
+        {
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                phosphor::logging::log<phosphor::logging::level::ERR>(
+                    "Policy journal cannot be read, journaling disabled",
+                    phosphor::logging::entry("FILE=%s", path.c_str()),
+                    phosphor::logging::entry("ERRNO=%d", errno));
+                ::close(file);
+                return false;
+            }
+            data.insert(data.end(), chunk, chunk + ret);
+        }
+        ::close(file);
+        if (data.empty())
+        {
+            return true;
+        }
+
+        JournalReader header(data.data(), data.size());
+        if (header.get32() != policyJournalMagic ||
+            header.get16() != policyJournalVersion)
+        {
+            return keepAside();
+        }
+
+        size_t pos = headerSize;
+        size_t replayed = 0;
+        while (pos + recordHeaderSize <= data.size())
+        {
+            JournalReader record(data.data() + pos, recordHeaderSize);
+            uint32_t length = record.get32();
+            uint32_t crc = record.get32();
+            const uint8_t *payload = data.data() + pos + recordHeaderSize;
+            if (length > data.size() - pos - recordHeaderSize ||
+                journalCrc32(payload, length) != crc)
+            {
+                break;
+            }
+
+            JournalReader reader(payload, length);
+            uint8_t op = reader.get8();
+            std::string key = reader.getString();
+            if (!reader.isValid())
+            {
+                break;
+            }
+            if (op == opPut)
+            {
+                entries[key] = reader.getRest();
+            }
+            else
+            {
+                entries.erase(key);
+            }
+            pos += recordHeaderSize + length;
+            replayed++;
+        }
+        validSize = pos;
+        records = replayed;
+        if (pos != data.size())
+        {
+            // crash while appending, the record was not acknowledged
+            phosphor::logging::log<phosphor::logging::level::WARNING>(
+                "Policy journal torn record dropped",
+                phosphor::logging::entry("FILE=%s", path.c_str()),
+                phosphor::logging::entry("OFFSET=%zu", pos));
+        }
+        phosphor::logging::log<phosphor::logging::level::INFO>(
+            "Policy journal replayed",
+            phosphor::logging::entry("RECORDS=%zu", replayed),
+            phosphor::logging::entry("ENTRIES=%zu", entries.size()));
+        return true;
+    }
+
+    /**
+     * @brief Moves a file of another format or version out of the way, so
+     * it can still be looked at, returns false when it stays in place
+     */
+    bool keepAside()
+    {
+        std::string badPath = path + ".bad";
+        if (std::rename(path.c_str(), badPath.c_str()) != 0)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Policy journal not recognized, journaling disabled",
+                phosphor::logging::entry("FILE=%s", path.c_str()),
+                phosphor::logging::entry("ERRNO=%d", errno));
+            return false;
+        }
+        phosphor::logging::log<phosphor::logging::level::ERR>(
+            "Policy journal not recognized, starting empty",
+            phosphor::logging::entry("FILE=%s", path.c_str()),
+            phosphor::logging::entry("MOVED_TO=%s", badPath.c_str()));
+        return true;
+    }
+
+    static std::vector<uint8_t> makeHeader()
+    {
+        JournalWriter header;
+        header.put32(policyJournalMagic);
+        header.put16(policyJournalVersion);
+        header.put16(0);
+        return header.getData();
+    }
+
+    /**
+     * @brief Rewrites the file with live entries only, returns false when
+     * the previous file is left as it was
+     */
+    bool compact()
+    {
+        pending.clear();
+        std::vector<uint8_t> data = makeHeader();
+        for (const auto &[key, value] : entries)
+        {
+            JournalWriter payload;
+            payload.put8(opPut);
+            payload.putString(key);
+            payload.putBytes(value);
+            appendRecord(data, payload.getData());
+        }
+
+        std::string tmpPath = path + ".tmp";
+        int file = ::open(tmpPath.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        bool written = file >= 0 && writeAll(file, data) && fsync(file) == 0;
+        if (file >= 0)
+        {
+            ::close(file);
+        }
+        if (!written || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Policy journal compaction failed",
+                phosphor::logging::entry("FILE=%s", path.c_str()),
+                phosphor::logging::entry("ERRNO=%d", errno));
+            // keeps appending to the previous file, if any
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+        syncDirectory();
+
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        records = entries.size();
+        return true;
+    }
+
+    /**
+     * @brief Appends to the replayed file when it could not be rewritten on
+     * startup, cut after the last valid record so new records are not
+     * hidden behind a torn one
+     */
+    void reopen()
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0600);
+        bool opened =
+            fd >= 0 && ::ftruncate(fd, static_cast<off_t>(validSize)) == 0;
+        if (opened && validSize == 0)
+        {
+            opened = writeAll(fd, makeHeader()) && fdatasync(fd) == 0;
+        }
+        if (!opened)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Policy journal cannot be opened",
+                phosphor::logging::entry("FILE=%s", path.c_str()),
+                phosphor::logging::entry("ERRNO=%d", errno));
+            if (fd >= 0)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    // makes the rename durable
+    void syncDirectory()
+    {
+        size_t slash = path.rfind('/');
+        std::string directory = slash == std::string::npos
+                                    ? "."
+                                    : slash == 0 ? "/" : path.substr(0, slash);
+        int dir = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir >= 0)
+        {
+            fsync(dir);
+            ::close(dir);
+        }
+    }
+};
+
+#endif
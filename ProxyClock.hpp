@@ -0,0 +1,259 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "AllocationCounter.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+#include <cstdint>
+
+#ifndef PROXYCLOCK_HPP
+#define PROXYCLOCK_HPP
+
+#ifdef NM_VIRTUAL_CLOCK
+
+#include <boost/asio/post.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+constexpr const char *virtualClockIntf =
+    "xyz.openbmc_project.NodeManagerProxy.VirtualClock";
+
+/**
+ * @brief Clock standing still until advanced explicitly. Timers waiting on it
+ * fire in order of their expiry while it is advanced, so hours of polling
+ * take as long as running their handlers.
+ *
+ * Whoever advances the clock also runs the io_contexts of the timers (the
+ * poll thread is not started), which keeps the order of handlers
+ * deterministic. The proxy advances it on request over Dbus, or runs it free
+ * while replaying IPMB traffic fast.
+ */
+class VirtualClock
+{
+  public:
+    using duration = std::chrono::steady_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<VirtualClock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return current;
+    }
+
+    /**
+     * @brief Moves the clock forward, firing expired timers one by one. Their
+     * io_context is polled after each one, so timers armed by the handlers
+     * fire within the same call when they expire before its end.
+     */
+    static void advance(duration step)
+    {
+        time_point end = now() + step;
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto next = waits.begin();
+            if (next == waits.end() || std::get<0>(next->first) > end)
+            {
+                current = end;
+                return;
+            }
+            current = std::max(current, std::get<0>(next->first));
+            Wait wait = std::move(next->second);
+            waits.erase(next);
+            lock.unlock();
+
+            boost::asio::post(wait.io, [handler{std::move(wait.handler)}]() {
+                handler(boost::system::error_code());
+            });
+            if (wait.io.stopped())
+            {
+                wait.io.restart();
+            }
+            wait.io.poll();
+        }
+    }
+
+    /**
+     * @brief Moves the clock to the earliest armed timer and fires it, so the
+     * clock can run free as fast as the handlers are.
+     * @return false when no timer is armed
+     */
+    static bool advanceToNext()
+    {
+        duration step;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (waits.empty())
+            {
+                return false;
+            }
+            step = std::max(std::get<0>(waits.begin()->first) - current,
+                            duration::zero());
+        }
+        advance(step);
+        return true;
+    }
+
+  private:
+    friend class VirtualTimer;
+
+    struct Wait
+    {
+        boost::asio::io_context &io;
+        std::function<void(const boost::system::error_code &)> handler;
+    };
+
+    // Keyed by expiry, then by order of arming to keep equal expiries FIFO
+    using WaitKey = std::tuple<time_point, uint64_t>;
+
+    static inline std::mutex mutex;
+    // Not zero, readings with zero timestamp are considered never taken
+    static inline time_point current{std::chrono::seconds(1)};
+    static inline uint64_t sequence{0};
+    static inline std::map<WaitKey, Wait> waits;
+};
+
+/**
+ * @brief Timer waiting on VirtualClock, providing the subset of
+ * basic_waitable_timer interface used by the proxy
+ */
+class VirtualTimer
+{
+  public:
+    using clock_type = VirtualClock;
+    using duration = VirtualClock::duration;
+    using time_point = VirtualClock::time_point;
+
+    VirtualTimer(const VirtualTimer &) = delete;
+    VirtualTimer &operator=(const VirtualTimer &) = delete;
+
+    explicit VirtualTimer(boost::asio::io_context &ioArg) : io(ioArg)
+    {
+    }
+
+    ~VirtualTimer()
+    {
+        cancel();
+    }
+
+    size_t expires_at(time_point expiryArg)
+    {
+        size_t cancelled = cancel();
+        expiryTime = expiryArg;
+        return cancelled;
+    }
+
+    size_t expires_after(duration after)
+    {
+        return expires_at(VirtualClock::now() + after);
+    }
+
+    time_point expiry() const
+    {
+        return expiryTime;
+    }
+
+    template <typename Handler>
+    void async_wait(Handler &&handler)
+    {
+        // bookkeeping of the simulation, not of the proxy
+        NM_ALLOCATIONS_EXCLUDED();
+        std::lock_guard<std::mutex> lock(VirtualClock::mutex);
+        WaitKey key{expiryTime, VirtualClock::sequence++};
+        VirtualClock::waits.emplace(
+            key, VirtualClock::Wait{io, std::forward<Handler>(handler)});
+        pending.push_back(key);
+    }
+
+    size_t cancel()
+    {
+        NM_ALLOCATIONS_EXCLUDED();
+        std::lock_guard<std::mutex> lock(VirtualClock::mutex);
+        size_t cancelled = 0;
+        for (const WaitKey &key : pending)
+        {
+            auto wait = VirtualClock::waits.find(key);
+            if (wait == VirtualClock::waits.end())
+            {
+                // fired already
+                continue;
+            }
+            auto handler = std::move(wait->second.handler);
+            boost::asio::post(io, [handler{std::move(handler)}]() {
+                handler(boost::asio::error::operation_aborted);
+            });
+            VirtualClock::waits.erase(wait);
+            cancelled++;
+        }
+        pending.clear();
+        return cancelled;
+    }
+
+  private:
+    using WaitKey = VirtualClock::WaitKey;
+
+    boost::asio::io_context &io;
+    time_point expiryTime{};
+    std::vector<WaitKey> pending;
+};
+
+using ProxyClock = VirtualClock;
+using ProxyTimer = VirtualTimer;
+
+#else
+
+/**
+ * @brief Clock and timer driving polling and scheduling. Replaced by
+ * VirtualClock when built with NM_VIRTUAL_CLOCK.
+ */
+using ProxyClock = std::chrono::steady_clock;
+using ProxyTimer = boost::asio::steady_timer;
+
+#endif
+
+/**
+ * @brief Converts ProxyClock timestamp [usec] into CLOCK_REALTIME one [usec
+ * since the Unix epoch]. The offset is taken on every call, so steps of the
+ * wall clock, e.g. time sync after boot, are followed. With the virtual clock
+ * it is taken once, simulated time maps onto wall time from the start.
+ */
+uint64_t proxyToRealtimeUs(uint64_t timestampUs)
+{
+    auto offsetUs = []() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::system_clock::now().time_since_epoch() -
+                   ProxyClock::now().time_since_epoch())
+            .count();
+    };
+#ifdef NM_VIRTUAL_CLOCK
+    static const int64_t offset = offsetUs();
+#else
+    int64_t offset = offsetUs();
+#endif
+    return static_cast<uint64_t>(static_cast<int64_t>(timestampUs) + offset);
+}
+
+#endif
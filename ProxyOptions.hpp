@@ -0,0 +1,426 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "MeChannel.hpp"
+
+#include <getopt.h>
+
+#include <phosphor-logging/log.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <string>
+#include <vector>
+
+#ifndef PROXYOPTIONS_HPP
+#define PROXYOPTIONS_HPP
+
+/**
+ * @brief Command line configuration of the proxy
+ */
+struct ProxyOptions
+{
+    std::vector<ChannelConfig> channels;
+    std::string recordFile; // IPMB traffic is appended to it when not empty
+    std::string replayFile; // IPMB traffic is answered from it when not empty
+    bool replayRealTime{true};
+    bool simulate{false}; // IPMB requests are answered without an ME
+    uint32_t adaptiveBudget{::adaptiveBudget}; // fast requests per minute
+    std::string journalFile{policyJournalPath}; // disabled when empty
+};
+
+/**
+ * @brief Parses "<num>[:<name>[:<hostIndex>]]" channel option
+ */
+std::optional<ChannelConfig> parseChannelOption(const std::string &arg)
+{
+    ChannelConfig config{0, "", 0};
+    size_t nameBegin = arg.find(':');
+    size_t hostBegin = nameBegin == std::string::npos
+                           ? std::string::npos
+                           : arg.find(':', nameBegin + 1);
+    try
+    {
+        unsigned long channel = std::stoul(arg.substr(0, nameBegin));
+        unsigned long hostIndex = hostBegin == std::string::npos
+                                      ? 0
+                                      : std::stoul(arg.substr(hostBegin + 1));
+        if (channel > 0xFF || hostIndex > 0xFF)
+        {
+            throw std::out_of_range(arg);
+        }
+        config.channel = static_cast<uint8_t>(channel);
+        config.hostIndex = static_cast<uint8_t>(hostIndex);
+    }
+    catch (const std::exception &)
+    {
+        phosphor::logging::log<phosphor::logging::level::ERR>(
+            "Invalid channel option",
+            phosphor::logging::entry("OPTION=%s", arg.c_str()));
+        return std::nullopt;
+    }
+    if (nameBegin != std::string::npos)
+    {
+        size_t nameEnd =
+            hostBegin == std::string::npos ? arg.size() : hostBegin;
+        config.name = arg.substr(nameBegin + 1, nameEnd - nameBegin - 1);
+    }
+
+    // Name becomes part of object paths and sensor names
+    for (char c : config.name)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Invalid channel name",
+                phosphor::logging::entry("NAME=%s", config.name.c_str()));
+            return std::nullopt;
+        }
+    }
+    return config;
+}
+
+/**
+ * @brief Parses comma separated window lengths, each a number of seconds with
+ * optional s, m or h suffix. Empty list disables window aggregates.
+ */
+std::optional<std::vector<uint32_t>> parseWindowsOption(const std::string &arg)
+{
+    std::vector<uint32_t> windows;
+    size_t begin = 0;
+    while (begin < arg.size())
+    {
+        size_t end = arg.find(',', begin);
+        if (end == std::string::npos)
+        {
+            end = arg.size();
+        }
+        std::string item = arg.substr(begin, end - begin);
+        begin = end + 1;
+
+        uint32_t multiplier = 1;
+        if (!item.empty() &&
+            !std::isdigit(static_cast<unsigned char>(item.back())))
+        {
+            switch (item.back())
+            {
+                case 's':
+                    break;
+                case 'm':
+                    multiplier = 60;
+                    break;
+                case 'h':
+                    multiplier = 3600;
+                    break;
+                default:
+                    multiplier = 0;
+                    break;
+            }
+            item.pop_back();
+        }
+        try
+        {
+            unsigned long value = std::stoul(item);
+            if (multiplier == 0 || value == 0 || value > 24 * 3600)
+            {
+                throw std::out_of_range(item);
+            }
+            uint32_t seconds = static_cast<uint32_t>(value) * multiplier;
+            if (std::find(windows.begin(), windows.end(), seconds) ==
+                windows.end())
+            {
+                windows.push_back(seconds);
+            }
+        }
+        catch (const std::exception &)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Invalid window option",
+                phosphor::logging::entry("OPTION=%s", arg.c_str()));
+            return std::nullopt;
+        }
+    }
+    return windows;
+}
+
+/**
+ * @brief Parses "<type>/<name>=<expression>" derived sensor option, e.g.
+ * "power/Other_Power=Total_Power-CPU_Power-Memory_Power"
+ */
+std::optional<DerivedSensorConfig> parseDerivedOption(const std::string &arg)
+{
+    size_t nameBegin = arg.find('/');
+    size_t expressionBegin = arg.find('=');
+    if (nameBegin == std::string::npos ||
+        expressionBegin == std::string::npos || expressionBegin < nameBegin)
+    {
+        phosphor::logging::log<phosphor::logging::level::ERR>(
+            "Invalid derived sensor option",
+            phosphor::logging::entry("OPTION=%s", arg.c_str()));
+        return std::nullopt;
+    }
+    std::string type = arg.substr(0, nameBegin);
+    std::string name =
+        arg.substr(nameBegin + 1, expressionBegin - nameBegin - 1);
+
+    // Type and name become part of the object path
+    for (const std::string *item : {&type, &name})
+    {
+        if (item->empty() ||
+            !std::all_of(item->begin(), item->end(), [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+            }))
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "Invalid derived sensor name",
+                phosphor::logging::entry("OPTION=%s", arg.c_str()));
+            return std::nullopt;
+        }
+    }
+
+    auto expression =
+        DerivedExpression::compile(arg.substr(expressionBegin + 1));
+    if (!expression)
+    {
+        phosphor::logging::log<phosphor::logging::level::ERR>(
+            "Invalid derived sensor expression",
+            phosphor::logging::entry("OPTION=%s", arg.c_str()));
+        return std::nullopt;
+    }
+    return DerivedSensorConfig{type, name, std::move(*expression)};
+}
+
+/**
+ * @brief Parses command line:
+ *   --channel <num>[:<name>[:<hostIndex>]] - repeatable, without any the
+ *                                            single default ME channel is used
+ *   --record <file>                        - record IPMB traffic
+ *   --replay <file>                        - answer IPMB requests from log
+ *   --replay-fast                          - do not delay replayed
+ *                                            responses, with the virtual
+ *                                            clock run it free until the
+ *                                            log runs out
+ *   --simulate                             - answer IPMB requests with
+ *                                            zero filled responses
+ *   --policy-stats-interval <seconds>      - refresh period of cached policy
+ *                                            statistics, 0 disables caching
+ *   --windows <len>[,<len>...]             - sensor aggregate windows, e.g.
+ *                                            1m,5m,1h; empty disables them
+ *   --sketch-epoch <seconds>               - restart period of sensor
+ *                                            quantile sketches, 0 never
+ *   --derived <type>/<name>=<expression>   - repeatable, sensor computed
+ *                                            from other sensors of each
+ *                                            channel, e.g. power/Other_Power=
+ *                                            Total_Power-CPU_Power-
+ *                                            Memory_Power
+ *   --adaptive-rate <watts/s>              - power change switching a
+ *                                            sensor to fast readings, 0
+ *                                            disables them
+ *   --adaptive-interval <msec>             - fast readings period
+ *   --adaptive-budget <requests/min>       - fast readings of all channels
+ *   --journal <file>                       - policies restored on startup,
+ *                                            empty disables the journal
+ */
+std::optional<ProxyOptions> parseOptions(int argc, char *argv[])
+{
+    static const option longOptions[] = {
+        {"channel", required_argument, nullptr, 'c'},
+        {"record", required_argument, nullptr, 'r'},
+        {"replay", required_argument, nullptr, 'p'},
+        {"replay-fast", no_argument, nullptr, 'f'},
+        {"simulate", no_argument, nullptr, 's'},
+        {"policy-stats-interval", required_argument, nullptr, 'i'},
+        {"windows", required_argument, nullptr, 'w'},
+        {"sketch-epoch", required_argument, nullptr, 'e'},
+        {"derived", required_argument, nullptr, 'd'},
+        {"adaptive-rate", required_argument, nullptr, 'a'},
+        {"adaptive-interval", required_argument, nullptr, 'n'},
+        {"adaptive-budget", required_argument, nullptr, 'b'},
+        {"journal", required_argument, nullptr, 'j'},
+        {nullptr, 0, nullptr, 0}};
+
+    ProxyOptions options;
+    uint32_t statsInterval = policyStatsInterval;
+    std::optional<std::vector<uint32_t>> windows;
+    uint32_t epoch = sketchEpoch;
+    std::vector<DerivedSensorConfig> derived;
+    double rate = adaptiveRate;
+    uint32_t interval = adaptiveInterval;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:r:p:fsi:w:e:d:a:n:b:j:",
+                              longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+            {
+                auto config = parseChannelOption(optarg);
+                if (!config)
+                {
+                    return std::nullopt;
+                }
+                for (const auto &other : options.channels)
+                {
+                    if (other.channel == config->channel ||
+                        other.name == config->name)
+                    {
+                        phosphor::logging::log<phosphor::logging::level::ERR>(
+                            "Duplicated channel",
+                            phosphor::logging::entry("OPTION=%s", optarg));
+                        return std::nullopt;
+                    }
+                }
+                options.channels.push_back(std::move(*config));
+                break;
+            }
+            case 'r':
+                options.recordFile = optarg;
+                break;
+            case 'j':
+                options.journalFile = optarg;
+                break;
+            case 'p':
+                options.replayFile = optarg;
+                break;
+            case 'f':
+                options.replayRealTime = false;
+                break;
+            case 's':
+                options.simulate = true;
+                break;
+            case 'i':
+                try
+                {
+                    statsInterval =
+                        static_cast<uint32_t>(std::stoul(optarg));
+                }
+                catch (const std::exception &)
+                {
+                    phosphor::logging::log<phosphor::logging::level::ERR>(
+                        "Invalid policy statistics interval",
+                        phosphor::logging::entry("OPTION=%s", optarg));
+                    return std::nullopt;
+                }
+                break;
+            case 'w':
+                windows = parseWindowsOption(optarg);
+                if (!windows)
+                {
+                    return std::nullopt;
+                }
+                break;
+            case 'e':
+                try
+                {
+                    epoch = static_cast<uint32_t>(std::stoul(optarg));
+                }
+                catch (const std::exception &)
+                {
+                    phosphor::logging::log<phosphor::logging::level::ERR>(
+                        "Invalid sketch epoch",
+                        phosphor::logging::entry("OPTION=%s", optarg));
+                    return std::nullopt;
+                }
+                break;
+            case 'd':
+            {
+                auto config = parseDerivedOption(optarg);
+                if (!config)
+                {
+                    return std::nullopt;
+                }
+                for (const auto &other : derived)
+                {
+                    if (other.name == config->name)
+                    {
+                        phosphor::logging::log<phosphor::logging::level::ERR>(
+                            "Duplicated derived sensor",
+                            phosphor::logging::entry("OPTION=%s", optarg));
+                        return std::nullopt;
+                    }
+                }
+                if (std::find(builtInReadingNames.begin(),
+                              builtInReadingNames.end(),
+                              config->name) != builtInReadingNames.end())
+                {
+                    phosphor::logging::log<phosphor::logging::level::ERR>(
+                        "Derived sensor name taken by a built-in sensor",
+                        phosphor::logging::entry("OPTION=%s", optarg));
+                    return std::nullopt;
+                }
+                derived.push_back(std::move(*config));
+                break;
+            }
+            case 'a':
+            case 'n':
+            case 'b':
+                try
+                {
+                    if (opt == 'a')
+                    {
+                        rate = std::stod(optarg);
+                    }
+                    else if (opt == 'n')
+                    {
+                        interval = static_cast<uint32_t>(std::stoul(optarg));
+                    }
+                    else
+                    {
+                        options.adaptiveBudget =
+                            static_cast<uint32_t>(std::stoul(optarg));
+                    }
+                }
+                catch (const std::exception &)
+                {
+                    phosphor::logging::log<phosphor::logging::level::ERR>(
+                        "Invalid adaptive readings option",
+                        phosphor::logging::entry("OPTION=%s", optarg));
+                    return std::nullopt;
+                }
+                break;
+            default:
+                return std::nullopt;
+        }
+    }
+
+    if (!options.replayFile.empty() + options.simulate +
+            !options.recordFile.empty() >
+        1)
+    {
+        phosphor::logging::log<phosphor::logging::level::ERR>(
+            "Recording, replaying and simulating IPMB traffic are exclusive");
+        return std::nullopt;
+    }
+    if (options.channels.empty())
+    {
+        options.channels.push_back({ipmbMeChannelNum, "", 0});
+    }
+    for (auto &config : options.channels)
+    {
+        config.policyStatsInterval = statsInterval;
+        config.sketchEpoch = epoch;
+        config.derived = derived;
+        config.adaptiveRate = rate;
+        config.adaptiveInterval = interval;
+        if (windows)
+        {
+            config.windows = *windows;
+        }
+    }
+    return options;
+}
+
+#endif
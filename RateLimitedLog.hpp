@@ -0,0 +1,155 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <phosphor-logging/log.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#ifndef RATELIMITEDLOG_HPP
+#define RATELIMITEDLOG_HPP
+
+constexpr uint32_t logRateInterval = 60; // seconds
+constexpr uint32_t logRateBurst = 5;     // messages per logRateInterval
+
+/**
+ * @brief Lets through at most logRateBurst messages per logRateInterval and
+ * counts the dropped ones. Safe to share by the serving and the poll thread,
+ * a message may slip through when both start a new interval at once.
+ *
+ * Limiters register themselves, so that flushExpired() reports drops of a
+ * burst which stopped and is never followed by a message let through.
+ */
+class LogRateLimiter
+{
+  public:
+    LogRateLimiter(const LogRateLimiter &) = delete;
+    LogRateLimiter &operator=(const LogRateLimiter &) = delete;
+
+    explicit LogRateLimiter(const char *messageArg) : message(messageArg)
+    {
+        std::lock_guard<std::mutex> lock(limitersMutex);
+        limiters.push_back(this);
+    }
+
+    /**
+     * @brief Decides whether message is logged
+     *
+     * @param suppressed - set to number of messages dropped in the previous
+     * interval by the first message of a new one, untouched otherwise
+     */
+    bool allow(uint32_t &suppressed)
+    {
+        int64_t now = nowMs();
+        int64_t start = intervalStart.load(std::memory_order_relaxed);
+        if (now - start >= int64_t{logRateInterval} * 1000 &&
+            intervalStart.compare_exchange_strong(start, now,
+                                                  std::memory_order_relaxed))
+        {
+            suppressed = dropped.exchange(0, std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+        }
+        if (count.fetch_add(1, std::memory_order_relaxed) < logRateBurst)
+        {
+            return true;
+        }
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void reportSuppressed(uint32_t suppressed) const
+    {
+        phosphor::logging::log<phosphor::logging::level::INFO>(
+            "Suppressed similar messages",
+            phosphor::logging::entry("SUPPRESSED_MESSAGE=%s", message),
+            phosphor::logging::entry("SUPPRESSED=%u", suppressed),
+            phosphor::logging::entry("INTERVAL_S=%u", logRateInterval));
+    }
+
+    /**
+     * @brief Reports drops of every limiter whose interval ended without a
+     * message starting a new one, to be called about every logRateInterval
+     */
+    static void flushExpired()
+    {
+        std::lock_guard<std::mutex> lock(limitersMutex);
+        for (LogRateLimiter *limiter : limiters)
+        {
+            limiter->flush();
+        }
+    }
+
+  private:
+    const char *message;
+
+    static inline std::mutex limitersMutex;
+    static inline std::vector<LogRateLimiter *> limiters;
+
+    static int64_t nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    void flush()
+    {
+        int64_t now = nowMs();
+        int64_t start = intervalStart.load(std::memory_order_relaxed);
+        if (now - start < int64_t{logRateInterval} * 1000 ||
+            dropped.load(std::memory_order_relaxed) == 0 ||
+            !intervalStart.compare_exchange_strong(start, now,
+                                                   std::memory_order_relaxed))
+        {
+            return;
+        }
+        uint32_t suppressed = dropped.exchange(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        reportSuppressed(suppressed);
+    }
+
+    std::atomic<int64_t> intervalStart{std::numeric_limits<int64_t>::min() /
+                                       2};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> dropped{0};
+};
+
+/**
+ * @brief Logs like phosphor::logging::log, limited per call site by its own
+ * LogRateLimiter. Entries are not evaluated, so nothing is formatted, when
+ * the message is dropped. Number of dropped messages is reported before the
+ * first message let through in the next interval, or by flushExpired().
+ */
+#define NM_LOG_RATE_LIMITED(logLevel, message, ...)                            \
+    do                                                                         \
+    {                                                                          \
+        static LogRateLimiter nmLogLimiter(message);                           \
+        uint32_t nmLogSuppressed = 0;                                          \
+        if (nmLogLimiter.allow(nmLogSuppressed))                               \
+        {                                                                      \
+            if (nmLogSuppressed != 0)                                          \
+            {                                                                  \
+                nmLogLimiter.reportSuppressed(nmLogSuppressed);                \
+            }                                                                  \
+            phosphor::logging::log<phosphor::logging::level::logLevel>(        \
+                message, ##__VA_ARGS__);                                       \
+        }                                                                      \
+    } while (0)
+
+#endif
@@ -0,0 +1,186 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <cstdint>
+
+#ifndef REQUESTTRACE_HPP
+#define REQUESTTRACE_HPP
+
+/**
+ * @brief Stages of an IPMB request recorded by the trace
+ */
+enum class TraceStage : uint8_t
+{
+    prepared,
+    sent,
+    answered,
+    published,
+    failed
+};
+
+/**
+ * @brief Trace ids: polled sensors use channel << 8 | sensor index and
+ * policies tracePolicyFlag | channel << 8 | policy id, the flags sit above
+ * the 16 bits of channel and index so that ids never collide
+ */
+constexpr uint32_t tracePolicyFlag = 0x10000;
+constexpr uint32_t traceClientRequest = 0x20000;
+
+#ifdef NM_REQUEST_TRACING
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <string>
+
+constexpr const char *traceIntf = "xyz.openbmc_project.NodeManagerProxy.Trace";
+constexpr const char *traceDumpFile = "/tmp/node-manager-proxy-trace.json";
+constexpr size_t traceRingSize = 4096; // events, must be power of 2
+
+/**
+ * @brief Fixed-size binary trace event. The sequence is the ring position + 1
+ * of the event stored in the slot and 0 while the slot is being written, so
+ * readers can tell a stable slot from one overwritten during the read.
+ */
+struct TraceEvent
+{
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> id;
+    std::atomic<uint64_t> timestampNs;
+    std::atomic<uint32_t> codes; // stage | netFn << 8 | cmd << 16 | cc << 24
+    std::atomic<int32_t> status;
+};
+static_assert(sizeof(TraceEvent) == 24);
+
+/**
+ * @brief In-memory ring of the most recent trace events. Writers only bump an
+ * atomic index, so recording never blocks nor allocates.
+ */
+class RequestTrace
+{
+  public:
+    static void record(TraceStage stage, uint32_t id, uint8_t netFn,
+                       uint8_t cmd, int status, uint8_t cc)
+    {
+        uint32_t position = head.fetch_add(1, std::memory_order_relaxed);
+        TraceEvent &event = ring[position & (traceRingSize - 1)];
+        event.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        event.timestampNs.store(
+            static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count()),
+            std::memory_order_relaxed);
+        event.id.store(id, std::memory_order_relaxed);
+        event.codes.store(static_cast<uint32_t>(stage) | netFn << 8 |
+                              cmd << 16 | static_cast<uint32_t>(cc) << 24,
+                          std::memory_order_relaxed);
+        event.status.store(status, std::memory_order_relaxed);
+        event.sequence.store(position + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Renders recorded events, oldest first, in Chrome trace-event
+     * JSON format
+     */
+    static std::string toChromeJson()
+    {
+        static constexpr const char *stageNames[] = {
+            "prepared", "sent", "answered", "published", "failed"};
+
+        uint32_t end = head.load(std::memory_order_acquire);
+        uint32_t begin = end > traceRingSize ? end - traceRingSize : 0;
+
+        std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        char buf[256];
+        bool first = true;
+        for (uint32_t i = begin; i != end; i++)
+        {
+            const TraceEvent &event = ring[i & (traceRingSize - 1)];
+            if (event.sequence.load(std::memory_order_acquire) != i + 1)
+            {
+                // still being written or already overwritten
+                continue;
+            }
+            uint64_t timestampNs =
+                event.timestampNs.load(std::memory_order_relaxed);
+            uint32_t id = event.id.load(std::memory_order_relaxed);
+            uint32_t codes = event.codes.load(std::memory_order_relaxed);
+            int status = event.status.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (event.sequence.load(std::memory_order_relaxed) != i + 1)
+            {
+                continue;
+            }
+            uint8_t stage = codes & 0xFF;
+            if (stage >= std::size(stageNames))
+            {
+                continue;
+            }
+            std::snprintf(
+                buf, sizeof(buf),
+                "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,"
+                "\"tid\":%u,\"ts\":%.3f,\"args\":{\"netFn\":%u,\"cmd\":%u,"
+                "\"status\":%d,\"cc\":%u}}",
+                first ? "" : ",", stageNames[stage], id,
+                timestampNs / 1000.0, (codes >> 8) & 0xFF,
+                (codes >> 16) & 0xFF, status, codes >> 24);
+            json += buf;
+            first = false;
+        }
+        json += "]}";
+        return json;
+    }
+
+    static bool dumpToFile(const char *path)
+    {
+        std::string json = toChromeJson();
+        FILE *file = std::fopen(path, "w");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        bool ok = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+        return (std::fclose(file) == 0) && ok;
+    }
+
+  private:
+    static_assert((traceRingSize & (traceRingSize - 1)) == 0);
+
+    static inline std::array<TraceEvent, traceRingSize> ring{};
+    static inline std::atomic<uint32_t> head{0};
+};
+
+#define NM_TRACE(stage, id, netFn, cmd, status, cc)                            \
+    RequestTrace::record(TraceStage::stage, id, netFn, cmd, status, cc)
+
+#define NM_TRACE_ID(id) (id)
+
+#else
+
+#define NM_TRACE(stage, id, netFn, cmd, status, cc)                            \
+    do                                                                         \
+    {                                                                          \
+    } while (0)
+
+// ids are not evaluated when tracing is disabled
+#define NM_TRACE_ID(id) traceClientRequest
+
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "LoopMonitor.hpp"
+#include "NodeManagerSketch.hpp"
+#include "ProxyClock.hpp"
+
+#include <sdbusplus/asio/object_server.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifndef SENSORQUANTILES_HPP
+#define SENSORQUANTILES_HPP
+
+/**
+ * @brief Node Manager Quantiles DBus interface, on sensors
+ * The following method shall be supported:
+ * * GetQuantiles
+ * * * std::vector<double> - requested quantiles, e.g. 0.5, 0.95, 0.99
+ * * * return std::vector<double> - values of the quantiles, NaN when empty
+ * * * return uint64_t - number of samples
+ * * * return uint64_t - wall clock time the current epoch started at,
+ * * * usec since the Unix epoch
+ * * * return std::vector<uint8_t> - serialized sketch, see
+ * * * NodeManagerSketch.hpp
+ * The following property shall be supported:
+ * * uint64_t EpochDuration - seconds after which the sketch restarts, 0 when
+ *   it never does
+ */
+constexpr const char *nmQuantilesIf =
+    "xyz.openbmc_project.NodeManager.Quantiles";
+
+/**
+ * @brief Quantile sketch of a sensor readings, restarted every epoch so
+ * percentiles reflect e.g. the current billing period. Epochs are aligned to
+ * the wall clock, so sketches of different nodes cover the same period.
+ */
+class SensorQuantiles
+{
+  public:
+    SensorQuantiles(const SensorQuantiles &) = delete;
+    SensorQuantiles &operator=(const SensorQuantiles &) = delete;
+
+    /**
+     * @param epochSeconds - epochs are aligned to multiples of it since the
+     * Unix epoch, 0 never restarts
+     */
+    SensorQuantiles(sdbusplus::asio::object_server &serverArg,
+                    const std::string &path, uint32_t epochSeconds) :
+        server(serverArg),
+        epochUs(uint64_t{epochSeconds} * 1000000)
+    {
+        iface = server.add_interface(path, nmQuantilesIf);
+        iface->register_property("EpochDuration", uint64_t{epochSeconds});
+        iface->register_method(
+            "GetQuantiles", [this](const std::vector<double> &quantiles) {
+                HandlerScope scope("Sensor.GetQuantiles");
+                if (epochUs != 0)
+                {
+                    // no sample may have arrived since the epoch ended
+                    rollEpoch(proxyToRealtimeUs(nowUs()));
+                }
+                std::vector<double> values;
+                values.reserve(quantiles.size());
+                for (double quantile : quantiles)
+                {
+                    values.push_back(sketch.quantile(quantile));
+                }
+                return std::make_tuple(values, sketch.count(), epochStartUs,
+                                       sketch.serialize());
+            });
+        iface->initialize();
+    }
+
+    ~SensorQuantiles()
+    {
+        server.remove_interface(iface);
+    }
+
+    void add(uint64_t timestampUs, double value)
+    {
+        rollEpoch(proxyToRealtimeUs(timestampUs));
+        sketch.add(value);
+    }
+
+  private:
+    sdbusplus::asio::object_server &server;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
+    NmQuantileSketch sketch;
+    uint64_t epochUs;
+    uint64_t epochStartUs{0}; // wall clock, 0 before the first sample
+
+    static uint64_t nowUs()
+    {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                ProxyClock::now().time_since_epoch())
+                .count());
+    }
+
+    // restarts the sketch when realtimeUs is past the current epoch
+    void rollEpoch(uint64_t realtimeUs)
+    {
+        // the wall clock may also step back
+        if (epochStartUs == 0 ||
+            (epochUs != 0 && (realtimeUs < epochStartUs ||
+                              realtimeUs - epochStartUs >= epochUs)))
+        {
+            sketch.clear();
+            epochStartUs = epochUs == 0 ? realtimeUs
+                                        : realtimeUs - realtimeUs % epochUs;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,133 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "NodeManagerSnapshot.hpp"
+
+#include <phosphor-logging/log.hpp>
+
+#include <cerrno>
+#include <string>
+
+#ifndef SNAPSHOTWRITER_HPP
+#define SNAPSHOTWRITER_HPP
+
+/**
+ * @brief Proxy side of the /dev/shm readings snapshot. Only the thread polling
+ * the ME updates entries, which makes it the single seqlock writer.
+ */
+class SnapshotWriter
+{
+  public:
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    SnapshotWriter()
+    {
+        int fd = shm_open(nmSnapshotShmName, O_CREAT | O_RDWR, 0644);
+        if (fd < 0)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "SnapshotWriter: shm_open failed",
+                phosphor::logging::entry("ERRNO=%d", errno));
+            return;
+        }
+        if (ftruncate(fd, sizeof(NmSnapshotPage)) != 0)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "SnapshotWriter: ftruncate failed",
+                phosphor::logging::entry("ERRNO=%d", errno));
+            ::close(fd);
+            return;
+        }
+        void *addr = mmap(nullptr, sizeof(NmSnapshotPage),
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "SnapshotWriter: mmap failed",
+                phosphor::logging::entry("ERRNO=%d", errno));
+            return;
+        }
+
+        // Readers validate magic, so invalidate it while the page is being
+        // laid out again after a proxy restart
+        page = static_cast<NmSnapshotPage *>(addr);
+        page->magic = 0;
+        page->entryCount.store(0, std::memory_order_release);
+        std::memset(static_cast<void *>(page->entries), 0,
+                    sizeof(page->entries));
+        page->version = nmSnapshotVersion;
+        page->entrySize = sizeof(NmSnapshotEntry);
+        page->reserved = 0;
+        std::atomic_thread_fence(std::memory_order_release);
+        page->magic = nmSnapshotMagic;
+    }
+
+    ~SnapshotWriter()
+    {
+        if (page != nullptr)
+        {
+            munmap(page, sizeof(NmSnapshotPage));
+        }
+    }
+
+    /**
+     * @brief Appends entry for a reading, returns false if there is no room
+     * left or the page is not mapped
+     */
+    bool add(uint32_t index, const std::string &name)
+    {
+        if (page == nullptr || index >= nmSnapshotMaxEntries)
+        {
+            return false;
+        }
+
+        NmSnapshotEntry &entry = page->entries[index];
+        std::strncpy(entry.name, name.c_str(), nmSnapshotNameSize - 1);
+        entry.name[nmSnapshotNameSize - 1] = '\0';
+        uint32_t count = page->entryCount.load(std::memory_order_relaxed);
+        if (index >= count)
+        {
+            page->entryCount.store(index + 1, std::memory_order_release);
+        }
+        return true;
+    }
+
+    void update(uint32_t index, double value, uint64_t timestampUs, bool valid)
+    {
+        if (page == nullptr || index >= nmSnapshotMaxEntries)
+        {
+            return;
+        }
+
+        NmSnapshotEntry &entry = page->entries[index];
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        uint32_t sequence = entry.sequence.load(std::memory_order_relaxed);
+        entry.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        entry.value.store(bits, std::memory_order_relaxed);
+        entry.timestampUs.store(timestampUs, std::memory_order_relaxed);
+        entry.valid.store(valid ? 1 : 0, std::memory_order_relaxed);
+        entry.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+  private:
+    NmSnapshotPage *page{nullptr};
+};
+
+#endif
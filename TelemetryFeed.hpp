@@ -0,0 +1,375 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <boost/asio/basic_socket_acceptor.hpp>
+#include <boost/asio/generic/seq_packet_protocol.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/container/flat_map.hpp>
+#include <phosphor-logging/log.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef TELEMETRYFEED_HPP
+#define TELEMETRYFEED_HPP
+
+/**
+ * @brief Telemetry feed defines
+ */
+constexpr const char *telemetrySocketPath =
+    "/run/node-manager-proxy/telemetry";
+constexpr size_t telemetryMaxSubscribers = 16;
+constexpr size_t telemetryQueueDepth = 64; // frames per subscriber
+constexpr size_t telemetryNameSize = 48;
+constexpr uint32_t telemetryAcceptRetry = 1; // seconds after an accept error
+
+/**
+ * @brief Frames sent by clients over the SOCK_SEQPACKET socket, one request
+ * per packet, native byte order
+ */
+constexpr uint8_t telemetryOpSubscribe = 1;
+constexpr uint8_t telemetryOpUnsubscribe = 2;
+constexpr uint8_t telemetryOpList = 3;
+
+struct TelemetryRequest
+{
+    uint8_t op;
+    uint8_t reserved;
+    uint16_t id;            // reading id, 0xFFFF - all readings
+    uint32_t minIntervalMs; // subscribe only, 0 - every sample
+};
+static_assert(sizeof(TelemetryRequest) == 8);
+
+constexpr uint16_t telemetryAllReadings = 0xFFFF;
+
+/**
+ * @brief Frames pushed by the proxy
+ */
+constexpr uint8_t telemetryFrameSample = 1;
+constexpr uint8_t telemetryFrameName = 2;
+
+struct TelemetrySample
+{
+    uint8_t type;
+    uint8_t valid;
+    uint16_t id;
+    uint32_t dropped; // frames dropped for this subscriber so far
+    double value;
+    uint64_t timestampUs; // CLOCK_MONOTONIC
+};
+static_assert(sizeof(TelemetrySample) == 24);
+
+struct TelemetryName
+{
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t id;
+    char name[telemetryNameSize];
+};
+static_assert(sizeof(TelemetryName) == 52);
+
+using TelemetryFrame = std::array<uint8_t, sizeof(TelemetryName)>;
+using TelemetryNames =
+    std::function<std::vector<std::pair<uint16_t, std::string>>()>;
+using SeqPacketProtocol = boost::asio::generic::seq_packet_protocol;
+
+/**
+ * @brief Single client of the feed. Frames are queued up to
+ * telemetryQueueDepth, the oldest is dropped when the client does not keep up.
+ * Queue storage is fixed, so publishing does not allocate.
+ */
+class TelemetrySubscriber :
+    public std::enable_shared_from_this<TelemetrySubscriber>
+{
+  public:
+    TelemetrySubscriber(SeqPacketProtocol::socket &&socketArg,
+                        const TelemetryNames &namesArg) :
+        socket(std::move(socketArg)),
+        names(namesArg)
+    {
+    }
+
+    void start()
+    {
+        receive();
+    }
+
+    bool isOpen() const
+    {
+        return socket.is_open();
+    }
+
+    void offer(uint16_t id, double value, uint64_t timestampUs, bool valid)
+    {
+        auto sub = subscriptions.find(id);
+        if (sub == subscriptions.end())
+        {
+            sub = subscriptions.find(telemetryAllReadings);
+            if (sub == subscriptions.end())
+            {
+                return;
+            }
+        }
+
+        uint64_t &lastSent = lastSentUs[id];
+        uint64_t minIntervalUs = uint64_t{sub->second} * 1000;
+        if (lastSent != 0 && timestampUs - lastSent < minIntervalUs)
+        {
+            return;
+        }
+        lastSent = timestampUs;
+
+        TelemetrySample sample{telemetryFrameSample,
+                               static_cast<uint8_t>(valid),
+                               id,
+                               dropped,
+                               value,
+                               timestampUs};
+        enqueue(&sample, sizeof(sample));
+    }
+
+    void close()
+    {
+        boost::system::error_code ec;
+        socket.close(ec);
+    }
+
+  private:
+    SeqPacketProtocol::socket socket;
+    TelemetryNames names;
+    boost::container::flat_map<uint16_t, uint32_t> subscriptions;
+    boost::container::flat_map<uint16_t, uint64_t> lastSentUs;
+    std::array<std::pair<TelemetryFrame, size_t>, telemetryQueueDepth> queue;
+    size_t queueHead{0};
+    size_t queueSize{0};
+    std::pair<TelemetryFrame, size_t> inFlight;
+    TelemetryRequest request{};
+    boost::asio::socket_base::message_flags receiveFlags{0};
+    uint32_t dropped{0};
+    bool sending{false};
+
+    void enqueue(const void *frame, size_t size)
+    {
+        if (queueSize >= telemetryQueueDepth)
+        {
+            queueHead = (queueHead + 1) % telemetryQueueDepth;
+            queueSize--;
+            dropped++;
+        }
+        auto &slot = queue[(queueHead + queueSize) % telemetryQueueDepth];
+        std::memcpy(slot.first.data(), frame, size);
+        slot.second = size;
+        queueSize++;
+        send();
+    }
+
+    void send()
+    {
+        if (sending || queueSize == 0 || !socket.is_open())
+        {
+            return;
+        }
+        // Frame being sent is moved out of the queue, so dropping the oldest
+        // queued frame never touches the buffer owned by the pending send
+        inFlight = queue[queueHead];
+        queueHead = (queueHead + 1) % telemetryQueueDepth;
+        queueSize--;
+
+        sending = true;
+        socket.async_send(
+            boost::asio::buffer(inFlight.first.data(), inFlight.second), 0,
+            [self = shared_from_this()](const boost::system::error_code &ec,
+                                        size_t) {
+                self->sending = false;
+                if (ec)
+                {
+                    self->close();
+                    return;
+                }
+                self->send();
+            });
+    }
+
+    void receive()
+    {
+        socket.async_receive(
+            boost::asio::buffer(&request, sizeof(request)), receiveFlags,
+            [self = shared_from_this()](const boost::system::error_code &ec,
+                                        size_t size) {
+                if (ec || size == 0)
+                {
+                    self->close();
+                    return;
+                }
+                if (size == sizeof(TelemetryRequest))
+                {
+                    self->handleRequest();
+                }
+                self->receive();
+            });
+    }
+
+    void handleRequest()
+    {
+        switch (request.op)
+        {
+            case telemetryOpSubscribe:
+                subscriptions[request.id] = request.minIntervalMs;
+                break;
+            case telemetryOpUnsubscribe:
+                subscriptions.erase(request.id);
+                lastSentUs.erase(request.id);
+                break;
+            case telemetryOpList:
+                for (const auto &[id, name] : names())
+                {
+                    TelemetryName frame{telemetryFrameName, 0, id, {}};
+                    std::strncpy(frame.name, name.c_str(),
+                                 telemetryNameSize - 1);
+                    enqueue(&frame, sizeof(frame));
+                }
+                break;
+            default:
+                break;
+        }
+    }
+};
+
+/**
+ * @brief Local AF_UNIX SOCK_SEQPACKET endpoint pushing reading samples to
+ * subscribed clients as soon as the poll pipeline gets them
+ */
+class TelemetryFeed
+{
+  public:
+    TelemetryFeed(const TelemetryFeed &) = delete;
+    TelemetryFeed &operator=(const TelemetryFeed &) = delete;
+
+    TelemetryFeed(boost::asio::io_context &io, TelemetryNames namesArg) :
+        acceptor(io), retryTimer(io), names(std::move(namesArg))
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, telemetrySocketPath,
+                     sizeof(addr.sun_path) - 1);
+        ::unlink(telemetrySocketPath);
+
+        boost::system::error_code ec;
+        acceptor.open(SeqPacketProtocol(AF_UNIX, 0), ec);
+        if (!ec)
+        {
+            acceptor.bind(SeqPacketProtocol::endpoint(&addr, sizeof(addr)),
+                          ec);
+        }
+        if (!ec)
+        {
+            acceptor.listen(boost::asio::socket_base::max_listen_connections,
+                            ec);
+        }
+        if (ec)
+        {
+            phosphor::logging::log<phosphor::logging::level::ERR>(
+                "TelemetryFeed: cannot listen on socket",
+                phosphor::logging::entry("PATH=%s", telemetrySocketPath),
+                phosphor::logging::entry("ERROR=%s", ec.message().c_str()));
+            acceptor.close(ec);
+            return;
+        }
+        accept();
+    }
+
+    /**
+     * @brief Offers a new sample to all subscribers, never blocks
+     */
+    void publish(uint16_t id, double value, uint64_t timestampUs, bool valid)
+    {
+        for (auto it = subscribers.begin(); it != subscribers.end();)
+        {
+            if (!(*it)->isOpen())
+            {
+                it = subscribers.erase(it);
+                continue;
+            }
+            (*it)->offer(id, value, timestampUs, valid);
+            it++;
+        }
+    }
+
+  private:
+    boost::asio::basic_socket_acceptor<SeqPacketProtocol> acceptor;
+    boost::asio::steady_timer retryTimer;
+    TelemetryNames names;
+    std::vector<std::shared_ptr<TelemetrySubscriber>> subscribers;
+
+    void accept()
+    {
+        acceptor.async_accept([this](const boost::system::error_code &ec,
+                                     SeqPacketProtocol::socket socket) {
+            if (ec == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            if (ec)
+            {
+                // e.g. out of descriptors, accepting again right away would
+                // only spin on the same error
+                phosphor::logging::log<phosphor::logging::level::ERR>(
+                    "TelemetryFeed: accept error",
+                    phosphor::logging::entry("ERROR=%s", ec.message().c_str()));
+                retryTimer.expires_after(
+                    std::chrono::seconds(telemetryAcceptRetry));
+                retryTimer.async_wait(
+                    [this](const boost::system::error_code &ec) {
+                        if (!ec)
+                        {
+                            accept();
+                        }
+                    });
+                return;
+            }
+
+            subscribers.erase(
+                std::remove_if(subscribers.begin(), subscribers.end(),
+                               [](const auto &sub) { return !sub->isOpen(); }),
+                subscribers.end());
+
+            if (subscribers.size() >= telemetryMaxSubscribers)
+            {
+                phosphor::logging::log<phosphor::logging::level::WARNING>(
+                    "TelemetryFeed: too many subscribers, rejecting");
+            }
+            else
+            {
+                auto subscriber = std::make_shared<TelemetrySubscriber>(
+                    std::move(socket), names);
+                subscribers.push_back(subscriber);
+                subscriber->start();
+            }
+            accept();
+        });
+    }
+};
+
+#endif
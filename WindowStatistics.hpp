@@ -0,0 +1,238 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <sdbusplus/asio/object_server.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef WINDOWSTATISTICS_HPP
+#define WINDOWSTATISTICS_HPP
+
+/**
+ * @brief Node Manager Window Statistics DBus interface, on sensors
+ * The following properties shall be supported for every configured window,
+ * e.g. for 5 minutes window:
+ * * double Average5m
+ * * double Min5m
+ * * double Max5m
+ */
+constexpr const char *nmWindowStatisticsIf =
+    "xyz.openbmc_project.NodeManager.WindowStatistics";
+
+constexpr size_t windowBuckets = 12; // window slides by 1/windowBuckets
+
+/**
+ * @brief Min/max/average of samples within a sliding time window. Samples
+ * are added into buckets of 1/windowBuckets of the window, so both memory and
+ * update cost are constant, and the window moves by a bucket at a time.
+ */
+class WindowAggregate
+{
+  public:
+    explicit WindowAggregate(uint32_t windowSeconds) :
+        bucketUs(std::max<uint64_t>(uint64_t{windowSeconds} * 1000000 /
+                                        windowBuckets,
+                                    1))
+    {
+    }
+
+    void add(uint64_t timestampUs, double value)
+    {
+        uint64_t index = timestampUs / bucketUs;
+        Bucket &bucket = buckets[index % windowBuckets];
+        if (bucket.index != index || bucket.count == 0)
+        {
+            bucket = Bucket{index, value, value, 0, 0};
+        }
+        bucket.min = std::min(bucket.min, value);
+        bucket.max = std::max(bucket.max, value);
+        bucket.sum += value;
+        bucket.count++;
+    }
+
+    /**
+     * @brief Aggregates of the window ending at given time, NaN when there
+     * are no samples in it
+     */
+    void get(uint64_t timestampUs, double &min, double &max,
+             double &average) const
+    {
+        uint64_t current = timestampUs / bucketUs;
+        double sum = 0;
+        uint64_t count = 0;
+        min = std::numeric_limits<double>::infinity();
+        max = -std::numeric_limits<double>::infinity();
+        for (const Bucket &bucket : buckets)
+        {
+            if (bucket.count == 0 || bucket.index > current ||
+                current - bucket.index >= windowBuckets)
+            {
+                continue;
+            }
+            min = std::min(min, bucket.min);
+            max = std::max(max, bucket.max);
+            sum += bucket.sum;
+            count += bucket.count;
+        }
+        if (count == 0)
+        {
+            min = max = average = std::numeric_limits<double>::quiet_NaN();
+            return;
+        }
+        average = sum / count;
+    }
+
+  private:
+    struct Bucket
+    {
+        uint64_t index;
+        double min;
+        double max;
+        double sum;
+        uint64_t count;
+    };
+
+    uint64_t bucketUs;
+    std::array<Bucket, windowBuckets> buckets{};
+};
+
+/**
+ * @brief Window aggregates of a sensor published on its object
+ */
+class WindowStatistics
+{
+  public:
+    WindowStatistics(const WindowStatistics &) = delete;
+    WindowStatistics &operator=(const WindowStatistics &) = delete;
+
+    /**
+     * @param windows - window lengths [seconds]
+     */
+    WindowStatistics(sdbusplus::asio::object_server &serverArg,
+                     const std::string &path,
+                     const std::vector<uint32_t> &windows) :
+        server(serverArg)
+    {
+        iface = server.add_interface(path, nmWindowStatisticsIf);
+        for (uint32_t seconds : windows)
+        {
+            Window &window = this->windows.emplace_back(
+                Window{windowSuffix(seconds), WindowAggregate(seconds), {}});
+            window.published.fill(std::numeric_limits<double>::quiet_NaN());
+            for (const std::string &name : aggregateNames)
+            {
+                iface->register_property(
+                    name + window.suffix,
+                    std::numeric_limits<double>::quiet_NaN());
+            }
+        }
+        iface->initialize();
+    }
+
+    ~WindowStatistics()
+    {
+        server.remove_interface(iface);
+    }
+
+    void add(uint64_t timestampUs, double value)
+    {
+        for (Window &window : windows)
+        {
+            window.aggregate.add(timestampUs, value);
+        }
+        publish(timestampUs);
+    }
+
+    /**
+     * @brief Publishes aggregates of windows ending at given time. Called
+     * also without new samples, so that samples leaving the windows expire
+     * and aggregates become NaN once no reading is in the window.
+     */
+    void publish(uint64_t timestampUs)
+    {
+        for (Window &window : windows)
+        {
+            std::array<double, 3> values;
+            window.aggregate.get(timestampUs, values[1], values[2], values[0]);
+            for (size_t index = 0; index < values.size(); index++)
+            {
+                // NaN never equals itself, it would be signalled every time
+                double &published = window.published[index];
+                if (values[index] == published ||
+                    (std::isnan(values[index]) && std::isnan(published)))
+                {
+                    continue;
+                }
+                published = values[index];
+                iface->set_property(aggregateNames[index] + window.suffix,
+                                    published);
+            }
+        }
+    }
+
+    /**
+     * @brief Period of re-publishing aggregates without new samples, the
+     * shortest window moves by a bucket
+     */
+    static std::chrono::milliseconds
+        refreshInterval(const std::vector<uint32_t> &windows)
+    {
+        uint32_t shortest = *std::min_element(windows.begin(), windows.end());
+        return std::max(std::chrono::milliseconds(uint64_t{shortest} * 1000 /
+                                                  windowBuckets),
+                        std::chrono::milliseconds(1000));
+    }
+
+    /**
+     * @brief Property name suffix of a window, e.g. "90s", "5m" or "1h"
+     */
+    static std::string windowSuffix(uint32_t seconds)
+    {
+        if (seconds % 3600 == 0)
+        {
+            return std::to_string(seconds / 3600) + 'h';
+        }
+        if (seconds % 60 == 0)
+        {
+            return std::to_string(seconds / 60) + 'm';
+        }
+        return std::to_string(seconds) + 's';
+    }
+
+  private:
+    struct Window
+    {
+        std::string suffix;
+        WindowAggregate aggregate;
+        std::array<double, 3> published; // in order of aggregateNames
+    };
+
+    static inline const std::array<std::string, 3> aggregateNames{
+        "Average", "Min", "Max"};
+
+    sdbusplus::asio::object_server &server;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
+    std::vector<Window> windows;
+};
+
+#endif
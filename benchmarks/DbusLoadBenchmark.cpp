@@ -0,0 +1,527 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "LoopMonitor.hpp"
+#include "NodeManagerProxy.hpp"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/asio/io_context.hpp>
+#include <sdbusplus/asio/connection.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+// Starts a private dbus-daemon and the proxy on it answering simulated IPMB
+// traffic, then keeps Dbus calls outstanding from a number of clients, each
+// on its own bus connection as Redfish sessions are, for a while. Reports
+// throughput and latency percentiles per operation along with CPU and memory
+// used by the proxy meanwhile.
+//
+//   dbusload_benchmark [operations] [clients] [seconds] [proxy]
+//
+// Operations are a comma separated mix of statistics (GetAllStatistics),
+// sensor (Total_Power Value), domain and policy (GetStatistics),
+// capabilities (domain Max), limit (policy Limit write), create
+// (CreateWithId) and delete. Every client runs them in turn, starting at its
+// own position, so all of them are in flight at once. Policy and limit use a
+// policy created upfront, create and delete one policy id per client.
+
+#ifndef NM_PROXY_BINARY
+#define NM_PROXY_BINARY "node-manager-proxy"
+#endif
+
+constexpr const char *dbusDaemon = "dbus-daemon";
+constexpr const char *defaultOperations = "statistics";
+constexpr int defaultClients = 8;
+constexpr int defaultDuration = 10;      // seconds
+constexpr int startupTimeout = 10;       // seconds
+constexpr int warmupDuration = 2;        // seconds
+constexpr int startupPollInterval = 100; // msec
+constexpr const char *sharedPolicyId = "10";
+constexpr int firstClientPolicyId = 16; // up to 253, ids of the ME
+constexpr int maxPolicyClients = 200;
+constexpr uint16_t loadLimits[] = {300, 400}; // Watts, written in turn
+
+enum class Operation
+{
+    statistics,
+    sensor,
+    domainStatistics,
+    policyStatistics,
+    capabilities,
+    limit,
+    create,
+    remove
+};
+
+constexpr std::array<const char *, 8> operationNames = {
+    "statistics", "sensor", "domain", "policy",
+    "capabilities", "limit", "create", "delete"};
+
+struct OperationResult
+{
+    LatencyHistogram latency;
+    uint64_t errors{0};
+};
+
+using OperationResults = std::array<OperationResult, operationNames.size()>;
+
+static pid_t spawn(const std::vector<std::string> &args)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        std::vector<char *> argv;
+        for (const std::string &arg : args)
+        {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        std::fprintf(stderr, "Cannot run %s: %s\n", argv[0],
+                     std::strerror(errno));
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop(pid_t pid)
+{
+    if (pid > 0)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+/**
+ * @brief Starts dbus-daemon with the session configuration, which lets the
+ * proxy own its name, and returns its address
+ */
+static std::string startBus(pid_t &pid)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return {};
+    }
+    pid = spawn({dbusDaemon, "--session", "--nofork", "--nopidfile",
+                 "--print-address=" + std::to_string(fds[1])});
+    close(fds[1]);
+
+    std::string address;
+    char c;
+    while (read(fds[0], &c, 1) == 1 && c != '\n')
+    {
+        address += c;
+    }
+    close(fds[0]);
+    return address;
+}
+
+static bool waitForProxy(sdbusplus::asio::connection &conn)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(startupTimeout);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        try
+        {
+            auto call = conn.new_method_call(
+                "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                "org.freedesktop.DBus", "NameHasOwner");
+            call.append(nmdBus);
+            auto reply = conn.call(call);
+            bool owned = false;
+            reply.read(owned);
+            if (owned)
+            {
+                return true;
+            }
+        }
+        catch (const sdbusplus::exception::SdBusError &)
+        {
+        }
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(startupPollInterval));
+    }
+    return false;
+}
+
+static std::string domainPath()
+{
+    return std::string(nmRootPath) + "/Domain/" + domainIdToName[dcTotal];
+}
+
+static std::string policyPath(const std::string &policyId)
+{
+    return domainPath() + "/Policy/" + policyId;
+}
+
+static PolicyParamsTuple makePolicyParams(uint16_t limit)
+{
+    return PolicyParamsTuple(6000, limit, 10, 0, 0, 0, {}, {}, 0, 0,
+                             "AlwaysOn");
+}
+
+/**
+ * @brief Client on its own bus connection keeping one call outstanding,
+ * issuing the next one from the completion of the previous. The loop is
+ * stopped when the last client is done, connections always wait for
+ * messages.
+ */
+class LoadClient
+{
+  public:
+    LoadClient(boost::asio::io_context &io,
+               const std::vector<Operation> &operationsArg, size_t index,
+               size_t &runningArg) :
+        conn(std::make_shared<sdbusplus::asio::connection>(io)),
+        operations(operationsArg), next(index),
+        policyId(std::to_string(firstClientPolicyId + index)),
+        running(runningArg)
+    {
+    }
+
+    void run(std::chrono::steady_clock::time_point endArg,
+             OperationResults &resultsArg)
+    {
+        end = endArg;
+        results = &resultsArg;
+        running++;
+        call();
+    }
+
+  private:
+    std::shared_ptr<sdbusplus::asio::connection> conn;
+    const std::vector<Operation> &operations;
+    size_t next;
+    std::string policyId;
+    bool created{false};
+    size_t limitIndex{0};
+    size_t &running;
+    OperationResults *results{nullptr};
+    std::chrono::steady_clock::time_point end;
+
+    void call()
+    {
+        Operation operation = operations[next++ % operations.size()];
+        if (operation == Operation::remove && !created)
+        {
+            // nothing to delete yet
+            operation = Operation::create;
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto done = [this, operation,
+                     start](boost::system::error_code ec,
+                            sdbusplus::message::message &) {
+            auto now = std::chrono::steady_clock::now();
+            OperationResult &result =
+                (*results)[static_cast<size_t>(operation)];
+            if (ec)
+            {
+                result.errors++;
+            }
+            else
+            {
+                result.latency.record(now - start);
+                if (operation == Operation::create)
+                {
+                    created = true;
+                }
+                else if (operation == Operation::remove)
+                {
+                    created = false;
+                }
+            }
+            if (now < end)
+            {
+                call();
+                return;
+            }
+            if (--running == 0)
+            {
+                conn->get_io_context().stop();
+            }
+        };
+
+        switch (operation)
+        {
+            case Operation::statistics:
+                conn->async_method_call(std::move(done), nmdBus, nmRootPath,
+                                        nmAllStatisticsIf,
+                                        "GetAllStatistics");
+                break;
+            case Operation::sensor:
+                conn->async_method_call(
+                    std::move(done), nmdBus,
+                    std::string(propObj) + "power/Total_Power",
+                    "org.freedesktop.DBus.Properties", "Get", nmdSensorIntf,
+                    "Value");
+                break;
+            case Operation::domainStatistics:
+                conn->async_method_call(std::move(done), nmdBus, domainPath(),
+                                        nmStatisitcsIf, "GetStatistics");
+                break;
+            case Operation::policyStatistics:
+                conn->async_method_call(std::move(done), nmdBus,
+                                        policyPath(sharedPolicyId),
+                                        nmStatisitcsIf, "GetStatistics");
+                break;
+            case Operation::capabilities:
+                conn->async_method_call(
+                    std::move(done), nmdBus, domainPath(),
+                    "org.freedesktop.DBus.Properties", "Get",
+                    nmDomainCapabilitesIf, "Max");
+                break;
+            case Operation::limit:
+                limitIndex = (limitIndex + 1) % std::size(loadLimits);
+                conn->async_method_call(
+                    std::move(done), nmdBus, policyPath(sharedPolicyId),
+                    "org.freedesktop.DBus.Properties", "Set",
+                    nmPolicyAttributesIf, "Limit",
+                    std::variant<uint16_t>(loadLimits[limitIndex]));
+                break;
+            case Operation::create:
+                conn->async_method_call(
+                    std::move(done), nmdBus, domainPath(),
+                    nmDomainPolicyManagerIf, "CreateWithId", policyId,
+                    makePolicyParams(loadLimits[0]));
+                break;
+            case Operation::remove:
+                conn->async_method_call(std::move(done), nmdBus,
+                                        policyPath(policyId),
+                                        "xyz.openbmc_project.Object.Delete",
+                                        "Delete");
+                break;
+        }
+    }
+};
+
+/**
+ * @brief Runs all clients for the duration, returns seconds until the last
+ * call was served
+ */
+static double runLoad(boost::asio::io_context &io,
+                      std::vector<std::unique_ptr<LoadClient>> &clients,
+                      std::chrono::seconds duration,
+                      OperationResults &results)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (auto &client : clients)
+    {
+        client->run(start + duration, results);
+    }
+    io.restart();
+    io.run();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static bool parseOperations(const char *list,
+                            std::vector<Operation> &operations)
+{
+    std::string names(list);
+    size_t pos = 0;
+    while (pos <= names.size())
+    {
+        size_t comma = std::min(names.find(',', pos), names.size());
+        std::string name = names.substr(pos, comma - pos);
+        auto found = std::find_if(
+            operationNames.begin(), operationNames.end(),
+            [&name](const char *known) { return name == known; });
+        if (found == operationNames.end())
+        {
+            return false;
+        }
+        operations.push_back(
+            static_cast<Operation>(found - operationNames.begin()));
+        pos = comma + 1;
+    }
+    return !operations.empty();
+}
+
+/**
+ * @brief CPU time and memory of a process, from procfs
+ */
+struct ProcessUsage
+{
+    uint64_t cpuTicks{0};
+    uint64_t rssKiB{0};
+    uint64_t peakRssKiB{0};
+};
+
+static ProcessUsage readUsage(pid_t pid)
+{
+    ProcessUsage usage;
+    std::string proc = "/proc/" + std::to_string(pid);
+    FILE *stat = std::fopen((proc + "/stat").c_str(), "r");
+    if (stat != nullptr)
+    {
+        unsigned long utime = 0, stime = 0;
+        // Fields 14 and 15, the command name in field 2 has no spaces
+        if (std::fscanf(stat,
+                        "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+                        "%*u %lu %lu",
+                        &utime, &stime) == 2)
+        {
+            usage.cpuTicks = utime + stime;
+        }
+        std::fclose(stat);
+    }
+    FILE *status = std::fopen((proc + "/status").c_str(), "r");
+    if (status != nullptr)
+    {
+        char line[256];
+        while (std::fgets(line, sizeof(line), status) != nullptr)
+        {
+            std::sscanf(line, "VmRSS: %" SCNu64, &usage.rssKiB);
+            std::sscanf(line, "VmHWM: %" SCNu64, &usage.peakRssKiB);
+        }
+        std::fclose(status);
+    }
+    return usage;
+}
+
+/**
+ * @brief Creates the policy read and written by the policy and limit
+ * operations
+ */
+static bool createSharedPolicy(sdbusplus::asio::connection &conn)
+{
+    try
+    {
+        auto call = conn.new_method_call(nmdBus, domainPath().c_str(),
+                                         nmDomainPolicyManagerIf,
+                                         "CreateWithId");
+        call.append(std::string(sharedPolicyId),
+                    makePolicyParams(loadLimits[0]));
+        conn.call(call);
+        return true;
+    }
+    catch (const sdbusplus::exception::SdBusError &)
+    {
+        return false;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<Operation> operations;
+    bool parsed =
+        parseOperations(argc > 1 ? argv[1] : defaultOperations, operations);
+    int clientCount = argc > 2 ? std::atoi(argv[2]) : defaultClients;
+    int duration = argc > 3 ? std::atoi(argv[3]) : defaultDuration;
+    const char *proxy = argc > 4 ? argv[4] : NM_PROXY_BINARY;
+    if (!parsed || clientCount <= 0 || clientCount > maxPolicyClients ||
+        duration <= 0)
+    {
+        std::fprintf(stderr,
+                     "Usage: %s [operations] [clients] [seconds] [proxy]\n"
+                     "  operations - comma separated statistics, sensor, "
+                     "domain, policy,\n"
+                     "               capabilities, limit, create, delete\n"
+                     "  clients - 1 to %d\n",
+                     argv[0], maxPolicyClients);
+        return 1;
+    }
+
+    pid_t busPid = -1;
+    std::string address = startBus(busPid);
+    if (address.empty())
+    {
+        std::fprintf(stderr, "Cannot start %s\n", dbusDaemon);
+        stop(busPid);
+        return 1;
+    }
+    // Both the proxy and the clients connect to their default bus
+    setenv("DBUS_SYSTEM_BUS_ADDRESS", address.c_str(), 1);
+    setenv("DBUS_SESSION_BUS_ADDRESS", address.c_str(), 1);
+
+    pid_t proxyPid = spawn({proxy, "--simulate", "--journal", ""});
+
+    boost::asio::io_context io;
+    auto conn = std::make_shared<sdbusplus::asio::connection>(io);
+    if (!waitForProxy(*conn) || !createSharedPolicy(*conn))
+    {
+        std::fprintf(stderr, "%s did not start\n", proxy);
+        stop(proxyPid);
+        stop(busPid);
+        return 1;
+    }
+
+    size_t running = 0;
+    std::vector<std::unique_ptr<LoadClient>> clients;
+    for (int client = 0; client < clientCount; client++)
+    {
+        clients.push_back(std::make_unique<LoadClient>(
+            io, operations, static_cast<size_t>(client), running));
+    }
+    OperationResults warmup;
+    runLoad(io, clients, std::chrono::seconds(warmupDuration), warmup);
+
+    OperationResults results;
+    ProcessUsage before = readUsage(proxyPid);
+    double elapsed =
+        runLoad(io, clients, std::chrono::seconds(duration), results);
+    ProcessUsage after = readUsage(proxyPid);
+
+    std::printf("%d clients, %.1f s\n", clientCount, elapsed);
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    for (size_t operation = 0; operation < results.size(); operation++)
+    {
+        const OperationResult &result = results[operation];
+        if (result.latency.count() == 0 && result.errors == 0)
+        {
+            continue;
+        }
+        calls += result.latency.count();
+        errors += result.errors;
+        std::printf("%-12s calls %" PRIu64 " errors %" PRIu64
+                    " p50 %.3f ms p99 %.3f ms p999 %.3f ms\n",
+                    operationNames[operation], result.latency.count(),
+                    result.errors, result.latency.percentileMs(0.50),
+                    result.latency.percentileMs(0.99),
+                    result.latency.percentileMs(0.999));
+    }
+    std::printf("calls %" PRIu64 " errors %" PRIu64 " throughput %.1f/s\n",
+                calls, errors, calls / elapsed);
+    std::printf("proxy cpu %.1f%% rss %" PRIu64 " KiB peak %" PRIu64
+                " KiB\n",
+                100.0 * (after.cpuTicks - before.cpuTicks) /
+                    sysconf(_SC_CLK_TCK) / elapsed,
+                after.rssKiB, after.peakRssKiB);
+
+    clients.clear();
+    stop(proxyPid);
+    stop(busPid);
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "IpmiCodec.hpp"
+#include "NodeManagerProxy.hpp"
+
+#include <cstring>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+// Codecs compared with the struct copies they replaced, for the request sent
+// on a policy change and the response decoded for every polled frame
+
+constexpr size_t statisticsSize =
+    IpmiCommand<nmIpmiGetNmStatisticsReq>::responseSize;
+
+static nmIpmiSetNmPolicyReq makeSetPolicy()
+{
+    nmIpmiSetNmPolicyReq req = {0};
+    ipmiSetIntelIanaNumber(req.iana);
+    req.policyEnabled = 1;
+    req.policyId = 7;
+    req.configurationAction = 1;
+    req.limit = 400;
+    req.correctionTime = 6000;
+    req.statsPeriod = 10;
+    return req;
+}
+
+static void BM_EncodeSetPolicy(benchmark::State &state)
+{
+    nmIpmiSetNmPolicyReq req = makeSetPolicy();
+    std::vector<uint8_t> data;
+    data.reserve(maxFrameSize);
+    for (auto _ : state)
+    {
+        ipmiSerialize(req, data);
+        benchmark::DoNotOptimize(data.data());
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_EncodeSetPolicy);
+
+static void BM_CopySetPolicy(benchmark::State &state)
+{
+    nmIpmiSetNmPolicyReq req = makeSetPolicy();
+    std::vector<uint8_t> data;
+    data.reserve(maxFrameSize);
+    for (auto _ : state)
+    {
+        data.resize(sizeof(req));
+        std::memcpy(data.data(), &req, sizeof(req));
+        benchmark::DoNotOptimize(data.data());
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_CopySetPolicy);
+
+static void BM_DecodeStatistics(benchmark::State &state)
+{
+    std::vector<uint8_t> data(statisticsSize, 0x5A);
+    nmIpmiGetNmStatisticsResp resp = {0};
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(
+            ipmiDeserialize<nmIpmiGetNmStatisticsReq>(data, resp));
+        benchmark::DoNotOptimize(resp);
+    }
+}
+BENCHMARK(BM_DecodeStatistics);
+
+static void BM_CopyStatistics(benchmark::State &state)
+{
+    std::vector<uint8_t> data(statisticsSize, 0x5A);
+    nmIpmiGetNmStatisticsResp resp = {0};
+    for (auto _ : state)
+    {
+        if (data.size() == sizeof(resp))
+        {
+            std::memcpy(&resp, data.data(), sizeof(resp));
+        }
+        benchmark::DoNotOptimize(resp);
+    }
+}
+BENCHMARK(BM_CopyStatistics);
+
+// Decoding unaligned within a larger buffer, as payloads read from a message
+static void BM_DecodeStatisticsUnaligned(benchmark::State &state)
+{
+    std::vector<uint8_t> buffer(statisticsSize + 1, 0x5A);
+    nmIpmiGetNmStatisticsResp resp = {0};
+    for (auto _ : state)
+    {
+        IpmiReader reader(buffer.data() + 1);
+        ipmiDecode(reader, resp);
+        benchmark::DoNotOptimize(resp);
+    }
+}
+BENCHMARK(BM_DecodeStatisticsUnaligned);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,210 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "IpmiCodec.hpp"
+#include "NodeManagerProxy.hpp"
+
+#include <array>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(IpmiCodecTest, WritesLsByteFirst)
+{
+    std::array<uint8_t, 9> data{};
+    IpmiWriter writer(data.data());
+    writer.put16(0x1234);
+    writer.put24(0x563412);
+    writer.put32(0x12345678);
+
+    EXPECT_EQ(writer.size(), data.size());
+    EXPECT_EQ(data, (std::array<uint8_t, 9>{0x34, 0x12, 0x12, 0x34, 0x56,
+                                            0x78, 0x56, 0x34, 0x12}));
+}
+
+TEST(IpmiCodecTest, ReadsLsByteFirst)
+{
+    const std::array<uint8_t, 9> data{0x34, 0x12, 0x12, 0x34, 0x56,
+                                      0x78, 0x56, 0x34, 0x12};
+    IpmiReader reader(data.data());
+
+    EXPECT_EQ(reader.get16(), 0x1234);
+    EXPECT_EQ(reader.get24(), 0x563412u);
+    EXPECT_EQ(reader.get32(), 0x12345678u);
+    EXPECT_EQ(reader.size(), data.size());
+}
+
+TEST(IpmiCodecTest, RoundTripsAtUnalignedOffsets)
+{
+    for (size_t offset = 0; offset < 8; offset++)
+    {
+        std::array<uint8_t, 32> data{};
+        IpmiWriter writer(data.data() + offset);
+        writer.put8(0xA5);
+        writer.put32(0xDEADBEEF);
+        writer.put16(0xCAFE);
+        writer.put24(0xC0FFEE);
+
+        IpmiReader reader(data.data() + offset);
+        EXPECT_EQ(reader.get8(), 0xA5) << "offset " << offset;
+        EXPECT_EQ(reader.get32(), 0xDEADBEEFu) << "offset " << offset;
+        EXPECT_EQ(reader.get16(), 0xCAFE) << "offset " << offset;
+        EXPECT_EQ(reader.get24(), 0xC0FFEEu) << "offset " << offset;
+        EXPECT_EQ(data[offset + 1], 0xEF) << "offset " << offset;
+    }
+}
+
+TEST(IpmiCodecTest, EncodesSetPolicy)
+{
+    nmIpmiSetNmPolicyReq req = {0};
+    ipmiSetIntelIanaNumber(req.iana);
+    req.domainId = 0;
+    req.policyEnabled = 1;
+    req.policyId = 7;
+    req.triggerType = 0;
+    req.configurationAction = 1;
+    req.cpuPowerCorrection = 2;
+    req.storageOption = 1;
+    req.sendAlert = 1;
+    req.shutdownSystem = 0;
+    req.limit = 400;
+    req.correctionTime = 6000;
+    req.triggerLimit = 0;
+    req.statsPeriod = 10;
+
+    std::vector<uint8_t> data;
+    ipmiSerialize(req, data);
+
+    EXPECT_EQ(data, (std::vector<uint8_t>{0x57, 0x01, 0x00, 0x10, 0x07, 0xD0,
+                                          0x01, 0x90, 0x01, 0x70, 0x17, 0x00,
+                                          0x00, 0x00, 0x00, 0x0A, 0x00}));
+}
+
+TEST(IpmiCodecTest, DecodesStatistics)
+{
+    const std::vector<uint8_t> data{0x57, 0x01, 0x00, 0x2C, 0x01, 0x64, 0x00,
+                                    0xF4, 0x01, 0xC8, 0x00, 0x78, 0x56, 0x34,
+                                    0x12, 0x3C, 0x00, 0x00, 0x00, 0x50};
+    nmIpmiGetNmStatisticsResp resp = {0};
+
+    ASSERT_TRUE(ipmiDeserialize<nmIpmiGetNmStatisticsReq>(data, resp));
+    EXPECT_EQ(resp.data.stats.cur, 300);
+    EXPECT_EQ(resp.data.stats.min, 100);
+    EXPECT_EQ(resp.data.stats.max, 500);
+    EXPECT_EQ(resp.data.stats.avg, 200);
+    EXPECT_EQ(resp.timeStamp, 0x12345678u);
+    EXPECT_EQ(resp.statsReportPeriod, 60u);
+    EXPECT_EQ(resp.domainId, 0);
+    EXPECT_EQ(resp.policyGlobalState, 1);
+    EXPECT_EQ(resp.policyOperationalState, 0);
+    EXPECT_EQ(resp.measurmentsState, 1);
+    EXPECT_EQ(resp.policyActivationState, 0);
+}
+
+TEST(IpmiCodecTest, RejectsWrongResponseSize)
+{
+    nmIpmiGetNmPolicyResp resp = {0};
+    EXPECT_FALSE(ipmiDeserialize<nmIpmiGetNmPolicyReq>(
+        std::vector<uint8_t>(15), resp));
+    EXPECT_FALSE(ipmiDeserialize<nmIpmiGetNmPolicyReq>(
+        std::vector<uint8_t>(17), resp));
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/**
+ * @brief On little endian hosts with the GCC bit field layout the packed
+ * structs match the wire format, so the codecs have to move random payloads
+ * exactly as a struct copy would
+ */
+class IpmiCodecRandomTest : public ::testing::Test
+{
+  protected:
+    std::mt19937 random{20211019};
+
+    std::vector<uint8_t> randomPayload(size_t size)
+    {
+        std::uniform_int_distribution<int> byte(0, 255);
+        std::vector<uint8_t> data(size);
+        for (uint8_t &value : data)
+        {
+            value = static_cast<uint8_t>(byte(random));
+        }
+        return data;
+    }
+
+    template <typename Req>
+    void checkRequest()
+    {
+        static_assert(sizeof(Req) == IpmiCommand<Req>::requestSize);
+        for (int run = 0; run < 1000; run++)
+        {
+            std::vector<uint8_t> payload = randomPayload(sizeof(Req));
+            Req req;
+            std::memcpy(&req, payload.data(), sizeof(req));
+
+            std::vector<uint8_t> data;
+            ipmiSerialize(req, data);
+            ASSERT_EQ(data, payload);
+        }
+    }
+
+    template <typename Req>
+    void checkResponse()
+    {
+        using Resp = typename IpmiCommand<Req>::Response;
+        static_assert(sizeof(Resp) == IpmiCommand<Req>::responseSize);
+        for (int run = 0; run < 1000; run++)
+        {
+            std::vector<uint8_t> payload = randomPayload(sizeof(Resp));
+            Resp resp;
+            std::memset(&resp, 0, sizeof(resp));
+
+            ASSERT_TRUE(ipmiDeserialize<Req>(payload, resp));
+            ASSERT_EQ(std::memcmp(&resp, payload.data(), sizeof(resp)), 0);
+        }
+    }
+};
+
+TEST_F(IpmiCodecRandomTest, GetDeviceIdMatchesStructLayout)
+{
+    checkResponse<ipmiGetDeviceIdReq>();
+}
+
+TEST_F(IpmiCodecRandomTest, GetStatisticsMatchesStructLayout)
+{
+    checkRequest<nmIpmiGetNmStatisticsReq>();
+    checkResponse<nmIpmiGetNmStatisticsReq>();
+}
+
+TEST_F(IpmiCodecRandomTest, SetPolicyMatchesStructLayout)
+{
+    checkRequest<nmIpmiSetNmPolicyReq>();
+    checkResponse<nmIpmiSetNmPolicyReq>();
+}
+
+TEST_F(IpmiCodecRandomTest, GetPolicyMatchesStructLayout)
+{
+    checkRequest<nmIpmiGetNmPolicyReq>();
+    checkResponse<nmIpmiGetNmPolicyReq>();
+}
+
+TEST_F(IpmiCodecRandomTest, GetCapabilitiesMatchesStructLayout)
+{
+    checkRequest<nmIpmiGetNmCapabilitesReq>();
+    checkResponse<nmIpmiGetNmCapabilitesReq>();
+}
+#endif
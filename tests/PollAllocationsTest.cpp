@@ -0,0 +1,178 @@
+/* Copyright 2021 Intel
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include "AllocationCounter.hpp"
+#include "IpmbReplay.hpp"
+#include "MeChannel.hpp"
+#include "NodeManagerProxy.hpp"
+
+#include <sdbusplus/test/sdbus_mock.hpp>
+
+#include <memory>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+/**
+ * @brief Answers statistics requests right away from a response reused for
+ * all of them, so that whatever the poll path allocates is the channel's own.
+ * They are answered with the configured completion code and current value,
+ * other commands are not supported.
+ */
+class ReusingIpmbTransport : public IpmbTransport
+{
+  public:
+    void asyncSendRequest(uint8_t, const std::vector<uint8_t> &,
+                          uint8_t netFn, uint8_t lun, uint8_t cmd,
+                          IpmbHandler handler) override
+    {
+        constexpr uint8_t ccInvalidCommand = 0xC1;
+        using Statistics = IpmiCommand<nmIpmiGetNmStatisticsReq>;
+        if (netFn != Statistics::netFn || cmd != Statistics::cmd)
+        {
+            // handlers of these may take the payload away
+            IpmbDbusRspType unsupported{0, static_cast<uint8_t>(netFn | 1),
+                                        lun, cmd, ccInvalidCommand,
+                                        std::vector<uint8_t>{}};
+            handler(boost::system::error_code(), unsupported);
+            return;
+        }
+        auto &[status, rspNetFn, rspLun, rspCmd, cc, data] = response;
+        status = 0;
+        rspNetFn = static_cast<uint8_t>(netFn | 1);
+        rspLun = lun;
+        rspCmd = cmd;
+        cc = completionCode;
+        data.resize(cc == 0 ? Statistics::responseSize : 0);
+        if (!data.empty())
+        {
+            data[sizeof(ipmiIana)] = current;
+        }
+        statisticsRequests++;
+        handler(boost::system::error_code(), response);
+    }
+
+    uint8_t completionCode{0};
+    uint8_t current{0};
+    uint64_t statisticsRequests{0};
+
+  private:
+    IpmbDbusRspType response{0, 0, 0, 0, 0,
+                             std::vector<uint8_t>(maxFrameSize)};
+};
+
+/**
+ * @brief Channel polled on the virtual clock through the reusing transport,
+ * readings cycles run processRequests and sendRequest as the proxy does
+ */
+class PollAllocationsTest : public ::testing::Test
+{
+  protected:
+    PollAllocationsTest() :
+        conn(std::make_shared<sdbusplus::asio::connection>(
+            io, sdbusplus::get_mocked_new(&sdbusMock))),
+        pollConn(std::make_shared<sdbusplus::asio::connection>(
+            pollIo, sdbusplus::get_mocked_new(&pollSdbusMock))),
+        server(conn), transport(std::make_shared<ReusingIpmbTransport>())
+    {
+        ChannelConfig config{0, "", 0};
+        // adaptive readings are on the same path, keep the cadence fixed
+        config.adaptiveRate = 0;
+        channel = std::make_unique<MeChannel>(
+            conn, pollConn, transport, server, config, 0, 1,
+            [](Request &) {}, std::make_shared<RequestBudget>(0));
+        channel->start();
+        pollCycle();
+    }
+
+    // one readings cycle, its samples are then published on the serving
+    // side, outside of the counted scopes
+    void pollCycle()
+    {
+        VirtualClock::advance(std::chrono::seconds(readingsInterval));
+        io.restart();
+        io.poll();
+    }
+
+    boost::asio::io_context io;
+    boost::asio::io_context pollIo;
+    ::testing::NiceMock<sdbusplus::SdBusMock> sdbusMock;
+    ::testing::NiceMock<sdbusplus::SdBusMock> pollSdbusMock;
+    std::shared_ptr<sdbusplus::asio::connection> conn;
+    std::shared_ptr<sdbusplus::asio::connection> pollConn;
+    sdbusplus::asio::object_server server;
+    std::shared_ptr<ReusingIpmbTransport> transport;
+    std::unique_ptr<MeChannel> channel;
+};
+
+TEST(AllocationCounterTest, CountsOnlyScopedNotExcluded)
+{
+    uint64_t before = AllocationCounter::getScoped();
+    auto outside = std::make_unique<int>(0);
+    EXPECT_EQ(AllocationCounter::getScoped(), before);
+    {
+        NM_ALLOCATIONS_SCOPE();
+        auto inside = std::make_unique<int>(1);
+        {
+            NM_ALLOCATIONS_EXCLUDED();
+            auto excluded = std::make_unique<int>(2);
+        }
+        EXPECT_EQ(AllocationCounter::getScoped(), before + 1);
+    }
+    auto after = std::make_unique<int>(3);
+    EXPECT_EQ(AllocationCounter::getScoped(), before + 1);
+}
+
+TEST_F(PollAllocationsTest, SteadyStatePollingDoesNotAllocate)
+{
+    // first cycles may size buffers
+    for (uint8_t cycle = 0; cycle < 3; cycle++)
+    {
+        transport->current = cycle;
+        pollCycle();
+    }
+
+    uint64_t before = AllocationCounter::getScoped();
+    uint64_t requests = transport->statisticsRequests;
+    for (uint8_t cycle = 3; cycle < 100; cycle++)
+    {
+        transport->current = cycle;
+        pollCycle();
+    }
+    EXPECT_EQ(AllocationCounter::getScoped(), before);
+    EXPECT_GT(transport->statisticsRequests, requests);
+
+    const Reading &power = channel->getSensors()[1]->getReadings().front();
+    EXPECT_TRUE(power.valid);
+    EXPECT_EQ(power.value, 99);
+}
+
+TEST_F(PollAllocationsTest, FailedResponsesDoNotAllocate)
+{
+    transport->completionCode = ipmiCcNodeBusy;
+    pollCycle();
+
+    uint64_t before = AllocationCounter::getScoped();
+    uint64_t requests = transport->statisticsRequests;
+    for (int cycle = 0; cycle < 10; cycle++)
+    {
+        pollCycle();
+    }
+    EXPECT_EQ(AllocationCounter::getScoped(), before);
+    EXPECT_GT(transport->statisticsRequests, requests);
+
+    EXPECT_FALSE(channel->getSensors()[1]->getReadings().front().valid);
+}